@@ -0,0 +1,486 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Plays animations rendered on a PC from flash. They are uploaded as files
+ * with the MCUmgr file system group and started by name over BLE. Frames
+ * are read through a small read-ahead buffer and decoded straight into the
+ * pixel buffer, so an animation of any length needs no more RAM than its
+ * largest frame.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/fs/fs.h>
+#include <zephyr/fs/littlefs.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include <lumen/anim.h>
+
+#include "anim.h"
+#include "link.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(anim, CONFIG_APP_LOG_LEVEL);
+
+#define ANIM_MOUNT_POINT "/lfs"
+#define ANIM_NAME_MAX 32
+#define ANIM_REPORT_MS 1000
+
+BUILD_ASSERT(CONFIG_APP_ANIM_READAHEAD >= sizeof(struct anim_frame_hdr),
+	"CONFIG_APP_ANIM_READAHEAD too small for a frame header");
+
+/** Playback report characteristic value, all fields little endian. */
+struct anim_report
+{
+	/** Frames shown since playback started. */
+	uint32_t frames;
+	/** Average and longest time to decode a frame. */
+	uint16_t decode_us;
+	uint16_t decode_max_us;
+	/** Bytes read from flash per second of playback. */
+	uint32_t flash_bytes_per_sec;
+	/** Bytes read per second spent reading, what the flash could do. */
+	uint32_t flash_read_bytes_per_sec;
+} __packed;
+
+static struct bt_uuid_128 anim_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef6));
+static struct bt_uuid_128 anim_play_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef7));
+static struct bt_uuid_128 anim_report_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef8));
+
+FS_LITTLEFS_DECLARE_DEFAULT_CONFIG(anim_fs_data);
+static struct fs_mount_t anim_mount =
+{
+	.type = FS_LITTLEFS,
+	.fs_data = &anim_fs_data,
+	.storage_dev = (void*) FIXED_PARTITION_ID(littlefs_storage),
+	.mnt_point = ANIM_MOUNT_POINT,
+};
+
+/* Requests from BLE, picked up by the render thread. */
+static K_MUTEX_DEFINE(anim_lock);
+static char anim_request[ANIM_NAME_MAX + 1];
+static atomic_t anim_requested;
+static struct anim_report anim_last_report;
+
+/* Playback, only touched by the render thread. */
+static size_t anim_strip_pixels;
+static struct fs_file_t anim_file;
+static struct anim_hdr anim_hdr;
+static bool anim_playing;
+static bool anim_resync;
+static uint32_t anim_frame;
+static int64_t anim_due_ms;
+
+static uint8_t readahead[CONFIG_APP_ANIM_READAHEAD];
+static size_t readahead_pos;
+static size_t readahead_len;
+
+/* Costs since the last report. */
+static struct
+{
+	int64_t start_ms;
+	uint32_t frames;
+	uint32_t decode_cycles;
+	uint32_t decode_max_cycles;
+	uint32_t read_cycles;
+	uint32_t read_bytes;
+} anim_stats;
+
+static uint32_t anim_total_frames;
+
+/** Makes sure at least need bytes are buffered, refilling from flash. */
+static int readahead_fill(size_t need)
+{
+	size_t left = readahead_len - readahead_pos;
+	uint32_t start;
+	ssize_t n;
+
+	if (left >= need)
+	{
+		return 0;
+	}
+	else if (need > sizeof(readahead))
+	{
+		return -ENOMEM;
+	}
+
+	memmove(readahead, readahead + readahead_pos, left);
+	readahead_pos = 0;
+	readahead_len = left;
+
+	start = k_cycle_get_32();
+	n = fs_read(&anim_file, readahead + readahead_len,
+		sizeof(readahead) - readahead_len);
+	anim_stats.read_cycles += k_cycle_get_32() - start;
+	if (n < 0)
+	{
+		return n;
+	}
+	anim_stats.read_bytes += n;
+	readahead_len += n;
+
+	return readahead_len >= need ? 0 : -ENODATA;
+}
+
+/** Goes back to the first frame, which is a key frame. */
+static int anim_rewind(void)
+{
+	readahead_pos = 0;
+	readahead_len = 0;
+	anim_frame = 0;
+
+	return fs_seek(&anim_file, sizeof(struct anim_hdr), FS_SEEK_SET);
+}
+
+static void anim_stop(void)
+{
+	if (!anim_playing)
+	{
+		return;
+	}
+
+	fs_close(&anim_file);
+	anim_playing = false;
+	LOG_INF("animation stopped after %u frames\n", anim_total_frames);
+}
+
+static int anim_start(const char* name)
+{
+	char path[sizeof(ANIM_MOUNT_POINT) + 1 + ANIM_NAME_MAX];
+	uint8_t buf[sizeof(struct anim_hdr)];
+	ssize_t n;
+	int err;
+
+	snprintf(path, sizeof(path), ANIM_MOUNT_POINT "/%s", name);
+
+	fs_file_t_init(&anim_file);
+	err = fs_open(&anim_file, path, FS_O_READ);
+	if (err < 0)
+	{
+		return err;
+	}
+
+	n = fs_read(&anim_file, buf, sizeof(buf));
+	if (n != sizeof(buf))
+	{
+		err = n < 0 ? n : -EINVAL;
+	}
+	else
+	{
+		err = anim_hdr_parse(buf, &anim_hdr);
+	}
+
+	if (err == 0 && sizeof(struct anim_frame_hdr) +
+		anim_hdr.max_frame_len > sizeof(readahead))
+	{
+		LOG_ERR("%s needs a read-ahead of %zu bytes\n", path,
+			sizeof(struct anim_frame_hdr) + anim_hdr.max_frame_len);
+		err = -ENOMEM;
+	}
+
+	if (err == 0 && anim_hdr.num_pixels > anim_strip_pixels)
+	{
+		LOG_ERR("%s has %u pixels, the strip only %zu\n", path,
+			anim_hdr.num_pixels, anim_strip_pixels);
+		err = -EINVAL;
+	}
+
+	if (err < 0)
+	{
+		fs_close(&anim_file);
+		return err;
+	}
+
+	anim_rewind();
+	anim_playing = true;
+	anim_resync = false;
+	anim_total_frames = 0;
+	anim_due_ms = k_uptime_get();
+	memset(&anim_stats, 0, sizeof(anim_stats));
+	anim_stats.start_ms = anim_due_ms;
+
+	LOG_INF("playing %s, %u frames of %u pixels every %u ms\n", path,
+		anim_hdr.num_frames, anim_hdr.num_pixels, anim_hdr.interval_ms);
+
+	return 0;
+}
+
+/** Sums up the costs since the last report. */
+static void anim_report(int64_t now)
+{
+	struct anim_report report = {0};
+	uint32_t elapsed_ms = now - anim_stats.start_ms;
+	uint32_t read_us = k_cyc_to_us_ceil32(anim_stats.read_cycles);
+
+	if (anim_stats.frames > 0)
+	{
+		report.decode_us = MIN(UINT16_MAX, k_cyc_to_us_ceil32(
+			anim_stats.decode_cycles / anim_stats.frames));
+		report.decode_max_us = MIN(UINT16_MAX,
+			k_cyc_to_us_ceil32(anim_stats.decode_max_cycles));
+	}
+	report.flash_bytes_per_sec = (uint64_t) anim_stats.read_bytes *
+		MSEC_PER_SEC / MAX(elapsed_ms, 1);
+	report.flash_read_bytes_per_sec = (uint64_t) anim_stats.read_bytes *
+		USEC_PER_SEC / MAX(read_us, 1);
+
+	LOG_INF("decoding takes %u us (up to %u us) per frame, "
+		"reading %u B/s from flash at %u B/s\n",
+		report.decode_us, report.decode_max_us,
+		report.flash_bytes_per_sec, report.flash_read_bytes_per_sec);
+
+	report.frames = sys_cpu_to_le32(anim_total_frames);
+	report.decode_us = sys_cpu_to_le16(report.decode_us);
+	report.decode_max_us = sys_cpu_to_le16(report.decode_max_us);
+	report.flash_bytes_per_sec =
+		sys_cpu_to_le32(report.flash_bytes_per_sec);
+	report.flash_read_bytes_per_sec =
+		sys_cpu_to_le32(report.flash_read_bytes_per_sec);
+
+	k_mutex_lock(&anim_lock, K_FOREVER);
+	anim_last_report = report;
+	k_mutex_unlock(&anim_lock);
+
+	memset(&anim_stats, 0, sizeof(anim_stats));
+	anim_stats.start_ms = now;
+}
+
+/**
+ * Buffers the header and codes of the next frame. Returns the length of
+ * both, the frame header is at readahead + readahead_pos.
+ */
+static int anim_next_frame(struct anim_frame_hdr* frame)
+{
+	int err;
+
+	if (anim_frame == anim_hdr.num_frames)
+	{
+		if (!(anim_hdr.flags & ANIM_FLAG_LOOP))
+		{
+			return -ENODATA;
+		}
+
+		err = anim_rewind();
+		if (err < 0)
+		{
+			return err;
+		}
+	}
+
+	err = readahead_fill(sizeof(*frame));
+	if (err == 0)
+	{
+		err = anim_frame_parse(&anim_hdr, readahead + readahead_pos,
+			frame);
+	}
+	if (err == 0 && anim_frame == 0 && frame->type != ANIM_FRAME_KEY)
+	{
+		err = -EINVAL;
+	}
+	if (err == 0)
+	{
+		err = readahead_fill(sizeof(*frame) + frame->len);
+	}
+
+	return err < 0 ? err : sizeof(*frame) + frame->len;
+}
+
+int anim_render(struct led_rgb* pixels, size_t num_pixels)
+{
+	struct anim_frame_hdr frame;
+	uint32_t start;
+	uint32_t cycles;
+	int len;
+	int err;
+
+	if (!anim_playing)
+	{
+		return -ENODATA;
+	}
+
+	len = anim_next_frame(&frame);
+
+	/* Delta frames need the frame before, skip to the next key frame. */
+	while (len >= 0 && anim_resync && frame.type != ANIM_FRAME_KEY)
+	{
+		readahead_pos += len;
+		anim_frame++;
+		len = anim_next_frame(&frame);
+	}
+	anim_resync = false;
+
+	if (len < 0)
+	{
+		err = len;
+		goto out;
+	}
+
+	if (anim_frame == 0 && anim_hdr.num_pixels < num_pixels)
+	{
+		memset(pixels + anim_hdr.num_pixels, 0,
+			(num_pixels - anim_hdr.num_pixels) * sizeof(*pixels));
+	}
+
+	start = k_cycle_get_32();
+	err = anim_decode(&frame,
+		readahead + readahead_pos + sizeof(frame), pixels,
+		MIN(num_pixels, anim_hdr.num_pixels));
+	cycles = k_cycle_get_32() - start;
+	if (err < 0)
+	{
+		goto out;
+	}
+
+	readahead_pos += len;
+	anim_frame++;
+	anim_total_frames++;
+	anim_stats.frames++;
+	anim_stats.decode_cycles += cycles;
+	anim_stats.decode_max_cycles = MAX(anim_stats.decode_max_cycles,
+		cycles);
+
+	anim_due_ms += anim_hdr.interval_ms;
+	if (anim_due_ms < k_uptime_get() - anim_hdr.interval_ms)
+	{
+		/* Too far behind to catch up, play on from now. */
+		anim_due_ms = k_uptime_get();
+	}
+
+	if (k_uptime_get() - anim_stats.start_ms >= ANIM_REPORT_MS)
+	{
+		anim_report(k_uptime_get());
+	}
+
+	return 0;
+
+out:
+	if (err != -ENODATA)
+	{
+		LOG_ERR("animation frame %u unreadable (err %d)\n",
+			anim_frame, err);
+	}
+	anim_stop();
+	return err;
+}
+
+void anim_wait(void)
+{
+	if (anim_playing)
+	{
+		k_sleep(K_TIMEOUT_ABS_MS(anim_due_ms));
+	}
+}
+
+void anim_invalidate(void)
+{
+	anim_resync = true;
+}
+
+bool anim_in_progress(void)
+{
+	char name[ANIM_NAME_MAX + 1];
+	int err;
+
+	if (atomic_cas(&anim_requested, 1, 0))
+	{
+		k_mutex_lock(&anim_lock, K_FOREVER);
+		strcpy(name, anim_request);
+		k_mutex_unlock(&anim_lock);
+
+		anim_stop();
+		if (name[0] != '\0')
+		{
+			err = anim_start(name);
+			if (err < 0)
+			{
+				LOG_ERR("unable to play %s (err %d)\n", name, err);
+			}
+		}
+	}
+
+	return anim_playing;
+}
+
+static ssize_t write_play(struct bt_conn* conn,
+	const struct bt_gatt_attr* attr, const void* buf, uint16_t len,
+	uint16_t offset, uint8_t flags)
+{
+	if (offset != 0)
+	{
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+	else if (len > ANIM_NAME_MAX || memchr(buf, '/', len) != NULL ||
+		memchr(buf, '\0', len) != NULL)
+	{
+		return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+	}
+
+	/* An empty name stops playback. */
+	k_mutex_lock(&anim_lock, K_FOREVER);
+	memcpy(anim_request, buf, len);
+	anim_request[len] = '\0';
+	k_mutex_unlock(&anim_lock);
+	atomic_set(&anim_requested, 1);
+
+	if (IS_ENABLED(CONFIG_APP_LINK))
+	{
+		link_write_received();
+	}
+
+	return len;
+}
+
+static ssize_t read_report(struct bt_conn* conn,
+	const struct bt_gatt_attr* attr, void* buf, uint16_t len,
+	uint16_t offset)
+{
+	struct anim_report report;
+
+	k_mutex_lock(&anim_lock, K_FOREVER);
+	report = anim_last_report;
+	k_mutex_unlock(&anim_lock);
+
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, &report,
+		sizeof(report));
+}
+
+BT_GATT_SERVICE_DEFINE(anim_svc,
+	BT_GATT_PRIMARY_SERVICE(&anim_uuid),
+	BT_GATT_CHARACTERISTIC(&anim_play_uuid.uuid,
+		BT_GATT_CHRC_WRITE,
+		BT_GATT_PERM_WRITE_ENCRYPT,
+		NULL, write_play, NULL
+	),
+	BT_GATT_CHARACTERISTIC(&anim_report_uuid.uuid,
+		BT_GATT_CHRC_READ,
+		BT_GATT_PERM_READ_ENCRYPT,
+		read_report, NULL, NULL
+	),
+);
+
+int anim_init(size_t num_pixels)
+{
+	int err;
+
+	anim_strip_pixels = num_pixels;
+
+	err = fs_mount(&anim_mount);
+	if (err < 0)
+	{
+		LOG_ERR("unable to mount %s (err %d)\n", ANIM_MOUNT_POINT, err);
+		return err;
+	}
+
+	LOG_INF("animations are read from %s\n", ANIM_MOUNT_POINT);
+	return 0;
+}
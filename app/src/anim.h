@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef APP_ANIM_H
+#define APP_ANIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <zephyr/drivers/led_strip.h>
+
+/**
+ * Mounts the file system animations are uploaded to over MCUmgr.
+ * Animations of more than num_pixels pixels are refused.
+ */
+int anim_init(size_t num_pixels);
+
+/**
+ * Starts or stops playback as requested over BLE. Returns true while an
+ * animation plays, zones must not be drawn then.
+ */
+bool anim_in_progress(void);
+
+/**
+ * Decodes the next frame of the animation into pixels, pixels beyond the
+ * animation are turned off. Returns 0 or a negative errno code, playback
+ * stops on errors.
+ */
+int anim_render(struct led_rgb* pixels, size_t num_pixels);
+
+/** Sleeps until the next frame is due. */
+void anim_wait(void);
+
+/**
+ * Tells the player that the pixels were drawn over, playback goes on from
+ * the next key frame.
+ */
+void anim_invalidate(void);
+
+#endif /* APP_ANIM_H */
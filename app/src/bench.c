@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Shell commands pushing synthetic frames through the LED strip, to measure
+ * the achievable frame rate and where the time goes on boards in the field.
+ * Results are printed as a header line and a row of whitespace separated
+ * columns.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/led_strip.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/timing/timing.h>
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_STATS
+#include <lumen/drivers/ws2812.h>
+#endif
+#ifdef CONFIG_LUMEN_EFFECTS
+#include <lumen/effects.h>
+#endif
+
+#include "bench.h"
+
+#define STRIP_NODE DT_ALIAS(led_strip)
+#define STRIP_NUM_PIXELS DT_PROP(DT_ALIAS(led_strip), chain_length)
+static const struct device* const strip = DEVICE_DT_GET(STRIP_NODE);
+
+static struct led_rgb bench_pixels[STRIP_NUM_PIXELS];
+
+/* Held by the render loop while it draws and by a benchmark while it runs. */
+static K_MUTEX_DEFINE(strip_lock);
+static atomic_t strip_dirty;
+
+#define BENCH_DEFAULT_FRAMES 200
+#define STRESS_DEFAULT_SECONDS 10
+#define STRESS_DEFAULT_SEED 1
+
+/** Fills the frame buffer for frame n of a run. */
+typedef void (*bench_pattern_t)(struct led_rgb* px, size_t len, uint32_t n,
+	void* arg);
+
+/** Accumulated timing of a run, cycles are timing API cycles. */
+struct bench_result
+{
+	uint32_t frames;
+	uint32_t errors;
+	uint64_t total_us;
+	uint64_t frame_cycles;
+	uint64_t frame_max_cycles;
+	uint64_t encode_cycles;
+	uint64_t latch_cycles;
+	uint64_t transfer_cycles;
+};
+
+bool bench_claim_strip(void)
+{
+	k_mutex_lock(&strip_lock, K_FOREVER);
+	return atomic_clear(&strip_dirty) != 0;
+}
+
+void bench_release_strip(void)
+{
+	k_mutex_unlock(&strip_lock);
+}
+
+/** Moving rainbow, every pixel changes every frame. */
+static void pattern_rainbow(struct led_rgb* px, size_t len, uint32_t n,
+	void* arg)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		uint8_t pos = (i * 256 / len + n) & 255;
+
+		if (pos < 85)
+		{
+			px[i] = (struct led_rgb) { .r = 255 - pos * 3, .b = pos * 3 };
+		}
+		else if (pos < 170)
+		{
+			pos -= 85;
+			px[i] = (struct led_rgb) { .g = pos * 3, .b = 255 - pos * 3 };
+		}
+		else
+		{
+			pos -= 170;
+			px[i] = (struct led_rgb) { .r = pos * 3, .g = 255 - pos * 3 };
+		}
+	}
+}
+
+/** The same color on every pixel of every frame. */
+static void pattern_fill(struct led_rgb* px, size_t len, uint32_t n,
+	void* arg)
+{
+	const struct led_rgb* color = arg;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		px[i] = *color;
+	}
+}
+
+/** Pseudo-random pixels, the same sequence for the same seed. */
+static void pattern_stress(struct led_rgb* px, size_t len, uint32_t n,
+	void* arg)
+{
+	uint32_t* state = arg;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		/* xorshift32 */
+		*state ^= *state << 13;
+		*state ^= *state >> 17;
+		*state ^= *state << 5;
+
+		px[i].r = *state;
+		px[i].g = *state >> 8;
+		px[i].b = *state >> 16;
+	}
+}
+
+static void bench_print(const struct shell* sh, const char* mode,
+	const struct bench_result* res)
+{
+	const uint32_t frames = MAX(res->frames, 1);
+	const uint64_t fps_x10 = res->total_us > 0 ?
+		(uint64_t) res->frames * 10 * USEC_PER_SEC / res->total_us : 0;
+
+	shell_print(sh, "%-6s %6s %6s %6s %8s %9s %9s %10s %10s %10s %4s",
+		"mode", "pixels", "frames", "errors", "fps", "frame_us", "max_us",
+		"encode_cyc", "latch_cyc", "xfer_cyc", "mhz");
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_STATS
+	shell_print(sh, "%-6s %6u %6u %6u %6u.%u %9llu %9llu %10llu %10llu %10llu %4u",
+		mode, STRIP_NUM_PIXELS, res->frames, res->errors,
+		(uint32_t) (fps_x10 / 10), (uint32_t) (fps_x10 % 10),
+		timing_cycles_to_ns(res->frame_cycles / frames) / NSEC_PER_USEC,
+		timing_cycles_to_ns(res->frame_max_cycles) / NSEC_PER_USEC,
+		res->encode_cycles / frames, res->latch_cycles / frames,
+		res->transfer_cycles / frames, timing_freq_get_mhz());
+#else
+	shell_print(sh, "%-6s %6u %6u %6u %6u.%u %9llu %9llu %10s %10s %10s %4u",
+		mode, STRIP_NUM_PIXELS, res->frames, res->errors,
+		(uint32_t) (fps_x10 / 10), (uint32_t) (fps_x10 % 10),
+		timing_cycles_to_ns(res->frame_cycles / frames) / NSEC_PER_USEC,
+		timing_cycles_to_ns(res->frame_max_cycles) / NSEC_PER_USEC,
+		"-", "-", "-", timing_freq_get_mhz());
+#endif
+}
+
+/**
+ * Pushes frames through the strip as fast as it takes them, either a
+ * number of frames or, if frames is 0, for duration_ms.
+ */
+static void bench_run(const struct shell* sh, const char* mode,
+	bench_pattern_t pattern, void* arg, uint32_t frames, uint32_t duration_ms)
+{
+	struct bench_result res = { 0 };
+	int64_t start_ticks;
+	int64_t until;
+	timing_t start, end;
+	uint64_t cycles;
+	int err;
+#ifdef CONFIG_LUMEN_WS2812_STRIP_STATS
+	struct ws2812_stats stats;
+#endif
+
+	timing_init();
+	timing_start();
+
+	/* Rendering pauses until the run is over, and redraws afterwards. */
+	k_mutex_lock(&strip_lock, K_FOREVER);
+	atomic_set(&strip_dirty, 1);
+
+	start_ticks = k_uptime_ticks();
+	until = k_uptime_get() + duration_ms;
+
+	while (frames > 0 ? res.frames < frames : k_uptime_get() < until)
+	{
+		pattern(bench_pixels, STRIP_NUM_PIXELS, res.frames, arg);
+
+		start = timing_counter_get();
+		err = led_strip_update_rgb(strip, bench_pixels, STRIP_NUM_PIXELS);
+		end = timing_counter_get();
+
+		if (err < 0)
+		{
+			res.errors++;
+		}
+
+		cycles = timing_cycles_get(&start, &end);
+		res.frame_cycles += cycles;
+		res.frame_max_cycles = MAX(res.frame_max_cycles, cycles);
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_STATS
+		if (ws2812_get_stats(strip, &stats) == 0)
+		{
+			res.encode_cycles += stats.encode_cycles;
+			res.latch_cycles += stats.latch_cycles;
+			res.transfer_cycles += stats.transfer_cycles;
+		}
+#endif
+
+		res.frames++;
+	}
+
+	res.total_us = k_ticks_to_us_floor64(k_uptime_ticks() - start_ticks);
+
+	k_mutex_unlock(&strip_lock);
+
+	bench_print(sh, mode, &res);
+
+	timing_stop();
+}
+
+static int parse_u32(const struct shell* sh, const char* arg, uint32_t max,
+	uint32_t* value)
+{
+	int err = 0;
+	unsigned long v = shell_strtoul(arg, 0, &err);
+
+	if (err != 0 || v > max)
+	{
+		shell_error(sh, "invalid value %s, expected 0 to %u", arg, max);
+		return -EINVAL;
+	}
+
+	*value = v;
+	return 0;
+}
+
+static int strip_ready(const struct shell* sh)
+{
+	if (!device_is_ready(strip))
+	{
+		shell_error(sh, "led strip device is not ready");
+		return -ENODEV;
+	}
+
+	return 0;
+}
+
+static int cmd_bench(const struct shell* sh, size_t argc, char** argv)
+{
+	uint32_t frames = BENCH_DEFAULT_FRAMES;
+	int err;
+
+	err = strip_ready(sh);
+	if (err < 0)
+	{
+		return err;
+	}
+
+	if (argc > 1)
+	{
+		err = parse_u32(sh, argv[1], UINT32_MAX, &frames);
+		if (err < 0 || frames == 0)
+		{
+			return -EINVAL;
+		}
+	}
+
+	bench_run(sh, "bench", pattern_rainbow, NULL, frames, 0);
+	return 0;
+}
+
+static int cmd_fill(const struct shell* sh, size_t argc, char** argv)
+{
+	struct led_rgb color;
+	uint32_t frames = BENCH_DEFAULT_FRAMES;
+	uint32_t r, g, b;
+	int err;
+
+	err = strip_ready(sh);
+	if (err < 0)
+	{
+		return err;
+	}
+
+	if (parse_u32(sh, argv[1], UINT8_MAX, &r) < 0 ||
+		parse_u32(sh, argv[2], UINT8_MAX, &g) < 0 ||
+		parse_u32(sh, argv[3], UINT8_MAX, &b) < 0)
+	{
+		return -EINVAL;
+	}
+
+	if (argc > 4)
+	{
+		err = parse_u32(sh, argv[4], UINT32_MAX, &frames);
+		if (err < 0 || frames == 0)
+		{
+			return -EINVAL;
+		}
+	}
+
+	color = (struct led_rgb) { .r = r, .g = g, .b = b };
+	bench_run(sh, "fill", pattern_fill, &color, frames, 0);
+	return 0;
+}
+
+static int cmd_stress(const struct shell* sh, size_t argc, char** argv)
+{
+	uint32_t seconds = STRESS_DEFAULT_SECONDS;
+	uint32_t seed = STRESS_DEFAULT_SEED;
+	int err;
+
+	err = strip_ready(sh);
+	if (err < 0)
+	{
+		return err;
+	}
+
+	if (argc > 1)
+	{
+		err = parse_u32(sh, argv[1], 3600, &seconds);
+		if (err < 0 || seconds == 0)
+		{
+			return -EINVAL;
+		}
+	}
+
+	if (argc > 2)
+	{
+		err = parse_u32(sh, argv[2], UINT32_MAX, &seed);
+		if (err < 0 || seed == 0)
+		{
+			/* xorshift never leaves 0. */
+			return -EINVAL;
+		}
+	}
+
+	bench_run(sh, "stress", pattern_stress, &seed, 0,
+		seconds * MSEC_PER_SEC);
+	return 0;
+}
+
+#ifdef CONFIG_LUMEN_EFFECTS
+/**
+ * Renders every built-in effect on the whole strip and compares the CPU
+ * cycles it takes per pixel to the cost it declares.
+ */
+static int cmd_effects(const struct shell* sh, size_t argc, char** argv)
+{
+	struct segment seg =
+	{
+		.len = STRIP_NUM_PIXELS,
+		.color = { .r = 255, .g = 96, .b = 16 },
+	};
+	uint32_t frames = BENCH_DEFAULT_FRAMES;
+	timing_t start, end;
+	int err;
+
+	err = strip_ready(sh);
+	if (err < 0)
+	{
+		return err;
+	}
+
+	if (argc > 1)
+	{
+		err = parse_u32(sh, argv[1], UINT32_MAX, &frames);
+		if (err < 0 || frames == 0)
+		{
+			return -EINVAL;
+		}
+	}
+
+	timing_init();
+	timing_start();
+
+	k_mutex_lock(&strip_lock, K_FOREVER);
+	atomic_set(&strip_dirty, 1);
+
+	shell_print(sh, "%-8s %6s %6s %8s %8s %8s",
+		"effect", "pixels", "frames", "cost_cyc", "max_cyc", "max_us");
+
+	for (size_t i = 0; i < effect_count(); i++)
+	{
+		const struct effect* effect = effect_get(i);
+		uint64_t max_ns = 0;
+
+		for (uint32_t n = 0; n < frames; n++)
+		{
+			start = timing_counter_get();
+			effect->render(&seg, bench_pixels, n * effect->interval_ms);
+			end = timing_counter_get();
+
+			max_ns = MAX(max_ns, timing_cycles_to_ns(
+				timing_cycles_get(&start, &end)));
+
+			(void) led_strip_update_rgb(strip, bench_pixels,
+				STRIP_NUM_PIXELS);
+		}
+
+		shell_print(sh, "%-8s %6u %6u %8u %8llu %8llu",
+			effect->name, STRIP_NUM_PIXELS, frames,
+			effect->cycles_per_pixel,
+			max_ns * CONFIG_LUMEN_EFFECTS_CPU_FREQ_KHZ /
+				(NSEC_PER_MSEC * STRIP_NUM_PIXELS),
+			max_ns / NSEC_PER_USEC);
+	}
+
+	k_mutex_unlock(&strip_lock);
+
+	timing_stop();
+	return 0;
+}
+#endif /* CONFIG_LUMEN_EFFECTS */
+
+SHELL_STATIC_SUBCMD_SET_CREATE(led_cmds,
+	SHELL_CMD_ARG(bench, NULL,
+		"Moving rainbow, as fast as the strip takes it.\n"
+		"Usage: led bench [frames]",
+		cmd_bench, 1, 1),
+	SHELL_CMD_ARG(fill, NULL,
+		"The same color on every pixel.\n"
+		"Usage: led fill <r> <g> <b> [frames]",
+		cmd_fill, 4, 1),
+	SHELL_CMD_ARG(stress, NULL,
+		"Pseudo-random pixels, reproducible for the same seed.\n"
+		"Usage: led stress [seconds] [seed]",
+		cmd_stress, 1, 2),
+#ifdef CONFIG_LUMEN_EFFECTS
+	SHELL_CMD_ARG(effects, NULL,
+		"Cycles per pixel of the built-in effects against their "
+		"declared cost.\n"
+		"Usage: led effects [frames]",
+		cmd_effects, 1, 1),
+#endif
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(led, &led_cmds, "LED strip benchmarks", NULL);
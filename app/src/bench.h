@@ -0,0 +1,21 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef APP_BENCH_H
+#define APP_BENCH_H
+
+#include <stdbool.h>
+
+/**
+ * Takes the LED strip for rendering, blocks while a benchmark runs. Returns
+ * true if a benchmark ran since the strip was last taken, so it has to be
+ * redrawn completely.
+ */
+bool bench_claim_strip(void);
+
+/** Gives the LED strip back after rendering. */
+void bench_release_strip(void);
+
+#endif /* APP_BENCH_H */
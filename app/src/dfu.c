@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Tracks MCUmgr image uploads, so rendering can back off while flash writes
+ * and the BT RX path need the CPU.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/mgmt/mcumgr/mgmt/callbacks.h>
+#include <zephyr/mgmt/mcumgr/grp/img_mgmt/img_mgmt.h>
+
+#include "dfu.h"
+#include "link.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(dfu, CONFIG_APP_LOG_LEVEL);
+
+static atomic_t dfu_active;
+static atomic_t dfu_last_chunk;
+static atomic_t dfu_percent;
+
+static enum mgmt_cb_return dfu_callback(uint32_t event,
+	enum mgmt_cb_return prev_status, int32_t* rc, uint16_t* group,
+	bool* abort_more, void* data, size_t data_size)
+{
+	const struct img_mgmt_upload_check* check;
+
+	switch (event)
+	{
+	case MGMT_EVT_OP_IMG_MGMT_DFU_STARTED:
+		LOG_INF("image upload started\n");
+		atomic_set(&dfu_percent, 0);
+		atomic_set(&dfu_last_chunk, k_uptime_get_32());
+		atomic_set(&dfu_active, 1);
+		if (IS_ENABLED(CONFIG_APP_LINK))
+		{
+			link_activity();
+		}
+		break;
+
+	case MGMT_EVT_OP_IMG_MGMT_DFU_CHUNK:
+		check = data;
+		if (check->action->size > 0)
+		{
+			atomic_set(&dfu_percent,
+				check->req->off * 100 / check->action->size);
+		}
+		atomic_set(&dfu_last_chunk, k_uptime_get_32());
+		if (IS_ENABLED(CONFIG_APP_LINK))
+		{
+			/* Chunks come in faster at the short interval. */
+			link_activity();
+		}
+		break;
+
+	case MGMT_EVT_OP_IMG_MGMT_DFU_PENDING:
+	case MGMT_EVT_OP_IMG_MGMT_DFU_STOPPED:
+		LOG_INF("image upload %s\n",
+			event == MGMT_EVT_OP_IMG_MGMT_DFU_PENDING ?
+				"finished" : "stopped");
+		atomic_set(&dfu_active, 0);
+		break;
+
+	default:
+		break;
+	}
+
+	return MGMT_CB_OK;
+}
+
+static struct mgmt_callback dfu_mgmt_callback =
+{
+	.callback = dfu_callback,
+	.event_id = MGMT_EVT_OP_IMG_MGMT_ALL,
+};
+
+void dfu_init(void)
+{
+	mgmt_callback_register(&dfu_mgmt_callback);
+}
+
+bool dfu_in_progress(void)
+{
+	if (!atomic_get(&dfu_active))
+	{
+		return false;
+	}
+
+	/* There is no notification when the peer just goes away mid upload. */
+	if (k_uptime_get_32() - (uint32_t) atomic_get(&dfu_last_chunk) >
+		CONFIG_APP_DFU_IDLE_TIMEOUT_MS)
+	{
+		LOG_WRN("image upload timed out\n");
+		atomic_set(&dfu_active, 0);
+		return false;
+	}
+
+	return true;
+}
+
+uint8_t dfu_progress(void)
+{
+	return atomic_get(&dfu_percent);
+}
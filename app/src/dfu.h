@@ -0,0 +1,21 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef APP_DFU_H
+#define APP_DFU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Registers for MCUmgr image management notifications. */
+void dfu_init(void);
+
+/** Returns true while an image upload is running. */
+bool dfu_in_progress(void);
+
+/** Returns the upload progress in percent. */
+uint8_t dfu_progress(void);
+
+#endif /* APP_DFU_H */
@@ -0,0 +1,499 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Manages the BLE link for control latency. While the strip is controlled
+ * or streamed to, the connection runs at a short interval without
+ * peripheral latency on the 2M PHY. After a while without writes it relaxes
+ * to a long interval with peripheral latency. After a disconnect, a bonded
+ * peer is called back with high duty directed advertising before falling
+ * back to fast and then default undirected advertising.
+ *
+ * The time from a control write arriving to the next frame being sent is
+ * measured and published together with the connection parameters, which
+ * add the radio's share of the write-to-photon latency.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include "link.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(link, CONFIG_APP_LOG_LEVEL);
+
+#define LINK_REPORT_MS 1000
+
+/* Supervision timeout in units of 10 ms. */
+#define LINK_TIMEOUT 400
+
+/* Shortest interval the spec allows, centrals pick within the range. */
+#define LINK_ACTIVE_INTERVAL_MIN 6
+
+BUILD_ASSERT(LINK_ACTIVE_INTERVAL_MIN <= CONFIG_APP_LINK_ACTIVE_INTERVAL,
+	"CONFIG_APP_LINK_ACTIVE_INTERVAL is below the shortest interval");
+/* The timeout must cover twice the time a latent peripheral stays away. */
+BUILD_ASSERT(LINK_TIMEOUT * 8 >
+	2 * (1 + CONFIG_APP_LINK_IDLE_LATENCY) * CONFIG_APP_LINK_IDLE_INTERVAL,
+	"CONFIG_APP_LINK_IDLE_INTERVAL and CONFIG_APP_LINK_IDLE_LATENCY "
+	"exceed the supervision timeout");
+
+/** Latency report characteristic value, all fields little endian. */
+struct link_report
+{
+	/** Control writes in the last report period. */
+	uint16_t writes;
+	/** Average and longest time from a write to the next frame sent. */
+	uint16_t photon_us;
+	uint16_t photon_max_us;
+	/** Connection interval in units of 1.25 ms. */
+	uint16_t interval;
+	/** Connection events the peripheral may skip. */
+	uint16_t latency;
+	/** BT_GAP_LE_PHY_* of both directions. */
+	uint8_t tx_phy;
+	uint8_t rx_phy;
+	/** 1 in the short interval mode. */
+	uint8_t active;
+} __packed;
+
+enum link_adv
+{
+	LINK_ADV_NONE,
+	/** High duty directed to the last bonded peer, 1.28 s at most. */
+	LINK_ADV_DIRECTED,
+	LINK_ADV_FAST,
+	LINK_ADV_SLOW,
+};
+
+static struct bt_uuid_128 link_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef9));
+static struct bt_uuid_128 link_report_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdefa));
+
+static const struct bt_le_conn_param link_active_param =
+	BT_LE_CONN_PARAM_INIT(LINK_ACTIVE_INTERVAL_MIN,
+		CONFIG_APP_LINK_ACTIVE_INTERVAL, 0, LINK_TIMEOUT);
+static const struct bt_le_conn_param link_idle_param =
+	BT_LE_CONN_PARAM_INIT(CONFIG_APP_LINK_IDLE_INTERVAL,
+		CONFIG_APP_LINK_IDLE_INTERVAL, CONFIG_APP_LINK_IDLE_LATENCY,
+		LINK_TIMEOUT);
+
+static const struct bt_data* link_ad;
+static size_t link_ad_len;
+
+/* Connection and peer, guarded by link_lock. */
+static struct k_spinlock link_lock;
+static struct bt_conn* link_conn;
+static bt_addr_le_t link_peer;
+
+static atomic_t link_adv_next;
+static atomic_t link_active;
+static uint8_t link_tx_phy;
+static uint8_t link_rx_phy;
+
+/* Write-to-photon measurement, guarded by link_lock. */
+static bool link_write_pending;
+static uint32_t link_write_cycles;
+struct link_stats
+{
+	int64_t start_ms;
+	uint32_t writes;
+	uint32_t sum_us;
+	uint32_t max_us;
+};
+static struct link_stats link_stats;
+static struct link_report link_last_report;
+
+static void link_adv_handler(struct k_work* work);
+static void link_slow_handler(struct k_work* work);
+static void link_active_handler(struct k_work* work);
+static void link_idle_handler(struct k_work* work);
+
+static K_WORK_DEFINE(link_adv_work, link_adv_handler);
+static K_WORK_DELAYABLE_DEFINE(link_slow_work, link_slow_handler);
+static K_WORK_DEFINE(link_active_work, link_active_handler);
+static K_WORK_DELAYABLE_DEFINE(link_idle_work, link_idle_handler);
+
+/** Returns a reference to the current connection or NULL. */
+static struct bt_conn* link_conn_get(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&link_lock);
+	struct bt_conn* conn = link_conn ? bt_conn_ref(link_conn) : NULL;
+
+	k_spin_unlock(&link_lock, key);
+
+	return conn;
+}
+
+static int link_adv_start(enum link_adv mode)
+{
+	struct bt_le_adv_param param;
+	bt_addr_le_t peer;
+	k_spinlock_key_t key;
+	int err;
+
+	/* Advertising is one time, resuming after a connection is up to us. */
+	if (mode == LINK_ADV_DIRECTED)
+	{
+		key = k_spin_lock(&link_lock);
+		peer = link_peer;
+		k_spin_unlock(&link_lock, key);
+
+		param = *BT_LE_ADV_CONN_DIR(&peer);
+		if (IS_ENABLED(CONFIG_BT_PRIVACY))
+		{
+			/* Bonded peers resolve our RPA and we theirs. */
+			param.options |= BT_LE_ADV_OPT_DIR_ADDR_RPA;
+		}
+
+		err = bt_le_adv_start(&param, NULL, 0, NULL, 0);
+		if (err == 0)
+		{
+			LOG_INF("calling back bonded peer\n");
+			return 0;
+		}
+		LOG_WRN("failed to start directed advertising (err %d)\n", err);
+		mode = LINK_ADV_FAST;
+	}
+
+	param = (struct bt_le_adv_param) BT_LE_ADV_PARAM_INIT(
+		BT_LE_ADV_OPT_CONNECTABLE | BT_LE_ADV_OPT_ONE_TIME |
+			BT_LE_ADV_OPT_USE_NAME,
+		mode == LINK_ADV_FAST ?
+			BT_GAP_ADV_FAST_INT_MIN_1 : BT_GAP_ADV_FAST_INT_MIN_2,
+		mode == LINK_ADV_FAST ?
+			BT_GAP_ADV_FAST_INT_MAX_1 : BT_GAP_ADV_FAST_INT_MAX_2,
+		NULL);
+
+	(void) bt_le_adv_stop();
+	err = bt_le_adv_start(&param, link_ad, link_ad_len, NULL, 0);
+	if (err < 0)
+	{
+		return err;
+	}
+
+	if (mode == LINK_ADV_FAST)
+	{
+		k_work_reschedule(&link_slow_work,
+			K_SECONDS(CONFIG_APP_LINK_FAST_ADV_SEC));
+	}
+
+	return 0;
+}
+
+static void link_adv_handler(struct k_work* work)
+{
+	enum link_adv mode = atomic_set(&link_adv_next, LINK_ADV_NONE);
+	struct bt_conn* conn = link_conn_get();
+	int err;
+
+	if (conn != NULL)
+	{
+		bt_conn_unref(conn);
+		return;
+	}
+
+	if (mode != LINK_ADV_NONE)
+	{
+		err = link_adv_start(mode);
+		if (err < 0)
+		{
+			LOG_ERR("failed to start advertising (err %d)\n", err);
+		}
+	}
+}
+
+static void link_slow_handler(struct k_work* work)
+{
+	atomic_set(&link_adv_next, LINK_ADV_SLOW);
+	link_adv_handler(NULL);
+}
+
+/** Requests the connection parameters of a mode. */
+static void link_set_mode(bool active)
+{
+	struct bt_conn* conn = link_conn_get();
+	int err;
+
+	if (conn == NULL)
+	{
+		return;
+	}
+
+	atomic_set(&link_active, active);
+
+	err = bt_conn_le_param_update(conn,
+		active ? &link_active_param : &link_idle_param);
+	if (err < 0 && err != -EALREADY)
+	{
+		LOG_WRN("failed to request connection parameters (err %d)\n",
+			err);
+	}
+
+	if (active && link_tx_phy != BT_GAP_LE_PHY_2M)
+	{
+		err = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+		if (err < 0)
+		{
+			LOG_WRN("failed to request 2M PHY (err %d)\n", err);
+		}
+	}
+
+	bt_conn_unref(conn);
+}
+
+static void link_active_handler(struct k_work* work)
+{
+	LOG_INF("short intervals for control\n");
+	link_set_mode(true);
+}
+
+static void link_idle_handler(struct k_work* work)
+{
+	LOG_INF("long intervals while idle\n");
+	link_set_mode(false);
+}
+
+void link_activity(void)
+{
+	if (atomic_cas(&link_active, 0, 1))
+	{
+		k_work_submit(&link_active_work);
+	}
+	k_work_reschedule(&link_idle_work,
+		K_MSEC(CONFIG_APP_LINK_IDLE_TIMEOUT_MS));
+}
+
+void link_write_received(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&link_lock);
+
+	/* The oldest write not shown yet is the one that waited longest. */
+	if (!link_write_pending)
+	{
+		link_write_pending = true;
+		link_write_cycles = k_cycle_get_32();
+	}
+
+	k_spin_unlock(&link_lock, key);
+
+	link_activity();
+}
+
+/** Publishes the measurements of the last period. */
+static void link_report(const struct link_stats* stats)
+{
+	struct link_report report = {0};
+	struct bt_conn_info info;
+	struct bt_conn* conn;
+	k_spinlock_key_t key;
+
+	report.writes = MIN(stats->writes, UINT16_MAX);
+	report.photon_us = MIN(stats->sum_us / stats->writes, UINT16_MAX);
+	report.photon_max_us = MIN(stats->max_us, UINT16_MAX);
+	report.active = atomic_get(&link_active);
+	report.tx_phy = link_tx_phy;
+	report.rx_phy = link_rx_phy;
+
+	conn = link_conn_get();
+	if (conn != NULL)
+	{
+		if (bt_conn_get_info(conn, &info) == 0)
+		{
+			report.interval = info.le.interval;
+			report.latency = info.le.latency;
+		}
+		bt_conn_unref(conn);
+	}
+
+	/* Writes wait for a connection event the peripheral listens to. */
+	LOG_INF("write to frame %u us (max %u us), interval %u us, "
+		"latency %u\n", report.photon_us, report.photon_max_us,
+		report.interval * 1250, report.latency);
+
+	report.writes = sys_cpu_to_le16(report.writes);
+	report.photon_us = sys_cpu_to_le16(report.photon_us);
+	report.photon_max_us = sys_cpu_to_le16(report.photon_max_us);
+	report.interval = sys_cpu_to_le16(report.interval);
+	report.latency = sys_cpu_to_le16(report.latency);
+
+	key = k_spin_lock(&link_lock);
+	link_last_report = report;
+	k_spin_unlock(&link_lock, key);
+}
+
+void link_frame_shown(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&link_lock);
+	struct link_stats stats;
+	int64_t now;
+	uint32_t us;
+
+	if (!link_write_pending)
+	{
+		k_spin_unlock(&link_lock, key);
+		return;
+	}
+
+	us = k_cyc_to_us_ceil32(k_cycle_get_32() - link_write_cycles);
+	link_write_pending = false;
+
+	if (link_stats.writes == 0)
+	{
+		link_stats.start_ms = k_uptime_get();
+	}
+	link_stats.writes++;
+	link_stats.sum_us += us;
+	link_stats.max_us = MAX(link_stats.max_us, us);
+
+	now = k_uptime_get();
+	if (now - link_stats.start_ms < LINK_REPORT_MS)
+	{
+		k_spin_unlock(&link_lock, key);
+		return;
+	}
+
+	/* Streamed frames are shown from the BT RX thread. */
+	stats = link_stats;
+	link_stats = (struct link_stats) { .start_ms = now };
+	k_spin_unlock(&link_lock, key);
+
+	link_report(&stats);
+}
+
+static ssize_t read_report(struct bt_conn* conn,
+	const struct bt_gatt_attr* attr, void* buf, uint16_t len,
+	uint16_t offset)
+{
+	k_spinlock_key_t key = k_spin_lock(&link_lock);
+	struct link_report report = link_last_report;
+
+	k_spin_unlock(&link_lock, key);
+
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, &report,
+		sizeof(report));
+}
+
+BT_GATT_SERVICE_DEFINE(link_svc,
+	BT_GATT_PRIMARY_SERVICE(&link_uuid),
+	BT_GATT_CHARACTERISTIC(&link_report_uuid.uuid,
+		BT_GATT_CHRC_READ,
+		BT_GATT_PERM_READ_ENCRYPT,
+		read_report, NULL, NULL
+	),
+);
+
+struct link_bond_query
+{
+	const bt_addr_le_t* addr;
+	bool found;
+};
+
+static void link_bond_match(const struct bt_bond_info* info, void* user_data)
+{
+	struct link_bond_query* query = user_data;
+
+	if (bt_addr_le_eq(&info->addr, query->addr))
+	{
+		query->found = true;
+	}
+}
+
+static void link_connected(struct bt_conn* conn, uint8_t err)
+{
+	k_spinlock_key_t key;
+
+	if (err)
+	{
+		/* Directed advertising timed out or the connection failed. */
+		atomic_set(&link_adv_next, LINK_ADV_FAST);
+		return;
+	}
+
+	k_work_cancel_delayable(&link_slow_work);
+
+	key = k_spin_lock(&link_lock);
+	link_conn = bt_conn_ref(conn);
+	k_spin_unlock(&link_lock, key);
+
+	/* The user most likely connected to control the strip. */
+	link_activity();
+}
+
+static void link_disconnected(struct bt_conn* conn, uint8_t reason)
+{
+	struct link_bond_query query = { .addr = bt_conn_get_dst(conn) };
+	k_spinlock_key_t key;
+
+	if (conn != link_conn)
+	{
+		return;
+	}
+
+	k_work_cancel_delayable(&link_idle_work);
+	atomic_set(&link_active, 0);
+	link_tx_phy = 0;
+	link_rx_phy = 0;
+
+	/* Only bonded peers can be called back, the others are unknown. */
+	bt_foreach_bond(BT_ID_DEFAULT, link_bond_match, &query);
+
+	key = k_spin_lock(&link_lock);
+	bt_addr_le_copy(&link_peer, query.addr);
+	link_conn = NULL;
+	k_spin_unlock(&link_lock, key);
+
+	bt_conn_unref(conn);
+
+	atomic_set(&link_adv_next,
+		query.found ? LINK_ADV_DIRECTED : LINK_ADV_FAST);
+}
+
+/* Advertising can only start again once the connection object is free. */
+static void link_recycled(void)
+{
+	if (atomic_get(&link_adv_next) != LINK_ADV_NONE)
+	{
+		k_work_submit(&link_adv_work);
+	}
+}
+
+static void link_param_updated(struct bt_conn* conn, uint16_t interval,
+	uint16_t latency, uint16_t timeout)
+{
+	LOG_INF("connection interval %u us, latency %u\n",
+		interval * 1250, latency);
+}
+
+static void link_phy_updated(struct bt_conn* conn,
+	struct bt_conn_le_phy_info* param)
+{
+	link_tx_phy = param->tx_phy;
+	link_rx_phy = param->rx_phy;
+	LOG_INF("phy tx %u rx %u\n", param->tx_phy, param->rx_phy);
+}
+
+BT_CONN_CB_DEFINE(link_conn_callbacks) =
+{
+	.connected = link_connected,
+	.disconnected = link_disconnected,
+	.recycled = link_recycled,
+	.le_param_updated = link_param_updated,
+	.le_phy_updated = link_phy_updated,
+};
+
+int link_init(const struct bt_data* ad, size_t ad_len)
+{
+	link_ad = ad;
+	link_ad_len = ad_len;
+
+	return link_adv_start(LINK_ADV_FAST);
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef APP_LINK_H
+#define APP_LINK_H
+
+#include <stddef.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+
+/**
+ * Starts advertising with the given data, fast for a while and then at the
+ * default interval. Returns 0 or a negative errno code.
+ */
+int link_init(const struct bt_data* ad, size_t ad_len);
+
+/**
+ * Keeps the connection in the short interval mode, e.g. while data is
+ * uploaded.
+ */
+void link_activity(void);
+
+/**
+ * Notes a control write, which starts the short interval mode and the
+ * measurement of the time until the next frame is sent.
+ */
+void link_write_received(void);
+
+/** Notes that a frame was sent to the strip. */
+void link_frame_shown(void);
+
+#endif /* APP_LINK_H */
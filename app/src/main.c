@@ -4,19 +4,34 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <string.h>
+
 #include <zephyr/kernel.h>
 #include <zephyr/sys_clock.h>
 #include <zephyr/device.h>
 #include <zephyr/drivers/led_strip.h>
 #include <zephyr/drivers/hwinfo.h>
+#include <zephyr/sys/byteorder.h>
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/conn.h>
 #include <zephyr/bluetooth/uuid.h>
 #include <zephyr/bluetooth/gatt.h>
 #include <zephyr/settings/settings.h>
 
+#include <lumen/drivers/ws2812.h>
+#include <lumen/effects.h>
+#include <lumen/segment.h>
+#include <lumen/sync.h>
+
 #include <app_version.h>
 
+#include "anim.h"
+#include "bench.h"
+#include "dfu.h"
+#include "link.h"
+#include "scene.h"
+#include "stream.h"
+
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(main, CONFIG_APP_LOG_LEVEL);
 
@@ -25,7 +40,104 @@ LOG_MODULE_REGISTER(main, CONFIG_APP_LOG_LEVEL);
 static const struct device* const strip = DEVICE_DT_GET(STRIP_NODE);
 
 struct led_rgb pixels[STRIP_NUM_PIXELS] = {0};
-static int do_color_wheel = 1;
+
+#define FRAME_INTERVAL_MS 20
+#ifdef CONFIG_APP_DFU_THROTTLE
+#define DFU_FRAME_INTERVAL K_MSEC(CONFIG_APP_DFU_FRAME_INTERVAL_MS)
+#else
+#define DFU_FRAME_INTERVAL K_MSEC(FRAME_INTERVAL_MS)
+#endif
+
+#define ZONE(n, _) { .name = "zone" #n }
+static struct segment zones[CONFIG_APP_NUM_ZONES] =
+{
+	LISTIFY(CONFIG_APP_NUM_ZONES, ZONE, (,))
+};
+
+#if CONFIG_APP_FADE_MS > 0
+static struct led_rgb fade_pixels[STRIP_NUM_PIXELS];
+#define FADE_PIXELS fade_pixels
+#else
+#define FADE_PIXELS NULL
+#endif
+
+#ifdef CONFIG_LUMEN_SEGMENT_DITHER
+static struct led_rgb wire_pixels[STRIP_NUM_PIXELS];
+static uint32_t dither_err[STRIP_NUM_PIXELS];
+#define WIRE_PIXELS wire_pixels
+#define DITHER_ERR dither_err
+#else
+#define WIRE_PIXELS NULL
+#define DITHER_ERR NULL
+#endif
+
+static struct segment_strip strip_zones =
+{
+	.dev = DEVICE_DT_GET(STRIP_NODE),
+	.pixels = pixels,
+	.num_pixels = STRIP_NUM_PIXELS,
+	.segments = zones,
+	.num_segments = CONFIG_APP_NUM_ZONES,
+	.fade_pixels = FADE_PIXELS,
+	.wire_pixels = WIRE_PIXELS,
+	.dither_err = DITHER_ERR,
+};
+
+/** Effects selectable per zone over BLE. */
+enum zone_effect
+{
+	ZONE_EFFECT_OFF = 0,
+	ZONE_EFFECT_SOLID = 1,
+	ZONE_EFFECT_COLOR_WHEEL = 2,
+	ZONE_EFFECT_FIRE = 3,
+	ZONE_EFFECT_PLASMA = 4,
+	ZONE_EFFECT_TWINKLE = 5,
+	ZONE_EFFECT_COMET = 6,
+	ZONE_EFFECT_BREATHE = 7,
+};
+
+/** Zone characteristic value, all fields little endian. */
+struct zone_cmd
+{
+	uint8_t zone;
+	uint16_t start;
+	uint16_t len;
+	uint8_t effect;
+	uint8_t r;
+	uint8_t g;
+	uint8_t b;
+	/** 0 for static effects, 0xffff for the highest sustained rate. */
+	uint16_t interval_ms;
+} __packed;
+
+BUILD_ASSERT(SEGMENT_INTERVAL_AUTO == UINT16_MAX,
+	"zone interval 0xffff must select the automatic frame rate");
+
+/**
+ * Zone as broadcast to sync followers and persisted, all fields little
+ * endian.
+ */
+struct sync_zone
+{
+	uint16_t start;
+	uint16_t len;
+	uint8_t effect;
+	uint8_t r;
+	uint8_t g;
+	uint8_t b;
+	uint16_t interval_ms;
+	/** Low 32 bits of the show time the effect started at. */
+	uint32_t start_ms;
+} __packed;
+
+/* Zones are encoded as a zone count followed by that many zones. */
+#define ZONES_LEN (1 + CONFIG_APP_NUM_ZONES * sizeof(struct sync_zone))
+#ifdef CONFIG_LUMEN_SYNC
+BUILD_ASSERT(ZONES_LEN <= CONFIG_LUMEN_SYNC_PAYLOAD_MAX,
+	"CONFIG_LUMEN_SYNC_PAYLOAD_MAX too small for CONFIG_APP_NUM_ZONES");
+#endif
+BUILD_ASSERT(ZONES_LEN <= SCENE_MAX_LEN,
+	"SCENE_MAX_LEN too small for CONFIG_APP_NUM_ZONES");
 
 #define BT_UUID_LUMEN_SERVICE_VAL \
 	BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef0)
@@ -33,6 +145,8 @@ static struct bt_uuid_128 lumen_uuid =
 	BT_UUID_INIT_128(BT_UUID_LUMEN_SERVICE_VAL);
 static struct bt_uuid_128 lumen_rgb_uuid = BT_UUID_INIT_128(
 	BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef1));
+static struct bt_uuid_128 lumen_zone_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef2));
 
 #define RGB_MAX_LEN 3
 static uint8_t rgb_value[RGB_MAX_LEN] = {0};
@@ -73,6 +187,370 @@ static const uint8_t gamma_correction[] =
 	236, 239, 241, 244, 247, 249, 252, 255
 };
 
+/** Outputs colors transitioning red - green - blue.
+ * Taken from https://github.com/adafruit/Adafruit_NeoPixel.
+ */
+void color_wheel(uint8_t pos, uint8_t* r, uint8_t* g, uint8_t* b)
+{
+	pos = 255 - pos;
+	if (pos < 85)
+	{
+		*r = 255 - pos * 3;
+		*g = 0;
+		*b = pos * 3;
+	}
+	else if (pos < 170)
+	{
+		pos -= 85;
+		*r = 0;
+		*g = pos * 3;
+		*b = 255 - pos * 3;
+	}
+	else
+	{
+		pos -= 170;
+		*r = pos * 3;
+		*g = 255 - pos * 3;
+		*b = 0;
+	}
+}
+
+/**
+ * Fills a zone with its gamma corrected color. With dithering the strip
+ * does the gamma correction, at 16 bits.
+ */
+static void effect_solid(const struct segment* seg, struct led_rgb* px,
+	uint32_t t_ms)
+{
+	for (size_t i = 0; i < seg->len; i++)
+	{
+		if (IS_ENABLED(CONFIG_LUMEN_SEGMENT_DITHER))
+		{
+			px[i] = seg->color;
+			continue;
+		}
+
+		px[i].r = gamma_correction[seg->color.r];
+		px[i].g = gamma_correction[seg->color.g];
+		px[i].b = gamma_correction[seg->color.b];
+	}
+}
+
+/**
+ * Rainbow across a zone, advancing one wheel step per FRAME_INTERVAL_MS
+ * regardless of the zone's frame rate.
+ */
+static void effect_color_wheel(const struct segment* seg, struct led_rgb* px,
+	uint32_t t_ms)
+{
+	const uint32_t step = t_ms / FRAME_INTERVAL_MS;
+
+	for (size_t i = 0; i < seg->len; i++)
+	{
+		color_wheel(
+			((i * 256 / seg->len) + step) & 255,
+			&(px[i].r), &(px[i].g), &(px[i].b)
+		);
+	}
+}
+
+static const segment_effect_t zone_effects[] =
+{
+	[ZONE_EFFECT_OFF] = NULL,
+	[ZONE_EFFECT_SOLID] = effect_solid,
+	[ZONE_EFFECT_COLOR_WHEEL] = effect_color_wheel,
+#ifdef CONFIG_LUMEN_EFFECTS
+	[ZONE_EFFECT_FIRE] = effect_fire,
+	[ZONE_EFFECT_PLASMA] = effect_plasma,
+	[ZONE_EFFECT_TWINKLE] = effect_twinkle,
+	[ZONE_EFFECT_COMET] = effect_comet,
+	[ZONE_EFFECT_BREATHE] = effect_breathe,
+#endif
+};
+
+#ifdef CONFIG_APP_RING
+/*
+ * The wheel is loaded as RING_PHASES rings of one position per pixel, ring
+ * p shifted by p / RING_PHASES of a pixel. Sending ring p from pixel q shows
+ * the wheel moved on by q + p / RING_PHASES pixels.
+ */
+#define RING_PHASES MIN(DIV_ROUND_UP(256, STRIP_NUM_PIXELS), \
+	CONFIG_LUMEN_WS2812_STRIP_RING_PIXELS / (2 * STRIP_NUM_PIXELS - 1))
+BUILD_ASSERT(RING_PHASES > 0,
+	"CONFIG_LUMEN_WS2812_STRIP_RING_PIXELS holds no ring of the strip");
+#else
+#define RING_PHASES 1
+#endif
+
+/** Positions of the wheel across all rings. */
+#define RING_POSITIONS (STRIP_NUM_PIXELS * RING_PHASES)
+
+static bool ring_loaded;
+/** Wheel position last sent from the rings, and its effect time. */
+static size_t ring_pos = SIZE_MAX;
+static uint32_t ring_t_ms;
+
+/** Encodes the color wheel into the rings of the strip driver. */
+static int wheel_ring_load(void)
+{
+	struct led_rgb ring[STRIP_NUM_PIXELS];
+	int err;
+
+	for (size_t p = 0; p < RING_PHASES; p++)
+	{
+		for (size_t j = 0; j < STRIP_NUM_PIXELS; j++)
+		{
+			color_wheel((j * RING_PHASES + p) * 256 / RING_POSITIONS,
+				&ring[j].r, &ring[j].g, &ring[j].b);
+		}
+
+		err = ws2812_ring_load(strip, p, ring, STRIP_NUM_PIXELS);
+		if (err < 0)
+		{
+			return err;
+		}
+	}
+
+	ring_loaded = true;
+
+	return 0;
+}
+
+/**
+ * Returns true if the zones are just an animated color wheel over the whole
+ * strip, which is then copied to wheel.
+ */
+static bool wheel_ring_fits(struct segment* wheel)
+{
+	if (!ring_loaded)
+	{
+		return false;
+	}
+
+	for (int i = 1; i < CONFIG_APP_NUM_ZONES; i++)
+	{
+		segment_get_effect(&strip_zones, i, wheel);
+		if (wheel->len > 0)
+		{
+			return false;
+		}
+	}
+
+	segment_get_effect(&strip_zones, 0, wheel);
+
+	return wheel->effect == effect_color_wheel && wheel->start == 0 &&
+		wheel->len == STRIP_NUM_PIXELS && wheel->interval_ms > 0 &&
+		wheel->fade_ms == 0 && !wheel->fade_pending;
+}
+
+/**
+ * Sends the frame of the wheel that is due from the rings, unless it is the
+ * one shown already. Returns the time until the next frame in ms.
+ */
+static uint32_t wheel_ring_show(const struct segment* wheel)
+{
+	const uint32_t interval_ms = wheel->interval_ms == SEGMENT_INTERVAL_AUTO ?
+		segment_strip_frame_interval(&strip_zones) : wheel->interval_ms;
+	const int64_t t_ms = MAX(segment_strip_now(&strip_zones) -
+		wheel->start_ms, 0);
+	const uint32_t step = (t_ms - t_ms % interval_ms) / FRAME_INTERVAL_MS;
+	const size_t pos = (step & 255) * RING_POSITIONS / 256;
+	int err;
+
+	if (pos != ring_pos)
+	{
+		err = ws2812_ring_show(strip, STRIP_NUM_PIXELS,
+			pos % RING_PHASES, pos / RING_PHASES);
+		if (err < 0)
+		{
+			LOG_WRN("unable to update led strip (err %d)\n", err);
+		}
+		else if (IS_ENABLED(CONFIG_APP_LINK))
+		{
+			link_frame_shown();
+		}
+
+		ring_pos = pos;
+		ring_t_ms = t_ms - t_ms % interval_ms;
+	}
+
+	return interval_ms - t_ms % interval_ms;
+}
+
+/** Renders the wheel last sent from the rings, for crossfades from it. */
+static void wheel_ring_leave(void)
+{
+	const struct segment wheel = { .len = STRIP_NUM_PIXELS };
+
+	effect_color_wheel(&wheel, pixels, ring_t_ms);
+	ring_pos = SIZE_MAX;
+}
+
+static uint8_t zone_effect_index(segment_effect_t effect)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(zone_effects); i++)
+	{
+		if (zone_effects[i] == effect)
+		{
+			return i;
+		}
+	}
+
+	return ZONE_EFFECT_OFF;
+}
+
+static void zones_encode(uint8_t payload[ZONES_LEN])
+{
+	struct sync_zone zone;
+	struct segment seg;
+
+	payload[0] = CONFIG_APP_NUM_ZONES;
+	for (int i = 0; i < CONFIG_APP_NUM_ZONES; i++)
+	{
+		segment_get_effect(&strip_zones, i, &seg);
+
+		zone.start = sys_cpu_to_le16(seg.start);
+		zone.len = sys_cpu_to_le16(seg.len);
+		zone.effect = zone_effect_index(seg.effect);
+		zone.r = seg.color.r;
+		zone.g = seg.color.g;
+		zone.b = seg.color.b;
+		zone.interval_ms = sys_cpu_to_le16(seg.interval_ms);
+		zone.start_ms = sys_cpu_to_le32((uint32_t) seg.start_ms);
+
+		memcpy(&payload[1 + i * sizeof(zone)], &zone, sizeof(zone));
+	}
+}
+
+/** Broadcasts the zones to sync followers, if this is the leader. */
+static void sync_publish_zones(void)
+{
+	uint8_t payload[ZONES_LEN];
+	int err;
+
+	if (!IS_ENABLED(CONFIG_APP_SYNC_LEADER))
+	{
+		return;
+	}
+
+	zones_encode(payload);
+	err = sync_leader_set_payload(payload, sizeof(payload));
+	if (err < 0)
+	{
+		LOG_WRN("failed to publish zones (err %d)\n", err);
+	}
+}
+
+/**
+ * Applies encoded zones. With keep_start effects keep the start time
+ * encoded with them, otherwise they start over.
+ */
+static int zones_apply(const uint8_t* data, size_t len, bool keep_start)
+{
+	const int64_t now = segment_strip_now(&strip_zones);
+	struct sync_zone zone;
+	struct segment seg;
+	size_t count;
+
+	if (len < 1 || len < 1 + data[0] * sizeof(zone))
+	{
+		return -EINVAL;
+	}
+
+	count = MIN(data[0], CONFIG_APP_NUM_ZONES);
+
+	/* Moved zones could overlap ones not moved yet, empty them first. */
+	for (size_t i = 0; i < count; i++)
+	{
+		memcpy(&zone, &data[1 + i * sizeof(zone)], sizeof(zone));
+		segment_get_effect(&strip_zones, i, &seg);
+
+		if (seg.start != sys_le16_to_cpu(zone.start) ||
+			seg.len != sys_le16_to_cpu(zone.len))
+		{
+			segment_configure(&strip_zones, i, 0, 0);
+		}
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		uint32_t age_ms;
+
+		memcpy(&zone, &data[1 + i * sizeof(zone)], sizeof(zone));
+
+		if (zone.effect >= ARRAY_SIZE(zone_effects) ||
+			segment_configure(&strip_zones, i,
+				sys_le16_to_cpu(zone.start),
+				sys_le16_to_cpu(zone.len)) < 0)
+		{
+			LOG_WRN("invalid zone %zu\n", i);
+			continue;
+		}
+
+		/* Wraps correctly for effects started less than 49 days ago. */
+		age_ms = keep_start ?
+			(uint32_t) now - sys_le32_to_cpu(zone.start_ms) : 0;
+
+		segment_set_effect_since(&strip_zones, i,
+			zone_effects[zone.effect],
+			(struct led_rgb) { .r = zone.r, .g = zone.g, .b = zone.b },
+			sys_le16_to_cpu(zone.interval_ms), now - age_ms);
+	}
+
+	return 0;
+}
+
+/**
+ * Applies the zones of the sync leader. Effects keep the start time the
+ * leader gave them, so both render the same frames.
+ */
+static void sync_apply_zones(const uint8_t* data, size_t len)
+{
+	if (zones_apply(data, len, true) < 0)
+	{
+		LOG_WRN("invalid sync payload\n");
+	}
+}
+
+/** Shares changed zones with sync followers and persists them. */
+static void zones_changed(void)
+{
+	uint8_t payload[ZONES_LEN];
+
+	sync_publish_zones();
+
+	if (IS_ENABLED(CONFIG_APP_SCENE))
+	{
+		zones_encode(payload);
+		scene_save(payload, sizeof(payload));
+	}
+}
+
+/** Restores the persisted zones, returns false if there are none. */
+static bool zones_restore(void)
+{
+	uint8_t payload[SCENE_MAX_LEN];
+	ssize_t len;
+
+	len = scene_load(payload, sizeof(payload));
+	if (len < 0)
+	{
+		if (len != -ENOENT)
+		{
+			LOG_WRN("failed to load scene (err %d)\n", (int) len);
+		}
+		return false;
+	}
+
+	if (zones_apply(payload, len, false) < 0)
+	{
+		LOG_WRN("invalid scene\n");
+		return false;
+	}
+
+	return true;
+}
+
 static ssize_t read_rgb(struct bt_conn* conn, const struct bt_gatt_attr* attr,
 	void* buf, uint16_t len, uint16_t offset)
 {
@@ -95,20 +573,88 @@ static ssize_t write_rgb(struct bt_conn* conn, const struct bt_gatt_attr* attr,
 		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
 	}
 
-	if (do_color_wheel)
-	{
-		do_color_wheel = 0;
-	}
-
 	value[0] = ((const uint8_t*) buf)[0];
 	value[1] = ((const uint8_t*) buf)[1];
 	value[2] = ((const uint8_t*) buf)[2];
 
-	for (int i = 0; i < STRIP_NUM_PIXELS; i++)
+	if (IS_ENABLED(CONFIG_APP_LINK))
+	{
+		link_write_received();
+	}
+
+	/* Applies to every zone, like it did before zones existed. */
+	for (int i = 0; i < CONFIG_APP_NUM_ZONES; i++)
 	{
-		pixels[i].r = gamma_correction[value[0]];
-		pixels[i].g = gamma_correction[value[1]];
-		pixels[i].b = gamma_correction[value[2]];
+		segment_fade_effect(&strip_zones, i, effect_solid,
+			(struct led_rgb) { .r = value[0], .g = value[1], .b = value[2] },
+			0, CONFIG_APP_FADE_MS, EASING_IN_OUT);
+	}
+	zones_changed();
+
+	return len;
+}
+
+static ssize_t write_zone(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+	const void* buf, uint16_t len, uint16_t offset, uint8_t flags)
+{
+	const struct effect* effect;
+	struct zone_cmd cmd;
+	uint32_t interval_ms;
+	int err;
+
+	if (len != sizeof(cmd))
+	{
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+	else if (offset != 0)
+	{
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+
+	memcpy(&cmd, buf, sizeof(cmd));
+
+	if (cmd.zone >= CONFIG_APP_NUM_ZONES ||
+		cmd.effect >= ARRAY_SIZE(zone_effects))
+	{
+		return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+	}
+
+	interval_ms = sys_le16_to_cpu(cmd.interval_ms);
+	effect = IS_ENABLED(CONFIG_LUMEN_EFFECTS) ?
+		effect_lookup(zone_effects[cmd.effect]) : NULL;
+	if (effect != NULL)
+	{
+		/* Slow down or refuse effects that would miss their frames. */
+		err = effect_fit(&strip_zones, cmd.zone, effect,
+			sys_le16_to_cpu(cmd.len), &interval_ms);
+		if (err < 0)
+		{
+			LOG_WRN("effect %u too costly for zone %u\n",
+				cmd.effect, cmd.zone);
+			return BT_GATT_ERR(BT_ATT_ERR_INSUFFICIENT_RESOURCES);
+		}
+		else if (interval_ms != sys_le16_to_cpu(cmd.interval_ms))
+		{
+			LOG_INF("zone %u slowed down to %u ms per frame\n",
+				cmd.zone, interval_ms);
+		}
+	}
+
+	err = segment_configure(&strip_zones, cmd.zone,
+		sys_le16_to_cpu(cmd.start), sys_le16_to_cpu(cmd.len));
+	if (err < 0)
+	{
+		return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+	}
+
+	segment_fade_effect(&strip_zones, cmd.zone, zone_effects[cmd.effect],
+		(struct led_rgb) { .r = cmd.r, .g = cmd.g, .b = cmd.b },
+		interval_ms, CONFIG_APP_FADE_MS, EASING_IN_OUT);
+	zones_changed();
+
+	if (IS_ENABLED(CONFIG_APP_LINK))
+	{
+		link_write_received();
 	}
 
 	return len;
@@ -122,6 +668,11 @@ BT_GATT_SERVICE_DEFINE(lumen_svc,
 		BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT,
 		read_rgb, write_rgb, rgb_value
 	),
+	BT_GATT_CHARACTERISTIC(&lumen_zone_uuid.uuid,
+		BT_GATT_CHRC_WRITE | BT_GATT_CHRC_WRITE_WITHOUT_RESP,
+		BT_GATT_PERM_WRITE_ENCRYPT,
+		NULL, write_zone, NULL
+	),
 );
 
 static const struct bt_data ad[] =
@@ -153,31 +704,16 @@ BT_CONN_CB_DEFINE(conn_callbacks) =
 	.disconnected = disconnected,
 };
 
-/** Outputs colors transitioning red - green - blue.
- * Taken from https://github.com/adafruit/Adafruit_NeoPixel.
- */
-void color_wheel(uint8_t pos, uint8_t* r, uint8_t* g, uint8_t* b)
+/** Shows upload progress as a dim bar while an image is uploaded. */
+static void dfu_progress_bar(uint8_t percent)
 {
-	pos = 255 - pos;
-	if (pos < 85)
-	{
-		*r = 255 - pos * 3;
-		*g = 0;
-		*b = pos * 3;
-	}
-	else if (pos < 170)
-	{
-		pos -= 85;
-		*r = 0;
-		*g = pos * 3;
-		*b = 255 - pos * 3;
-	}
-	else
+	const int lit = percent * STRIP_NUM_PIXELS / 100;
+
+	for (int i = 0; i < STRIP_NUM_PIXELS; i++)
 	{
-		pos -= 170;
-		*r = pos * 3;
-		*g = 255 - pos * 3;
-		*b = 0;
+		pixels[i].r = 0;
+		pixels[i].g = 0;
+		pixels[i].b = (i < lit) ? gamma_correction[128] : 0;
 	}
 }
 
@@ -219,6 +755,68 @@ static struct bt_conn_auth_info_cb conn_auth_info_callbacks =
 	.pairing_failed = pairing_failed,
 };
 
+/** Brings up everything that needs Bluetooth, once it is enabled. */
+static void bt_ready(int err)
+{
+	if (err < 0)
+	{
+		LOG_ERR("bluetooth enable failed (err %d)\n", err);
+		return;
+	}
+	LOG_INF("bluetooth enabled\n");
+
+	if (IS_ENABLED(CONFIG_SETTINGS))
+	{
+		settings_load();
+	}
+
+	if (IS_ENABLED(CONFIG_APP_DFU_THROTTLE))
+	{
+		dfu_init();
+	}
+
+	if (IS_ENABLED(CONFIG_APP_ANIM))
+	{
+		anim_init(STRIP_NUM_PIXELS);
+	}
+
+	if (IS_ENABLED(CONFIG_APP_SYNC_LEADER))
+	{
+		sync_publish_zones();
+		err = sync_leader_start();
+		if (err < 0)
+		{
+			LOG_ERR("failed to start sync leader (err %d)\n", err);
+		}
+	}
+	else if (IS_ENABLED(CONFIG_APP_SYNC_FOLLOWER))
+	{
+		err = sync_follower_start(sync_apply_zones);
+		if (err < 0)
+		{
+			LOG_ERR("failed to start sync follower (err %d)\n", err);
+		}
+	}
+
+	if (IS_ENABLED(CONFIG_APP_LINK))
+	{
+		/* Fast at first and directed to the last central later on. */
+		err = link_init(ad, ARRAY_SIZE(ad));
+	}
+	else
+	{
+		err = bt_le_adv_start(BT_LE_ADV_CONN_NAME,
+			ad, ARRAY_SIZE(ad), NULL, 0);
+	}
+	if (err < 0)
+	{
+		LOG_ERR("failed to start advertising (err %d)\n", err);
+		return;
+	}
+	LOG_INF("started advertising %lld us after boot\n",
+		k_ticks_to_us_floor64(k_uptime_ticks()));
+}
+
 int main(void)
 {
 	int err;
@@ -226,7 +824,13 @@ int main(void)
 	uint8_t device_id[device_id_len];
 	ssize_t actual_device_id_len;
 	uint32_t passkey;
-	int j = 0;
+	bool updating = false;
+	bool streaming = false;
+	bool playing = false;
+	bool rotating = false;
+	struct segment wheel;
+	uint32_t wheel_wait_ms = 0;
+	uint32_t frame_interval_ms = 0;
 	k_timepoint_t till_heartbeat = sys_timepoint_calc(K_NO_WAIT);
 
 	LOG_INF("lumen example application %s\n", APP_VERSION_STRING);
@@ -237,6 +841,38 @@ int main(void)
 		return 0;
 	}
 
+	if (!IS_ENABLED(CONFIG_APP_SYNC_NONE))
+	{
+		/* Zones run on the show clock shared with the other devices. */
+		strip_zones.clock = sync_time_ms;
+	}
+	segment_strip_init(&strip_zones);
+
+	/*
+	 * Light up before Bluetooth, which takes a while to come up. The scene
+	 * is read on its own, the rest of the settings need Bluetooth.
+	 */
+	if (!IS_ENABLED(CONFIG_APP_SCENE) || !zones_restore())
+	{
+		/* The whole strip starts out as a single rainbow zone. */
+		segment_configure(&strip_zones, 0, 0, STRIP_NUM_PIXELS);
+		segment_set_effect(&strip_zones, 0, effect_color_wheel,
+			(struct led_rgb) { 0 }, FRAME_INTERVAL_MS);
+	}
+	segment_strip_render(&strip_zones);
+	LOG_INF("first frame %lld us after boot\n",
+		k_ticks_to_us_floor64(k_uptime_ticks()));
+
+	if (IS_ENABLED(CONFIG_APP_RING))
+	{
+		/* After the first frame, which should not wait for it. */
+		err = wheel_ring_load();
+		if (err < 0)
+		{
+			LOG_WRN("unable to load the wheel rings (err %d)\n", err);
+		}
+	}
+
 	err = bt_conn_auth_cb_register(&conn_auth_callbacks);
 	if (err < 0)
 	{
@@ -270,50 +906,123 @@ int main(void)
 	LOG_INF("setting passkey to %06u\n", passkey);
 	bt_passkey_set(passkey);
 
-	err = bt_enable(NULL);
+	/* Finishes in bt_ready() while the zones are already rendered. */
+	err = bt_enable(bt_ready);
 	if (err < 0)
 	{
 		LOG_ERR("bluetooth enable failed (err %d)\n", err);
 		return 0;
 	}
-	LOG_INF("bluetooth enabled\n");
 
-	if (IS_ENABLED(CONFIG_SETTINGS))
+	while (1)
 	{
-		settings_load();
-	}
+		if (IS_ENABLED(CONFIG_APP_STREAM))
+		{
+			stream_claim_strip();
+		}
 
-	err = bt_le_adv_start(BT_LE_ADV_CONN_NAME,
-		ad, ARRAY_SIZE(ad), NULL, 0);
-	if (err < 0)
-	{
-		LOG_ERR("failed to start advertising (err %d)\n", err);
-		return 0;
-	}
-	LOG_INF("started advertising\n");
+		if (IS_ENABLED(CONFIG_APP_LED_SHELL) && bench_claim_strip())
+		{
+			/* A benchmark drew its own frames in the meantime. */
+			segment_strip_invalidate(&strip_zones);
+			ring_pos = SIZE_MAX;
+			if (IS_ENABLED(CONFIG_APP_ANIM))
+			{
+				anim_invalidate();
+			}
+		}
 
-	while (1)
-	{
-		if (do_color_wheel)
+		if (IS_ENABLED(CONFIG_APP_DFU_THROTTLE) && dfu_in_progress())
 		{
-			for (int i = 0; i < STRIP_NUM_PIXELS; i++)
+			/* Leave flash writes and BT RX as much time as possible. */
+			dfu_progress_bar(dfu_progress());
+			updating = true;
+
+			err = led_strip_update_rgb(strip, pixels, STRIP_NUM_PIXELS);
+			if (err < 0)
 			{
-				color_wheel(
-					((i * 256 / STRIP_NUM_PIXELS) + j) & 255,
-					&(pixels[i].r), &(pixels[i].g), &(pixels[i].b)
-				);
+				LOG_WRN("unable to update led strip (err %d)\n", err);
 			}
 		}
+		else if (IS_ENABLED(CONFIG_APP_STREAM) && stream_in_progress())
+		{
+			/* Streamed frames go straight to the driver. */
+			streaming = true;
+		}
+		else if (IS_ENABLED(CONFIG_APP_ANIM) && anim_in_progress())
+		{
+			if (updating || streaming)
+			{
+				updating = false;
+				streaming = false;
+				anim_invalidate();
+			}
+			playing = true;
 
-		err = led_strip_update_rgb(strip, pixels, STRIP_NUM_PIXELS);
-		if (err < 0)
+			/* Frames are decoded from flash into the pixel buffer. */
+			err = anim_render(pixels, STRIP_NUM_PIXELS);
+			if (err == 0)
+			{
+				err = led_strip_update_rgb(strip, pixels,
+					STRIP_NUM_PIXELS);
+				if (err < 0)
+				{
+					LOG_WRN("unable to update led strip (err %d)\n",
+						err);
+				}
+				else if (IS_ENABLED(CONFIG_APP_LINK))
+				{
+					link_frame_shown();
+				}
+			}
+		}
+		else if (IS_ENABLED(CONFIG_APP_RING) && wheel_ring_fits(&wheel))
 		{
-			LOG_WRN("unable to update led strip (err %d)\n", err);
+			if (updating || streaming || playing)
+			{
+				/* The strip shows something else than the wheel. */
+				updating = false;
+				streaming = false;
+				playing = false;
+				ring_pos = SIZE_MAX;
+			}
+			rotating = true;
+
+			/* Nothing to render or convert, only an offset to pick. */
+			wheel_wait_ms = wheel_ring_show(&wheel);
 		}
+		else
+		{
+			if (rotating && !updating && !streaming && !playing)
+			{
+				wheel_ring_leave();
+			}
 
-		if (do_color_wheel && ++j >= 256 * 5)
+			if (updating || streaming || playing || rotating)
+			{
+				updating = false;
+				streaming = false;
+				playing = false;
+				rotating = false;
+				segment_strip_invalidate(&strip_zones);
+			}
+
+			/* Only zones that are due or changed get rendered. */
+			err = segment_strip_render(&strip_zones);
+			if (err > 0 && IS_ENABLED(CONFIG_APP_LINK))
+			{
+				link_frame_shown();
+			}
+		}
+
+		if (IS_ENABLED(CONFIG_APP_LED_SHELL))
+		{
+			bench_release_strip();
+		}
+
+		if (IS_ENABLED(CONFIG_APP_STREAM))
 		{
-			j = 0;
+			stream_release_strip();
 		}
 
 		if (sys_timepoint_expired(till_heartbeat))
@@ -321,9 +1030,39 @@ int main(void)
 			LOG_INF("hello world i'm still here %llu\n",
 				k_uptime_get());
 			till_heartbeat = sys_timepoint_calc(K_SECONDS(1));
+
+			if (IS_ENABLED(CONFIG_LUMEN_SEGMENT_RATE) &&
+				segment_strip_frame_interval(&strip_zones) !=
+					frame_interval_ms)
+			{
+				frame_interval_ms =
+					segment_strip_frame_interval(&strip_zones);
+				LOG_INF("rendering at up to %u fps\n",
+					MSEC_PER_SEC / frame_interval_ms);
+			}
 		}
 
-		k_sleep(K_MSEC(20));
+		if (updating)
+		{
+			k_sleep(DFU_FRAME_INTERVAL);
+		}
+		else if (streaming)
+		{
+			k_sleep(K_MSEC(FRAME_INTERVAL_MS));
+		}
+		else if (playing)
+		{
+			anim_wait();
+		}
+		else if (rotating)
+		{
+			/* Zone changes are picked up within a frame interval. */
+			k_sleep(K_MSEC(MIN(wheel_wait_ms, FRAME_INTERVAL_MS)));
+		}
+		else
+		{
+			segment_strip_wait(&strip_zones, MSEC_PER_SEC);
+		}
 	}
 
 	return 0;
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Persists the zones as an opaque scene in the settings backend, so they
+ * can be shown again right after the next boot.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/settings/settings.h>
+
+#include "scene.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(scene, CONFIG_APP_LOG_LEVEL);
+
+#define SCENE_SUBTREE "lumen"
+#define SCENE_KEY "scene"
+
+struct scene_buf
+{
+	uint8_t* data;
+	size_t max_len;
+	ssize_t len;
+};
+
+static K_MUTEX_DEFINE(scene_lock);
+static uint8_t scene_pending[SCENE_MAX_LEN];
+static size_t scene_pending_len;
+
+static void scene_save_work_handler(struct k_work* work);
+static K_WORK_DELAYABLE_DEFINE(scene_save_work, scene_save_work_handler);
+
+static int scene_read(const char* key, size_t len, settings_read_cb read_cb,
+	void* cb_arg, void* param)
+{
+	struct scene_buf* buf = param;
+	const char* next;
+
+	if (!settings_name_steq(key, SCENE_KEY, &next) || next != NULL)
+	{
+		return 0;
+	}
+
+	if (len > buf->max_len)
+	{
+		buf->len = -ENOMEM;
+		return 0;
+	}
+
+	buf->len = read_cb(cb_arg, buf->data, len);
+
+	return 0;
+}
+
+ssize_t scene_load(void* data, size_t len)
+{
+	struct scene_buf buf =
+	{
+		.data = data,
+		.max_len = len,
+		.len = -ENOENT,
+	};
+	int err;
+
+	err = settings_subsys_init();
+	if (err < 0)
+	{
+		return err;
+	}
+
+	/* Deleted values are read back with a length of 0. */
+	err = settings_load_subtree_direct(SCENE_SUBTREE, scene_read, &buf);
+	if (err < 0)
+	{
+		return err;
+	}
+
+	return buf.len == 0 ? -ENOENT : buf.len;
+}
+
+static void scene_save_work_handler(struct k_work* work)
+{
+	uint8_t data[SCENE_MAX_LEN];
+	size_t len;
+	int err;
+
+	k_mutex_lock(&scene_lock, K_FOREVER);
+	len = scene_pending_len;
+	memcpy(data, scene_pending, len);
+	k_mutex_unlock(&scene_lock);
+
+	err = settings_save_one(SCENE_SUBTREE "/" SCENE_KEY, data, len);
+	if (err < 0)
+	{
+		LOG_WRN("failed to save scene (err %d)\n", err);
+	}
+}
+
+void scene_save(const void* data, size_t len)
+{
+	if (len > SCENE_MAX_LEN)
+	{
+		LOG_WRN("scene too large (%zu bytes)\n", len);
+		return;
+	}
+
+	k_mutex_lock(&scene_lock, K_FOREVER);
+	memcpy(scene_pending, data, len);
+	scene_pending_len = len;
+	k_mutex_unlock(&scene_lock);
+
+	k_work_schedule(&scene_save_work, K_MSEC(CONFIG_APP_SCENE_SAVE_DELAY_MS));
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef APP_SCENE_H
+#define APP_SCENE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/** Largest scene that can be persisted. */
+#define SCENE_MAX_LEN 256
+
+/**
+ * Reads the persisted scene straight from the settings backend, without
+ * waiting for Bluetooth or loading any other settings. Returns its length
+ * or a negative errno code, -ENOENT if none was saved yet.
+ */
+ssize_t scene_load(void* data, size_t len);
+
+/**
+ * Persists a scene. Saving is deferred by CONFIG_APP_SCENE_SAVE_DELAY_MS and
+ * only the last of several scenes saved within it is written, so quick
+ * successive changes do not wear out the flash.
+ */
+void scene_save(const void* data, size_t len);
+
+#endif /* APP_SCENE_H */
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Streams frames over BLE straight into the wire buffer of the LED strip
+ * driver. Received pixels are converted as they are stored, so streamed
+ * frames need neither the pixel buffer of the zones nor a separate
+ * conversion pass.
+ */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include <lumen/drivers/ws2812.h>
+
+#include "link.h"
+#include "stream.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(stream, CONFIG_APP_LOG_LEVEL);
+
+#define STRIP_NODE DT_ALIAS(led_strip)
+#define STRIP_NUM_PIXELS DT_PROP(DT_ALIAS(led_strip), chain_length)
+static const struct device* const strip = DEVICE_DT_GET(STRIP_NODE);
+
+/** Sends the frame after the pixels of this write. */
+#define STREAM_FLAG_SHOW BIT(0)
+
+/**
+ * Header of a pixels characteristic write, all fields little endian. It is
+ * followed by R, G, B triplets for consecutive pixels from offset on.
+ */
+struct stream_hdr
+{
+	uint16_t offset;
+	uint8_t flags;
+} __packed;
+
+static struct bt_uuid_128 stream_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef4));
+static struct bt_uuid_128 stream_pixels_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef5));
+
+static K_MUTEX_DEFINE(strip_lock);
+static atomic_t stream_active;
+static atomic_t stream_last_write;
+
+static ssize_t write_pixels(struct bt_conn* conn,
+	const struct bt_gatt_attr* attr, const void* buf, uint16_t len,
+	uint16_t offset, uint8_t flags)
+{
+	struct ws2812_window win;
+	struct stream_hdr hdr;
+	size_t n;
+	int err;
+
+	if (offset != 0)
+	{
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+	else if (len < sizeof(hdr) || (len - sizeof(hdr)) % 3 != 0)
+	{
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	memcpy(&hdr, buf, sizeof(hdr));
+	n = (len - sizeof(hdr)) / 3;
+
+	if (IS_ENABLED(CONFIG_APP_LINK))
+	{
+		link_write_received();
+	}
+
+	k_mutex_lock(&strip_lock, K_FOREVER);
+
+	if (!atomic_set(&stream_active, 1))
+	{
+		LOG_INF("streaming started\n");
+	}
+	atomic_set(&stream_last_write, k_uptime_get_32());
+
+	err = ws2812_acquire(strip, STRIP_NUM_PIXELS,
+		sys_le16_to_cpu(hdr.offset), n, &win);
+	if (err == 0)
+	{
+		err = ws2812_window_write_rgb24(&win, 0,
+			(const uint8_t*) buf + sizeof(hdr), n);
+	}
+	if (err == 0 && (hdr.flags & STREAM_FLAG_SHOW))
+	{
+		err = ws2812_commit(&win);
+		if (err == 0 && IS_ENABLED(CONFIG_APP_LINK))
+		{
+			link_frame_shown();
+		}
+	}
+
+	k_mutex_unlock(&strip_lock);
+
+	if (err == -EINVAL)
+	{
+		return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+	}
+	else if (err < 0)
+	{
+		LOG_WRN("unable to stream pixels (err %d)\n", err);
+		return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+	}
+
+	return len;
+}
+
+BT_GATT_SERVICE_DEFINE(stream_svc,
+	BT_GATT_PRIMARY_SERVICE(&stream_uuid),
+	BT_GATT_CHARACTERISTIC(&stream_pixels_uuid.uuid,
+		BT_GATT_CHRC_WRITE | BT_GATT_CHRC_WRITE_WITHOUT_RESP,
+		BT_GATT_PERM_WRITE_ENCRYPT,
+		NULL, write_pixels, NULL
+	),
+);
+
+void stream_claim_strip(void)
+{
+	k_mutex_lock(&strip_lock, K_FOREVER);
+}
+
+void stream_release_strip(void)
+{
+	k_mutex_unlock(&strip_lock);
+}
+
+bool stream_in_progress(void)
+{
+	if (!atomic_get(&stream_active))
+	{
+		return false;
+	}
+
+	if (k_uptime_get_32() - (uint32_t) atomic_get(&stream_last_write) >
+		CONFIG_APP_STREAM_IDLE_TIMEOUT_MS)
+	{
+		LOG_INF("streaming stopped\n");
+		atomic_set(&stream_active, 0);
+		return false;
+	}
+
+	return true;
+}
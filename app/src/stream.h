@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef APP_STREAM_H
+#define APP_STREAM_H
+
+#include <stdbool.h>
+
+/**
+ * Takes the LED strip for rendering, blocks while a streamed write is
+ * converted or sent.
+ */
+void stream_claim_strip(void);
+
+/** Gives the LED strip back after rendering. */
+void stream_release_strip(void);
+
+/** Returns true while frames are streamed, zones must not be drawn then. */
+bool stream_in_progress(void);
+
+#endif /* APP_STREAM_H */
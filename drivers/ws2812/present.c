@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#ifdef CONFIG_NRF_RTC_TIMER
+#include <zephyr/drivers/timer/nrf_rtc_timer.h>
+#include <helpers/nrfx_gppi.h>
+#endif
+
+#include "present.h"
+
+/* An armed transfer that did not start by then is given up. */
+#define WS2812_PRESENT_TIMEOUT_MS 1000
+
+/* Start right away, the tick was missed. */
+static int present_late(struct ws2812_present *p)
+{
+	p->start(p->user_data);
+	p->started_at = k_uptime_ticks();
+	p->late++;
+	k_sem_give(&p->started);
+
+	return -ETIME;
+}
+
+#ifdef CONFIG_NRF_RTC_TIMER
+
+/* The compare event has already started the transfer through (D)PPI. */
+static void present_handler(int32_t chan, uint64_t expire_time,
+			    void *user_data)
+{
+	struct ws2812_present *p = user_data;
+
+	nrfx_gppi_channels_disable(BIT(p->ppi));
+	k_sem_give(&p->started);
+}
+
+int ws2812_present_init(struct ws2812_present *p, uint32_t task,
+			ws2812_present_start_t start, void *user_data)
+{
+	p->at = WS2812_PRESENT_NONE;
+	p->armed = false;
+	p->late = 0;
+	p->start = start;
+	p->user_data = user_data;
+	k_sem_init(&p->started, 0, 1);
+
+	p->chan = z_nrf_rtc_timer_chan_alloc();
+	if (p->chan < 0) {
+		return -ENODEV;
+	}
+
+	if (nrfx_gppi_channel_alloc(&p->ppi) != NRFX_SUCCESS) {
+		z_nrf_rtc_timer_chan_free(p->chan);
+		return -ENODEV;
+	}
+
+	nrfx_gppi_channel_endpoints_setup(
+		p->ppi, z_nrf_rtc_timer_compare_evt_address_get(p->chan),
+		task);
+
+	return 0;
+}
+
+int ws2812_present_arm(struct ws2812_present *p)
+{
+	uint64_t target;
+	int rc;
+
+	if (!ws2812_present_pending(p)) {
+		return -EINVAL;
+	}
+
+	k_sem_reset(&p->started);
+	p->armed = true;
+	p->started_at = p->at;
+	p->at = WS2812_PRESENT_NONE;
+
+	target = z_nrf_rtc_timer_get_ticks(K_TIMEOUT_ABS_TICKS(p->started_at));
+	if ((int64_t)target < 0) {
+		return present_late(p);
+	}
+
+	nrfx_gppi_channels_enable(BIT(p->ppi));
+
+	/* Fails if the compare event cannot fire on that exact tick anymore. */
+	rc = z_nrf_rtc_timer_exact_set(p->chan, target, present_handler, p);
+	if (rc < 0) {
+		nrfx_gppi_channels_disable(BIT(p->ppi));
+		return present_late(p);
+	}
+
+	return 0;
+}
+
+static void present_cancel(struct ws2812_present *p)
+{
+	z_nrf_rtc_timer_abort(p->chan);
+	nrfx_gppi_channels_disable(BIT(p->ppi));
+}
+
+#else
+
+/* Stand-in for the compare event, runs in the timer interrupt. */
+static void present_expiry(struct k_timer *timer)
+{
+	struct ws2812_present *p = CONTAINER_OF(timer, struct ws2812_present,
+						timer);
+
+	p->start(p->user_data);
+	k_sem_give(&p->started);
+}
+
+int ws2812_present_init(struct ws2812_present *p, uint32_t task,
+			ws2812_present_start_t start, void *user_data)
+{
+	ARG_UNUSED(task);
+
+	p->at = WS2812_PRESENT_NONE;
+	p->armed = false;
+	p->late = 0;
+	p->start = start;
+	p->user_data = user_data;
+	k_sem_init(&p->started, 0, 1);
+	k_timer_init(&p->timer, present_expiry, NULL);
+
+	return 0;
+}
+
+int ws2812_present_arm(struct ws2812_present *p)
+{
+	if (!ws2812_present_pending(p)) {
+		return -EINVAL;
+	}
+
+	k_sem_reset(&p->started);
+	p->armed = true;
+	p->started_at = p->at;
+	p->at = WS2812_PRESENT_NONE;
+
+	if (p->started_at <= k_uptime_ticks()) {
+		return present_late(p);
+	}
+
+	k_timer_start(&p->timer, K_TIMEOUT_ABS_TICKS(p->started_at),
+		      K_NO_WAIT);
+
+	return 0;
+}
+
+static void present_cancel(struct ws2812_present *p)
+{
+	k_timer_stop(&p->timer);
+}
+
+#endif /* CONFIG_NRF_RTC_TIMER */
+
+int ws2812_present_wait(struct ws2812_present *p)
+{
+	int rc;
+
+	if (!p->armed) {
+		return 0;
+	}
+
+	rc = k_sem_take(&p->started,
+			K_TIMEOUT_ABS_TICKS(p->started_at +
+					    k_ms_to_ticks_ceil64(
+						    WS2812_PRESENT_TIMEOUT_MS)));
+	if (rc < 0) {
+		present_cancel(p);
+	}
+
+	p->armed = false;
+
+	return rc;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ *
+ * Hardware timed start of transfers. On nRF SoCs a compare event of the RTC
+ * behind the system clock triggers the start task of the peripheral through
+ * (D)PPI, so a frame goes out on the exact tick no matter when the thread
+ * that armed it runs next. Elsewhere a kernel timer calls a start function
+ * instead, a stand-in that keeps the scheduling testable on native boards.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef LUMEN_WS2812_PRESENT_H
+#define LUMEN_WS2812_PRESENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+
+/* No transfer is scheduled. */
+#define WS2812_PRESENT_NONE (-1)
+
+/* Starts the transfer, used by the stand-in and for late frames. */
+typedef void (*ws2812_present_start_t)(void *user_data);
+
+struct ws2812_present {
+	/* Uptime tick the next transfer starts at. */
+	int64_t at;
+	/* Uptime tick the armed transfer started at. */
+	int64_t started_at;
+	/* Given once the armed transfer started. */
+	struct k_sem started;
+	bool armed;
+	/* Transfers that started late since init. */
+	uint32_t late;
+	ws2812_present_start_t start;
+	void *user_data;
+#ifdef CONFIG_NRF_RTC_TIMER
+	int32_t chan;
+	uint8_t ppi;
+#else
+	struct k_timer timer;
+#endif
+};
+
+/*
+ * Set up start of transfers by the start task at address task, which the
+ * start function triggers in software. The stand-in only uses the start
+ * function.
+ */
+int ws2812_present_init(struct ws2812_present *p, uint32_t task,
+			ws2812_present_start_t start, void *user_data);
+
+/* Start the next armed transfer at an uptime tick. */
+static inline void ws2812_present_set(struct ws2812_present *p, int64_t at)
+{
+	p->at = at;
+}
+
+static inline bool ws2812_present_pending(const struct ws2812_present *p)
+{
+	return p->at != WS2812_PRESENT_NONE;
+}
+
+/*
+ * Arm the transfer set up by the caller to start at the tick given to
+ * ws2812_present_set(). If the tick is too close or has passed, the transfer
+ * is started right away and -ETIME returned.
+ */
+int ws2812_present_arm(struct ws2812_present *p);
+
+/* Wait until an armed transfer started, returns at once if none is armed. */
+int ws2812_present_wait(struct ws2812_present *p);
+
+#endif /* LUMEN_WS2812_PRESENT_H */
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ *
+ * Bookkeeping of pre-encoded pixel rings. All rings of an instance share
+ * one length, since their position in the ring buffer depends on it, so
+ * loading a ring of another length overwrites the others in part and
+ * drops them.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef LUMEN_WS2812_RING_H
+#define LUMEN_WS2812_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/sys/util.h>
+
+/* Rings an instance keeps track of. */
+#define WS2812_RING_MAX 32
+
+struct ws2812_rings {
+	/* Length of the loaded rings, 0 if there are none. */
+	size_t len;
+	/* Bit i is set if ring i holds pixels of the current length. */
+	uint32_t loaded;
+};
+
+/* Record that ring now holds len pixels. */
+static inline void ws2812_rings_add(struct ws2812_rings *r, size_t ring,
+				    size_t len)
+{
+	if (len != r->len) {
+		r->loaded = 0;
+		r->len = len;
+	}
+
+	r->loaded |= BIT(ring);
+}
+
+static inline bool ws2812_rings_loaded(const struct ws2812_rings *r,
+				       size_t ring)
+{
+	return ring < WS2812_RING_MAX && (r->loaded & BIT(ring)) != 0;
+}
+
+#endif /* LUMEN_WS2812_RING_H */
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ *
+ * Helpers shared by the WS2812 backends.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef LUMEN_WS2812_WS2812_H
+#define LUMEN_WS2812_WS2812_H
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/devicetree.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/toolchain.h>
+#include <zephyr/dt-bindings/led/led.h>
+#ifdef CONFIG_LUMEN_WS2812_STRIP_STATS
+#include <zephyr/timing/timing.h>
+#endif
+
+#include <lumen/drivers/ws2812.h>
+
+/*
+ * Select the converted channel value belonging to a LED_COLOR_ID_* constant.
+ * The color id is pasted into the macro name, so the channel order from the
+ * "color-mapping" DT property is resolved by the preprocessor and the encode
+ * loop neither branches nor indexes a mapping table.
+ */
+#define WS2812_CHANNEL_0(r, g, b, w) (w) /* LED_COLOR_ID_WHITE */
+#define WS2812_CHANNEL_1(r, g, b, w) (r) /* LED_COLOR_ID_RED */
+#define WS2812_CHANNEL_2(r, g, b, w) (g) /* LED_COLOR_ID_GREEN */
+#define WS2812_CHANNEL_3(r, g, b, w) (b) /* LED_COLOR_ID_BLUE */
+
+#define WS2812_CHANNEL(color_id, r, g, b, w) \
+	UTIL_CAT(WS2812_CHANNEL_, color_id)(r, g, b, w)
+
+/* Value of channel n of a node's "color-mapping" DT property. */
+#define WS2812_CHANNEL_BY_IDX(node_id, prop, n, r, g, b, w) \
+	WS2812_CHANNEL(DT_PROP_BY_IDX(node_id, prop, n), r, g, b, w)
+
+/*
+ * Reject unsupported "color-mapping" entries at build time, the encoders
+ * cannot fall back to a run-time check anymore.
+ */
+#define WS2812_CHECK_CHANNEL(node_id, prop, n)				\
+	BUILD_ASSERT(DT_PROP_BY_IDX(node_id, prop, n) >= LED_COLOR_ID_WHITE && \
+		     DT_PROP_BY_IDX(node_id, prop, n) <= LED_COLOR_ID_BLUE, \
+		     "invalid channel to color mapping, check the "	\
+		     "color-mapping DT property of " DT_NODE_PATH(node_id));
+
+#define WS2812_CHECK_COLOR_MAPPING(idx)					\
+	BUILD_ASSERT(DT_INST_PROP_LEN(idx, color_mapping) <= 4,		\
+		     "at most four channels per pixel are supported");	\
+	DT_INST_FOREACH_PROP_ELEM(idx, color_mapping, WS2812_CHECK_CHANNEL)
+
+#define WS2812_NUM_COLORS(idx) (DT_INST_PROP_LEN(idx, color_mapping))
+
+#define WS2812_IS_WHITE(node_id, prop, n) \
+	|| (DT_PROP_BY_IDX(node_id, prop, n) == LED_COLOR_ID_WHITE)
+
+#define WS2812_HAS_WHITE(idx) \
+	(0 DT_INST_FOREACH_PROP_ELEM(idx, color_mapping, WS2812_IS_WHITE))
+
+/*
+ * RGB to RGBW conversion algorithm of an instance, the index into the enum
+ * of the "rgbw-algorithm" DT property is the algo argument of
+ * rgbw_conversion(). Without the property, strips with a white channel use
+ * algorithm 4 and RGB strips skip the conversion.
+ */
+#define WS2812_RGBW_ALGO(idx)						\
+	DT_INST_ENUM_IDX_OR(idx, rgbw_algorithm,			\
+			    (WS2812_HAS_WHITE(idx) ? 4 : RGBW_ALGO_NONE))
+
+#define WS2812_CHECK_RGBW_ALGO(idx)					\
+	BUILD_ASSERT(WS2812_HAS_WHITE(idx) ||				\
+		     WS2812_RGBW_ALGO(idx) == RGBW_ALGO_NONE,		\
+		     "rgbw-algorithm needs a white channel, check the "	\
+		     "color-mapping DT property of "			\
+		     DT_NODE_PATH(DT_DRV_INST(idx)));
+
+/*
+ * Bus settings of nodes with a "led-timing" DT property come from the
+ * ws2812_timing.h header scripts/ws2812_timing.py generates at configure
+ * time, with names keyed by the dependency ordinal of the node, e.g.
+ * WS2812_TIMING_42_SPI_FREQUENCY.
+ */
+#define WS2812_TIMING(node_id, name) \
+	UTIL_CAT(UTIL_CAT(WS2812_TIMING_, DT_DEP_ORD(node_id)), _##name)
+
+/* Generated setting name of a node with "led-timing", else DT property prop. */
+#define WS2812_TIMING_OR(node_id, name, prop)				\
+	COND_CODE_1(DT_NODE_HAS_PROP(node_id, led_timing),		\
+		    (WS2812_TIMING(node_id, name)),			\
+		    (DT_PROP(node_id, prop)))
+
+#define WS2812_CHECK_TIMING(idx, prop)					\
+	BUILD_ASSERT(DT_INST_NODE_HAS_PROP(idx, led_timing) ||		\
+		     DT_INST_NODE_HAS_PROP(idx, prop),			\
+		     "led-timing or " #prop " is needed, check the DT "	\
+		     "node " DT_NODE_PATH(DT_DRV_INST(idx)));
+
+/*
+ * A strip latches a frame once its data line stayed idle for the reset time.
+ * Instead of sleeping through it after every transfer, backends remember
+ * when it ends and only wait if the next transfer would start earlier.
+ */
+static inline void ws2812_latch_start(k_timepoint_t *latch, uint32_t us)
+{
+	*latch = sys_timepoint_calc(K_USEC(us));
+}
+
+static inline void ws2812_latch_wait(const k_timepoint_t *latch)
+{
+	k_timeout_t remaining = sys_timepoint_timeout(*latch);
+
+	if (!K_TIMEOUT_EQ(remaining, K_NO_WAIT)) {
+		k_sleep(remaining);
+	}
+}
+
+/*
+ * Split the time of an update into the phases of struct ws2812_stats. Start
+ * with ws2812_stats_begin() and add each phase with ws2812_stats_lap(). All
+ * of this compiles to nothing without CONFIG_LUMEN_WS2812_STRIP_STATS.
+ */
+static inline uint64_t ws2812_stats_begin(struct ws2812_stats *stats)
+{
+#ifdef CONFIG_LUMEN_WS2812_STRIP_STATS
+	*stats = (struct ws2812_stats){ 0 };
+	return timing_counter_get();
+#else
+	ARG_UNUSED(stats);
+	return 0;
+#endif
+}
+
+/* Start timing a phase without resetting the stats of the update. */
+static inline uint64_t ws2812_stats_mark(void)
+{
+#ifdef CONFIG_LUMEN_WS2812_STRIP_STATS
+	return timing_counter_get();
+#else
+	return 0;
+#endif
+}
+
+static inline void ws2812_stats_lap(uint64_t *cycles, uint64_t *mark)
+{
+#ifdef CONFIG_LUMEN_WS2812_STRIP_STATS
+	timing_t start = *mark;
+	timing_t now = timing_counter_get();
+
+	*cycles += timing_cycles_get(&start, &now);
+	*mark = now;
+#else
+	ARG_UNUSED(cycles);
+	ARG_UNUSED(mark);
+#endif
+}
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PALETTE
+
+static inline int ws2812_palette_check(uint8_t bits, size_t palette_len)
+{
+	if ((bits != 4 && bits != 8) || palette_len == 0 ||
+	    palette_len > CONFIG_LUMEN_WS2812_STRIP_PALETTE_SIZE) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Palette index of pixel i, 4-bit indices are packed high nibble first. */
+static ALWAYS_INLINE uint8_t ws2812_palette_index(const uint8_t *indices,
+						  uint8_t bits, size_t i)
+{
+	if (bits == 4) {
+		return (indices[i / 2] >> ((i & 1) ? 0 : 4)) & 0x0F;
+	}
+
+	return indices[i];
+}
+
+/* Check all indices before any pixel is converted, -EINVAL if one is out. */
+static inline int ws2812_palette_check_indices(const uint8_t *indices,
+					       size_t num_pixels, uint8_t bits,
+					       size_t palette_len)
+{
+	for (size_t i = 0; i < num_pixels; i++) {
+		if (ws2812_palette_index(indices, bits, i) >= palette_len) {
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+#endif /* CONFIG_LUMEN_WS2812_STRIP_PALETTE */
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_WINDOW
+
+/* Pixels unpacked from R, G, B triplets per call of an encoder. */
+#define WS2812_RGB24_CHUNK 16
+
+static inline int ws2812_window_check(const struct ws2812_window *win,
+				      size_t offset, size_t n)
+{
+	if (offset > win->count || n > win->count - offset) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static inline void ws2812_rgb24_unpack(struct led_rgb *pixels,
+				       const uint8_t *rgb, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		pixels[i].r = rgb[3 * i];
+		pixels[i].g = rgb[3 * i + 1];
+		pixels[i].b = rgb[3 * i + 2];
+	}
+}
+
+#endif /* CONFIG_LUMEN_WS2812_STRIP_WINDOW */
+
+#endif /* LUMEN_WS2812_WS2812_H */
@@ -7,7 +7,7 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
-#define DT_DRV_COMPAT worldsemi_ws2812_gpio
+#define DT_DRV_COMPAT leonfyi_ws2812_gpio
 
 #include <zephyr/drivers/led_strip.h>
 
@@ -21,84 +21,113 @@ LOG_MODULE_REGISTER(ws2812_gpio);
 #include <soc.h>
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/device.h>
+#include <zephyr/sys/math_extras.h>
+#include <zephyr/dt-bindings/led/led.h>
+#ifdef CONFIG_CLOCK_CONTROL_NRF
 #include <zephyr/drivers/clock_control.h>
 #include <zephyr/drivers/clock_control/nrf_clock_control.h>
-#include <zephyr/dt-bindings/led/led.h>
+#endif
+
+#include <lumen/drivers/ws2812.h>
 
 #include "rgbw.h"
+#include "ws2812.h"
+
+/*
+ * Per-instance encoder, converts num_pixels RGB color values into bytes in
+ * the instance's on-wire channel order.
+ */
+typedef void (*ws2812_gpio_encode_t)(uint8_t *ptr, const struct led_rgb *pixels,
+				     size_t num_pixels);
 
 struct ws2812_gpio_cfg {
 	struct gpio_dt_spec in_gpio;
+	uint8_t *px_buf;
+	size_t px_buf_size;
 	uint8_t num_colors;
-	const uint8_t *color_mapping;
+	ws2812_gpio_encode_t encode;
+	uint32_t t0h_ns;
+	uint32_t t1h_ns;
+	uint32_t tl_ns;
+	uint16_t reset_delay;
 };
 
-/*
- * This is hard-coded to nRF51 in two ways:
- *
- * 1. The assembly delays T1H, T0H, TxL
- * 2. GPIO set/clear
- */
+struct ws2812_gpio_data {
+	/* Pulse widths in CPU cycles, derived from the DT nanoseconds at init. */
+	uint32_t t0h;
+	uint32_t t1h;
+	uint32_t tl;
+	k_timepoint_t latch;
+	struct ws2812_stats stats;
+};
 
 /*
- * T1H: 1 bit high pulse delay: 12 cycles == .75 usec
- * T0H: 0 bit high pulse delay: 4 cycles == .25 usec
- * TxL: inter-bit low pulse delay: 8 cycles == .5 usec
+ * Bits are timed with the DWT cycle counter rather than counted nops, so
+ * the timing follows the core clock of whatever Cortex-M this runs on.
  *
- * We can't use k_busy_wait() here: its argument is in microseconds,
- * and we need roughly .05 microsecond resolution.
+ * Every edge is scheduled against a running deadline instead of being
+ * followed by a fixed delay. Setting and clearing the pin go through the
+ * same GPIO API call, so its latency shifts both edges of a pulse alike and
+ * cancels out, as long as it is shorter than the shortest pulse.
  */
-#define DELAY_T1H "nop\nnop\nnop\nnop\nnop\nnop\nnop\nnop\nnop\nnop\nnop\nnop\n"
-#define DELAY_T0H "nop\nnop\nnop\nnop\n"
-#define DELAY_TxL "nop\nnop\nnop\nnop\nnop\nnop\nnop\nnop\n"
+static ALWAYS_INLINE uint32_t ws2812_gpio_cycles(void)
+{
+	return DWT->CYCCNT;
+}
+
+static ALWAYS_INLINE void ws2812_gpio_wait_until(uint32_t deadline)
+{
+	while ((int32_t)(ws2812_gpio_cycles() - deadline) < 0) {
+	}
+}
+
+static uint32_t ws2812_gpio_ns_to_cycles(uint32_t ns)
+{
+	return ((uint64_t)ns * SystemCoreClock + NSEC_PER_SEC - 1) / NSEC_PER_SEC;
+}
 
 /*
- * GPIO set/clear (these make assumptions about assembly details
- * below).
- *
- * This uses OUTCLR == OUTSET+4.
- *
- * We should be able to make this portable using the results of
- * https://github.com/zephyrproject-rtos/zephyr/issues/11917.
- *
- * We already have the GPIO device stashed in ws2812_gpio_config, so
- * this driver can be used as a test case for the optimized API.
- *
- * Per Arm docs, both Rd and Rn must be r0-r7, so we use the "l"
- * constraint in the below assembly.
+ * Send the bytes of one pixel, MSbit first. Interrupts are only locked for
+ * the duration of a single pixel, the strip tolerates much longer low times
+ * between bits than an interrupt usually takes.
  */
-#define SET_HIGH "str %[p], [%[r], #0]\n" /* OUTSET = BIT(LED_PIN) */
-#define SET_LOW "str %[p], [%[r], #4]\n"  /* OUTCLR = BIT(LED_PIN) */
-
-/* Send out a 1 bit's pulse */
-#define ONE_BIT(base, pin) do {			\
-	__asm volatile (SET_HIGH			\
-			DELAY_T1H			\
-			SET_LOW			\
-			DELAY_TxL			\
-			::				\
-			[r] "l" (base),		\
-			[p] "l" (pin)); } while (false)
-
-/* Send out a 0 bit's pulse */
-#define ZERO_BIT(base, pin) do {			\
-	__asm volatile (SET_HIGH			\
-			DELAY_T0H			\
-			SET_LOW			\
-			DELAY_TxL			\
-			::				\
-			[r] "l" (base),		\
-			[p] "l" (pin)); } while (false)
-
-static int send_buf(const struct device *dev, uint8_t *buf, size_t len)
+static void ws2812_gpio_send_pixel(const struct ws2812_gpio_cfg *cfg,
+				   const struct ws2812_gpio_data *data,
+				   const uint8_t *buf)
 {
-	const struct ws2812_gpio_cfg *config = dev->config;
-	volatile uint32_t *base = (uint32_t *)&NRF_GPIO->OUTSET;
-	const uint32_t val = BIT(config->in_gpio.pin);
+	const struct device *port = cfg->in_gpio.port;
+	const gpio_port_pins_t pin = BIT(cfg->in_gpio.pin);
+	unsigned int key;
+	uint32_t t;
+
+	key = irq_lock();
+
+	t = ws2812_gpio_cycles();
+	for (uint8_t c = 0; c < cfg->num_colors; c++) {
+		for (int8_t i = 7; i >= 0; i--) {
+			const uint32_t th = buf[c] & BIT(i) ? data->t1h : data->t0h;
+
+			gpio_port_set_bits_raw(port, pin);
+			ws2812_gpio_wait_until(t + th);
+			gpio_port_clear_bits_raw(port, pin);
+			t += th + data->tl;
+			ws2812_gpio_wait_until(t);
+		}
+	}
+
+	irq_unlock(key);
+}
+
+static int send_buf(const struct device *dev, const uint8_t *buf,
+		    size_t num_pixels, uint64_t *mark)
+{
+	const struct ws2812_gpio_cfg *cfg = dev->config;
+	struct ws2812_gpio_data *data = dev->data;
+#ifdef CONFIG_CLOCK_CONTROL_NRF
+	/* Run from the HFXO, the internal oscillator is only accurate to a few %. */
 	struct onoff_manager *mgr =
 		z_nrf_clock_control_get_onoff(CLOCK_CONTROL_NRF_SUBSYS_HF);
 	struct onoff_client cli;
-	unsigned int key;
 	int rc;
 
 	sys_notify_init_spinwait(&cli.notify);
@@ -110,85 +139,190 @@ static int send_buf(const struct device *dev, uint8_t *buf, size_t len)
 	while (sys_notify_fetch_result(&cli.notify, &rc)) {
 		/* pend until clock is up and running */
 	}
+#endif
 
-	key = irq_lock();
+	/* The previous frame may still be latching. */
+	ws2812_latch_wait(&data->latch);
+	ws2812_stats_lap(&data->stats.latch_cycles, mark);
 
-	while (len--) {
-		uint32_t b = *buf++;
-		int32_t i;
-
-		/*
-		 * Generate signal out of the bits, MSbit first.
-		 *
-		 * Accumulator maintenance and branching mean the
-		 * inter-bit time will be longer than TxL, but the
-		 * wp.josh.com blog post says we have at least 5 usec
-		 * of slack time between bits before we risk the
-		 * signal getting latched, so this will be fine as
-		 * long as the compiler does something minimally
-		 * reasonable.
-		 */
-		for (i = 7; i >= 0; i--) {
-			if (b & BIT(i)) {
-				ONE_BIT(base, val);
-			} else {
-				ZERO_BIT(base, val);
-			}
-		}
+	for (size_t i = 0; i < num_pixels; i++) {
+		ws2812_gpio_send_pixel(cfg, data, &buf[i * cfg->num_colors]);
 	}
+	ws2812_stats_lap(&data->stats.transfer_cycles, mark);
 
-	irq_unlock(key);
+	ws2812_latch_start(&data->latch, cfg->reset_delay);
 
+#ifdef CONFIG_CLOCK_CONTROL_NRF
 	rc = onoff_release(mgr);
 	/* Returns non-negative value on success. Cap to 0 as API states. */
-	rc = MIN(rc, 0);
+	return MIN(rc, 0);
+#else
+	return 0;
+#endif
+}
 
-	return rc;
+/*
+ * Returns true if and only if cfg->px_buf is big enough to convert
+ * num_pixels RGB color values.
+ */
+static inline bool num_pixels_ok(const struct ws2812_gpio_cfg *cfg,
+				 size_t num_pixels)
+{
+	size_t nbytes;
+	bool overflow;
+
+	overflow = size_mul_overflow(num_pixels, cfg->num_colors, &nbytes);
+	return !overflow && (nbytes <= cfg->px_buf_size);
 }
 
 static int ws2812_gpio_update_rgb(const struct device *dev,
 				  struct led_rgb *pixels,
 				  size_t num_pixels)
 {
-	const struct ws2812_gpio_cfg *config = dev->config;
-	uint8_t *ptr = (uint8_t *)pixels;
-	size_t i;
+	const struct ws2812_gpio_cfg *cfg = dev->config;
+	struct ws2812_gpio_data *data = dev->data;
+	uint64_t mark;
+
+	if (!num_pixels_ok(cfg, num_pixels)) {
+		return -ENOMEM;
+	}
+
+	mark = ws2812_stats_begin(&data->stats);
 
 	/* Convert from RGB to on-wire format (e.g. GRB, GRBW, RGB, etc) */
-	for (i = 0; i < num_pixels; i++) {
-		uint8_t j;
-
-		uint8_t ro, go, bo, wo;
-		rgbw_conversion(
-			/* outs: */ &ro, &go, &bo, &wo,
-			/*  ins: */ pixels[i].r, pixels[i].g, pixels[i].b,
-			/* algo: */ 4
-		);
-
-		for (j = 0; j < config->num_colors; j++) {
-			switch (config->color_mapping[j]) {
-			/* White channel is not supported by LED strip API. */
-			case LED_COLOR_ID_WHITE:
-				*ptr++ = wo;
-				break;
-			case LED_COLOR_ID_RED:
-				*ptr++ = ro;
-				break;
-			case LED_COLOR_ID_GREEN:
-				*ptr++ = go;
-				break;
-			case LED_COLOR_ID_BLUE:
-				*ptr++ = bo;
-				break;
-			default:
-				return -EINVAL;
-			}
-		}
+	cfg->encode(cfg->px_buf, pixels, num_pixels);
+	ws2812_stats_lap(&data->stats.encode_cycles, &mark);
+
+	return send_buf(dev, cfg->px_buf, num_pixels, &mark);
+}
+
+int ws2812_update_rgb_range(const struct device *dev, struct led_rgb *pixels,
+			    size_t num_pixels, size_t first, size_t count)
+{
+	const struct ws2812_gpio_cfg *cfg = dev->config;
+	struct ws2812_gpio_data *data = dev->data;
+	uint64_t mark;
+
+	if (!num_pixels_ok(cfg, num_pixels)) {
+		return -ENOMEM;
+	}
+
+	if (first > num_pixels || count > num_pixels - first) {
+		return -EINVAL;
+	}
+
+	mark = ws2812_stats_begin(&data->stats);
+
+	/* Bytes of all other pixels are still in px_buf. */
+	cfg->encode(&cfg->px_buf[first * cfg->num_colors], &pixels[first],
+		    count);
+	ws2812_stats_lap(&data->stats.encode_cycles, &mark);
+
+	return send_buf(dev, cfg->px_buf, num_pixels, &mark);
+}
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_WINDOW
+int ws2812_acquire(const struct device *dev, size_t num_pixels, size_t first,
+		   size_t count, struct ws2812_window *win)
+{
+	const struct ws2812_gpio_cfg *cfg = dev->config;
+	struct ws2812_gpio_data *data = dev->data;
+
+	if (!num_pixels_ok(cfg, num_pixels)) {
+		return -ENOMEM;
 	}
 
-	return send_buf(dev, (uint8_t *)pixels, num_pixels * config->num_colors);
+	if (first > num_pixels || count > num_pixels - first) {
+		return -EINVAL;
+	}
+
+	(void)ws2812_stats_begin(&data->stats);
+
+	*win = (struct ws2812_window){
+		.dev = dev,
+		.num_pixels = num_pixels,
+		.first = first,
+		.count = count,
+	};
+
+	return 0;
 }
 
+int ws2812_window_write(struct ws2812_window *win, size_t offset,
+			const struct led_rgb *pixels, size_t n)
+{
+	const struct ws2812_gpio_cfg *cfg = win->dev->config;
+	struct ws2812_gpio_data *data = win->dev->data;
+	uint64_t mark;
+	int rc;
+
+	rc = ws2812_window_check(win, offset, n);
+	if (rc < 0) {
+		return rc;
+	}
+
+	mark = ws2812_stats_mark();
+	cfg->encode(&cfg->px_buf[(win->first + offset) * cfg->num_colors], pixels,
+		    n);
+	ws2812_stats_lap(&data->stats.encode_cycles, &mark);
+
+	return 0;
+}
+
+int ws2812_window_write_rgb24(struct ws2812_window *win, size_t offset,
+			      const uint8_t *rgb, size_t n)
+{
+	const struct ws2812_gpio_cfg *cfg = win->dev->config;
+	struct ws2812_gpio_data *data = win->dev->data;
+	struct led_rgb chunk[WS2812_RGB24_CHUNK];
+	uint8_t *px_buf;
+	uint64_t mark;
+	int rc;
+
+	rc = ws2812_window_check(win, offset, n);
+	if (rc < 0) {
+		return rc;
+	}
+
+	mark = ws2812_stats_mark();
+	px_buf = &cfg->px_buf[(win->first + offset) * cfg->num_colors];
+
+	/* Only a few pixels at a time ever exist as struct led_rgb. */
+	while (n > 0) {
+		size_t m = MIN(n, ARRAY_SIZE(chunk));
+
+		ws2812_rgb24_unpack(chunk, rgb, m);
+		cfg->encode(px_buf, chunk, m);
+		px_buf += m * cfg->num_colors;
+		rgb += 3 * m;
+		n -= m;
+	}
+	ws2812_stats_lap(&data->stats.encode_cycles, &mark);
+
+	return 0;
+}
+
+int ws2812_commit(struct ws2812_window *win)
+{
+	const struct ws2812_gpio_cfg *cfg = win->dev->config;
+	uint64_t mark = ws2812_stats_mark();
+
+	/* Bytes of all other pixels are still in px_buf. */
+	return send_buf(win->dev, cfg->px_buf, win->num_pixels, &mark);
+}
+#endif /* CONFIG_LUMEN_WS2812_STRIP_WINDOW */
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_STATS
+int ws2812_get_stats(const struct device *dev, struct ws2812_stats *stats)
+{
+	const struct ws2812_gpio_data *data = dev->data;
+
+	*stats = data->stats;
+
+	return 0;
+}
+#endif
+
 static int ws2812_gpio_update_channels(const struct device *dev,
 				       uint8_t *channels,
 				       size_t num_channels)
@@ -197,70 +331,123 @@ static int ws2812_gpio_update_channels(const struct device *dev,
 	return -ENOTSUP;
 }
 
+static int ws2812_gpio_init(const struct device *dev)
+{
+	const struct ws2812_gpio_cfg *cfg = dev->config;
+	struct ws2812_gpio_data *data = dev->data;
+	uint32_t overhead;
+	unsigned int key;
+	int rc;
+
+	if (!gpio_is_ready_dt(&cfg->in_gpio)) {
+		LOG_ERR("GPIO device not ready");
+		return -ENODEV;
+	}
+
+	rc = gpio_pin_configure_dt(&cfg->in_gpio, GPIO_OUTPUT_INACTIVE);
+	if (rc < 0) {
+		return rc;
+	}
+
+	/* Enable the cycle counter, it may already be running for tracing. */
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	data->t0h = ws2812_gpio_ns_to_cycles(cfg->t0h_ns);
+	data->t1h = ws2812_gpio_ns_to_cycles(cfg->t1h_ns);
+	data->tl = ws2812_gpio_ns_to_cycles(cfg->tl_ns);
+
+	/* A pulse cannot be shorter than one call to clear the pin. */
+	key = irq_lock();
+	overhead = ws2812_gpio_cycles();
+	gpio_port_clear_bits_raw(cfg->in_gpio.port, BIT(cfg->in_gpio.pin));
+	overhead = ws2812_gpio_cycles() - overhead;
+	irq_unlock(key);
+
+	LOG_DBG("T0H %u T1H %u TL %u cycles, GPIO write %u cycles at %u Hz",
+		data->t0h, data->t1h, data->tl, overhead, SystemCoreClock);
+
+	if (overhead >= data->t0h) {
+		LOG_ERR("GPIO write takes %u cycles, too slow for T0H of %u ns",
+			overhead, cfg->t0h_ns);
+		return -ENOTSUP;
+	}
+
+	return 0;
+}
+
 static const struct led_strip_driver_api ws2812_gpio_api = {
 	.update_rgb = ws2812_gpio_update_rgb,
 	.update_channels = ws2812_gpio_update_channels,
 };
 
+#define WS2812_GPIO_NUM_PIXELS(idx) \
+	(DT_INST_PROP(idx, chain_length))
+#define WS2812_GPIO_BUFSZ(idx) \
+	(WS2812_NUM_COLORS(idx) * WS2812_GPIO_NUM_PIXELS(idx))
+
 /*
- * Retrieve the channel to color mapping (e.g. RGB, BGR, GRB, ...) from the
- * "color-mapping" DT property.
+ * Store one channel of the current pixel, the channel is picked from the
+ * "color-mapping" DT property at compile time.
  */
-#define WS2812_COLOR_MAPPING(idx)					\
-static const uint8_t ws2812_gpio_##idx##_color_mapping[] =		\
-	DT_INST_PROP(idx, color_mapping)
-
-#define WS2812_NUM_COLORS(idx) (DT_INST_PROP_LEN(idx, color_mapping))
+#define WS2812_GPIO_SER_CHANNEL(node_id, prop, n)			\
+	*ptr++ = WS2812_CHANNEL_BY_IDX(node_id, prop, n, ro, go, bo, wo);
 
 /*
- * The inline assembly above is designed to work on nRF51 devices with
- * the 16 MHz clock enabled.
- *
- * TODO: try to make this portable, or at least port to more devices.
+ * Generate the encoder of an instance, with its channel order and channel
+ * count folded in.
  */
-
-#define WS2812_GPIO_DEVICE(idx)					\
-									\
-	static int ws2812_gpio_##idx##_init(const struct device *dev)	\
+#define WS2812_GPIO_ENCODER(idx)					\
+	static void ws2812_gpio_##idx##_encode(uint8_t *ptr,		\
+					       const struct led_rgb *pixels, \
+					       size_t num_pixels)	\
 	{								\
-		const struct ws2812_gpio_cfg *cfg = dev->config;	\
-		uint8_t i;						\
+		size_t i;						\
 									\
-		if (!gpio_is_ready_dt(&cfg->in_gpio)) {		\
-			LOG_ERR("GPIO device not ready");		\
-			return -ENODEV;					\
-		}							\
+		for (i = 0; i < num_pixels; i++) {			\
+			uint8_t ro, go, bo, wo;				\
+									\
+			rgbw_conversion(				\
+				/* outs: */ &ro, &go, &bo, &wo,		\
+				/*  ins: */ pixels[i].r, pixels[i].g,	\
+					    pixels[i].b,		\
+				/* algo: */ WS2812_RGBW_ALGO(idx)	\
+			);						\
 									\
-		for (i = 0; i < cfg->num_colors; i++) {			\
-			switch (cfg->color_mapping[i]) {		\
-			case LED_COLOR_ID_WHITE:			\
-			case LED_COLOR_ID_RED:				\
-			case LED_COLOR_ID_GREEN:			\
-			case LED_COLOR_ID_BLUE:				\
-				break;					\
-			default:					\
-				LOG_ERR("%s: invalid channel to color mapping." \
-					" Check the color-mapping DT property",	\
-					dev->name);			\
-				return -EINVAL;				\
-			}						\
+			DT_INST_FOREACH_PROP_ELEM(idx, color_mapping,	\
+						  WS2812_GPIO_SER_CHANNEL) \
 		}							\
+	}
+
+#define WS2812_GPIO_DEVICE(idx)					\
+									\
+	static uint8_t ws2812_gpio_##idx##_px_buf[WS2812_GPIO_BUFSZ(idx)]; \
 									\
-		return gpio_pin_configure_dt(&cfg->in_gpio, GPIO_OUTPUT); \
-	}								\
+	WS2812_CHECK_COLOR_MAPPING(idx)					\
+	WS2812_CHECK_RGBW_ALGO(idx)					\
+	BUILD_ASSERT(DT_INST_PROP(idx, t0h_ns) < DT_INST_PROP(idx, t1h_ns), \
+		     "t0h-ns must be shorter than t1h-ns");		\
 									\
-	WS2812_COLOR_MAPPING(idx);					\
+	WS2812_GPIO_ENCODER(idx)					\
+									\
+	static struct ws2812_gpio_data ws2812_gpio_##idx##_data;	\
 									\
 	static const struct ws2812_gpio_cfg ws2812_gpio_##idx##_cfg = { \
 		.in_gpio = GPIO_DT_SPEC_INST_GET(idx, in_gpios),	\
+		.px_buf = ws2812_gpio_##idx##_px_buf,			\
+		.px_buf_size = WS2812_GPIO_BUFSZ(idx),			\
 		.num_colors = WS2812_NUM_COLORS(idx),			\
-		.color_mapping = ws2812_gpio_##idx##_color_mapping,	\
+		.encode = ws2812_gpio_##idx##_encode,			\
+		.t0h_ns = DT_INST_PROP(idx, t0h_ns),			\
+		.t1h_ns = DT_INST_PROP(idx, t1h_ns),			\
+		.tl_ns = DT_INST_PROP(idx, tl_ns),			\
+		.reset_delay = DT_INST_PROP(idx, reset_delay),		\
 	};								\
 									\
 	DEVICE_DT_INST_DEFINE(idx,					\
-			    ws2812_gpio_##idx##_init,			\
-			    NULL,					\
+			    ws2812_gpio_init,				\
 			    NULL,					\
+			    &ws2812_gpio_##idx##_data,			\
 			    &ws2812_gpio_##idx##_cfg, POST_KERNEL,	\
 			    CONFIG_LED_STRIP_INIT_PRIORITY,		\
 			    &ws2812_gpio_api);
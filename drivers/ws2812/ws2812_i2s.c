@@ -13,10 +13,16 @@
  * A single LED color (8 data bits) will take up one 32-bit word or one LRCK
  * period. This means a standard RGB led will take 3 LRCK periods to transmit.
  *
+ * Dual strip mode:
+ * Two chains share the data line through a demux driven by LRCK. The
+ * peripheral runs with 8-bit samples, a left and a right slot per LRCK period
+ * each carry the high pulse of one bit of their chain, the other chain's line
+ * stays low meanwhile. A 32-bit word then holds two bits of each chain.
+ *
  * SPDX-License-Identifier: Apache-2.0
  */
 
-#define DT_DRV_COMPAT worldsemi_ws2812_i2s
+#define DT_DRV_COMPAT leonfyi_ws2812_i2s
 
 #include <string.h>
 
@@ -32,22 +38,64 @@ LOG_MODULE_REGISTER(ws2812_i2s);
 #include <zephyr/kernel.h>
 #include <zephyr/sys/util.h>
 
+#include <lumen/drivers/ws2812.h>
+#include <ws2812_timing.h>
+
 #include "rgbw.h"
+#include "ws2812.h"
 
 #define WS2812_I2S_PRE_DELAY_WORDS 1
 
+/* Words of the largest unit, a pair of four color pixels in dual mode. */
+#define WS2812_I2S_MAX_UNIT_WORDS 16
+
+/*
+ * Per-instance encoder, converts num_pixels RGB color values into I2S words
+ * in the instance's on-wire channel order.
+ */
+typedef void (*ws2812_i2s_encode_t)(uint32_t *tx_buf, const struct led_rgb *pixels,
+				    size_t num_pixels);
+
+/*
+ * Per-instance encoder of dual strip mode, converts pairs of a left and a
+ * right chain pixel into I2S words.
+ */
+typedef void (*ws2812_i2s_encode_dual_t)(uint32_t *tx_buf, const struct led_rgb *left,
+					 const struct led_rgb *right, size_t num_pairs);
+
 struct ws2812_i2s_cfg {
 	struct device const *dev;
 	size_t tx_buf_bytes;
 	struct k_mem_slab *mem_slab;
 	uint8_t num_colors;
-	const uint8_t *color_mapping;
+	ws2812_i2s_encode_t encode;
+	/* Dual strip mode only, the left chain is the first half of pixels. */
+	ws2812_i2s_encode_dual_t encode_dual;
+	size_t half;
+	/* Words per pixel, or per pair in dual strip mode. */
+	uint8_t unit_words;
 	uint16_t reset_words;
 	uint32_t lrck_period;
+	uint32_t word_period;
 	uint32_t extra_wait_time_us;
 	bool active_low;
-	uint8_t nibble_one;
-	uint8_t nibble_zero;
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PALETTE
+	uint32_t *pal_buf;
+#endif
+};
+
+struct ws2812_i2s_data {
+	k_timepoint_t latch;
+	struct ws2812_stats stats;
+};
+
+/* Pixels of a frame, either RGB values or palette indices. */
+struct ws2812_i2s_src {
+	const struct led_rgb *pixels;
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PALETTE
+	const uint8_t *indices;
+	uint8_t bits;
+#endif
 };
 
 /* Serialize an 8-bit color channel value into two 16-bit I2S values (or 1 32-bit
@@ -69,27 +117,357 @@ static inline void ws2812_i2s_ser(uint32_t *word, uint8_t color, const uint8_t s
 	*word = (*word >> 16) | (*word << 16);
 }
 
-static int ws2812_strip_update_rgb(const struct device *dev, struct led_rgb *pixels,
-				   size_t num_pixels)
+/*
+ * Serialize a color channel of a left and a right chain pixel into four words,
+ * a byte symbol per bit and slot, MSB first. The bytes of a word go out in
+ * order, left slot first.
+ */
+static inline void ws2812_i2s_ser_pair(uint32_t *words, uint8_t left, uint8_t right,
+				       const uint8_t sym_one, const uint8_t sym_zero)
+{
+	for (uint8_t i = 0; i < 4; i++) {
+		uint32_t word = 0;
+
+		for (uint8_t j = 0; j < 2; j++) {
+			uint8_t bit = 7 - 2 * i - j;
+			uint32_t l = (left & BIT(bit)) ? sym_one : sym_zero;
+			uint32_t r = (right & BIT(bit)) ? sym_one : sym_zero;
+
+			word |= (l | r << 8) << (16 * j);
+		}
+
+		words[i] = word;
+	}
+}
+
+/*
+ * Units encoded for an update, pixels or in dual strip mode pairs of pixels,
+ * or a negative errno code.
+ */
+static int ws2812_i2s_units(const struct ws2812_i2s_cfg *cfg, size_t num_pixels)
+{
+	if (cfg->encode_dual == NULL) {
+		return num_pixels;
+	}
+
+	/* Both chains go out in the same words, they cannot be updated alone. */
+	if (num_pixels != 2 * cfg->half) {
+		return -EINVAL;
+	}
+
+	return cfg->half;
+}
+
+/*
+ * Convert units [first, first + n) into I2S words. Palette indices must have
+ * been checked and the palette converted into cfg->pal_buf before.
+ */
+static void ws2812_i2s_fill(const struct ws2812_i2s_cfg *cfg, const struct ws2812_i2s_src *src,
+			    uint32_t *tx_buf, size_t first, size_t n)
+{
+	if (cfg->encode_dual != NULL) {
+		cfg->encode_dual(tx_buf, &src->pixels[first], &src->pixels[cfg->half + first], n);
+		return;
+	}
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PALETTE
+	if (src->indices != NULL) {
+		for (size_t i = first; i < first + n; i++) {
+			uint8_t index = ws2812_palette_index(src->indices, src->bits, i);
+
+			memcpy(tx_buf, &cfg->pal_buf[index * cfg->num_colors],
+			       cfg->num_colors * sizeof(uint32_t));
+			tx_buf += cfg->num_colors;
+		}
+		return;
+	}
+#endif
+
+	cfg->encode(tx_buf, &src->pixels[first], n);
+}
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_I2S_STREAM
+
+/* Start TX once all but one chunk buffer are queued. */
+#define WS2812_I2S_STREAM_PRIME_BLOCKS (CONFIG_LUMEN_WS2812_STRIP_I2S_STREAM_CHUNKS - 1)
+
+/* Cursor into the ring of chunk buffers while streaming a frame. */
+struct ws2812_i2s_stream {
+	const struct ws2812_i2s_cfg *cfg;
+	struct ws2812_stats *stats;
+	uint64_t mark;
+	uint32_t *block;
+	size_t pos;
+	size_t queued;
+	bool started;
+};
+
+/* Queue the current chunk, and start TX once enough chunks are ahead. */
+static int ws2812_i2s_stream_flush(struct ws2812_i2s_stream *s)
+{
+	const struct ws2812_i2s_cfg *cfg = s->cfg;
+	int ret;
+
+	ret = i2s_write(cfg->dev, s->block, cfg->tx_buf_bytes);
+	if (ret < 0) {
+		k_mem_slab_free(cfg->mem_slab, s->block);
+		s->block = NULL;
+		LOG_ERR("Failed to write data: %d", ret);
+		return ret;
+	}
+
+	s->block = NULL;
+	s->queued++;
+
+	if (!s->started && s->queued >= WS2812_I2S_STREAM_PRIME_BLOCKS) {
+		ret = i2s_trigger(cfg->dev, I2S_DIR_TX, I2S_TRIGGER_START);
+		if (ret < 0) {
+			LOG_ERR("Failed to trigger command %d on TX: %d", I2S_TRIGGER_START, ret);
+			return ret;
+		}
+		s->started = true;
+	}
+
+	return 0;
+}
+
+/*
+ * Make sure there is room for at least one more word. Once TX runs, this
+ * blocks until the DMA has moved past a chunk and the driver released it.
+ */
+static int ws2812_i2s_stream_room(struct ws2812_i2s_stream *s)
+{
+	const struct ws2812_i2s_cfg *cfg = s->cfg;
+	void *mem_block;
+	int ret;
+
+	if (s->block != NULL && s->pos == cfg->tx_buf_bytes / sizeof(uint32_t)) {
+		ret = ws2812_i2s_stream_flush(s);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	if (s->block == NULL) {
+		ret = k_mem_slab_alloc(cfg->mem_slab, &mem_block, K_SECONDS(1));
+		if (ret < 0) {
+			LOG_ERR("Unable to allocate mem slab for TX (err %d)", ret);
+			return -ENOMEM;
+		}
+		s->block = (uint32_t *)mem_block;
+		s->pos = 0;
+	}
+
+	return 0;
+}
+
+static int ws2812_i2s_stream_put(struct ws2812_i2s_stream *s, uint32_t word, size_t count)
+{
+	int ret;
+
+	while (count--) {
+		ret = ws2812_i2s_stream_room(s);
+		if (ret < 0) {
+			return ret;
+		}
+		s->block[s->pos++] = word;
+	}
+
+	return 0;
+}
+
+static int ws2812_i2s_stream_pixels(struct ws2812_i2s_stream *s,
+				    const struct ws2812_i2s_src *src, size_t num_units)
+{
+	const struct ws2812_i2s_cfg *cfg = s->cfg;
+	const size_t block_words = cfg->tx_buf_bytes / sizeof(uint32_t);
+	uint32_t words[WS2812_I2S_MAX_UNIT_WORDS];
+	size_t i = 0;
+	size_t n;
+	int ret;
+
+	while (i < num_units) {
+		ret = ws2812_i2s_stream_room(s);
+		if (ret < 0) {
+			return ret;
+		}
+
+		/* Waiting for room is waiting for the transfer. */
+		ws2812_stats_lap(&s->stats->transfer_cycles, &s->mark);
+
+		/* Encode as many whole units as fit into the current chunk. */
+		n = MIN(num_units - i, (block_words - s->pos) / cfg->unit_words);
+		if (n > 0) {
+			ws2812_i2s_fill(cfg, src, &s->block[s->pos], i, n);
+			ws2812_stats_lap(&s->stats->encode_cycles, &s->mark);
+			s->pos += n * cfg->unit_words;
+			i += n;
+			continue;
+		}
+
+		/* The next unit straddles two chunks. */
+		ws2812_i2s_fill(cfg, src, words, i, 1);
+		ws2812_stats_lap(&s->stats->encode_cycles, &s->mark);
+		for (uint8_t j = 0; j < cfg->unit_words; j++) {
+			ret = ws2812_i2s_stream_put(s, words[j], 1);
+			if (ret < 0) {
+				return ret;
+			}
+		}
+		i++;
+	}
+
+	return 0;
+}
+
+/* Wait until the driver released all chunk buffers, i.e. TX is over. */
+static int ws2812_i2s_stream_wait(const struct ws2812_i2s_cfg *cfg)
+{
+	void *mem_blocks[CONFIG_LUMEN_WS2812_STRIP_I2S_STREAM_CHUNKS];
+	size_t n;
+	int ret = 0;
+
+	for (n = 0; n < ARRAY_SIZE(mem_blocks); n++) {
+		ret = k_mem_slab_alloc(cfg->mem_slab, &mem_blocks[n], K_SECONDS(1));
+		if (ret < 0) {
+			break;
+		}
+	}
+
+	while (n--) {
+		k_mem_slab_free(cfg->mem_slab, mem_blocks[n]);
+	}
+
+	return ret;
+}
+
+static int ws2812_i2s_update(const struct device *dev, const struct ws2812_i2s_src *src,
+			     size_t num_pixels)
 {
 	const struct ws2812_i2s_cfg *cfg = dev->config;
-	uint8_t sym_one, sym_zero;
+	struct ws2812_i2s_data *data = dev->data;
+	struct ws2812_i2s_stream s = { .cfg = cfg, .stats = &data->stats };
+	uint32_t reset_word;
+	uint32_t flush_time_us;
+	int units;
+	int ret;
+
+	units = ws2812_i2s_units(cfg, num_pixels);
+	if (units < 0) {
+		return units;
+	}
+
+	reset_word = cfg->active_low ? 0xFFFFFFFF : 0;
+	s.mark = ws2812_stats_begin(&data->stats);
+
+	/*
+	 * Chunks can only be queued once the previous frame is out, wait for
+	 * its latch and for its chunks to be released.
+	 */
+	ws2812_latch_wait(&data->latch);
+
+	ret = ws2812_i2s_stream_wait(cfg);
+	if (ret < 0) {
+		LOG_ERR("Timed out waiting for TX to finish (err %d)", ret);
+		return ret;
+	}
+	ws2812_stats_lap(&data->stats.latch_cycles, &s.mark);
+
+	/* Add a pre-data reset, so the first pixel isn't skipped by the strip. */
+	ret = ws2812_i2s_stream_put(&s, reset_word, WS2812_I2S_PRE_DELAY_WORDS);
+	if (ret < 0) {
+		goto abort;
+	}
+
+	ret = ws2812_i2s_stream_pixels(&s, src, units);
+	if (ret < 0) {
+		goto abort;
+	}
+
+	ret = ws2812_i2s_stream_put(&s, reset_word, cfg->reset_words);
+	if (ret < 0) {
+		goto abort;
+	}
+
+	/* Pad the last chunk with reset words and queue it. */
+	ret = ws2812_i2s_stream_put(&s, reset_word,
+				    cfg->tx_buf_bytes / sizeof(uint32_t) - s.pos);
+	if (ret < 0) {
+		goto abort;
+	}
+
+	ret = ws2812_i2s_stream_flush(&s);
+	if (ret < 0) {
+		goto abort;
+	}
+
+	if (!s.started) {
+		ret = i2s_trigger(cfg->dev, I2S_DIR_TX, I2S_TRIGGER_START);
+		if (ret < 0) {
+			LOG_ERR("Failed to trigger command %d on TX: %d", I2S_TRIGGER_START, ret);
+			goto abort;
+		}
+	}
+
+	ret = i2s_trigger(cfg->dev, I2S_DIR_TX, I2S_TRIGGER_DRAIN);
+	if (ret < 0) {
+		LOG_ERR("Failed to trigger command %d on TX: %d", I2S_TRIGGER_DRAIN, ret);
+		goto abort;
+	}
+
+	ws2812_stats_lap(&data->stats.transfer_cycles, &s.mark);
+
+	/* At most all chunk buffers are still queued. */
+	flush_time_us = cfg->word_period * cfg->tx_buf_bytes / sizeof(uint32_t) *
+			MIN(s.queued, CONFIG_LUMEN_WS2812_STRIP_I2S_STREAM_CHUNKS);
+	ws2812_latch_start(&data->latch, flush_time_us + cfg->extra_wait_time_us);
+
+	return 0;
+
+abort:
+	/*
+	 * Most likely a chunk was not encoded before the previous one ran
+	 * out. Throw away what is queued and bring the interface back into
+	 * the ready state for the next frame.
+	 */
+	if (s.block != NULL) {
+		k_mem_slab_free(cfg->mem_slab, s.block);
+	}
+	(void)i2s_trigger(cfg->dev, I2S_DIR_TX, I2S_TRIGGER_DROP);
+	(void)i2s_trigger(cfg->dev, I2S_DIR_TX, I2S_TRIGGER_PREPARE);
+
+	return ret;
+}
+
+#else
+
+static int ws2812_i2s_update(const struct device *dev, const struct ws2812_i2s_src *src,
+			     size_t num_pixels)
+{
+	const struct ws2812_i2s_cfg *cfg = dev->config;
+	struct ws2812_i2s_data *data = dev->data;
 	uint32_t reset_word;
 	uint32_t *tx_buf;
 	uint32_t flush_time_us;
+	size_t tx_bytes;
 	void *mem_block;
+	uint64_t mark;
+	int units;
 	int ret;
 
-	if (cfg->active_low) {
-		sym_one = (~cfg->nibble_one) & 0x0F;
-		sym_zero = (~cfg->nibble_zero) & 0x0F;
-		reset_word = 0xFFFFFFFF;
-	} else {
-		sym_one = cfg->nibble_one & 0x0F;
-		sym_zero = cfg->nibble_zero & 0x0F;
-		reset_word = 0;
+	units = ws2812_i2s_units(cfg, num_pixels);
+	if (units < 0) {
+		return units;
+	}
+
+	if (units > (cfg->tx_buf_bytes / sizeof(uint32_t) - WS2812_I2S_PRE_DELAY_WORDS -
+		     cfg->reset_words) / cfg->unit_words) {
+		return -ENOMEM;
 	}
 
+	reset_word = cfg->active_low ? 0xFFFFFFFF : 0;
+	mark = ws2812_stats_begin(&data->stats);
+
 	/* Acquire memory for the I2S payload. */
 	ret = k_mem_slab_alloc(cfg->mem_slab, &mem_block, K_SECONDS(10));
 	if (ret < 0) {
@@ -97,6 +475,7 @@ static int ws2812_strip_update_rgb(const struct device *dev, struct led_rgb *pix
 		return -ENOMEM;
 	}
 	tx_buf = (uint32_t *)mem_block;
+	ws2812_stats_lap(&data->stats.latch_cycles, &mark);
 
 	/* Add a pre-data reset, so the first pixel isn't skipped by the strip. */
 	for (uint16_t i = 0; i < WS2812_I2S_PRE_DELAY_WORDS; i++) {
@@ -108,46 +487,22 @@ static int ws2812_strip_update_rgb(const struct device *dev, struct led_rgb *pix
 	 * Convert pixel data into I2S frames. Each frame has pixel data
 	 * in color mapping on-wire format (e.g. GRB, GRBW, RGB, etc).
 	 */
-	for (uint16_t i = 0; i < num_pixels; i++) {
-		uint8_t ro, go, bo, wo;
-		rgbw_conversion(
-			/* outs: */ &ro, &go, &bo, &wo,
-			/*  ins: */ pixels[i].r, pixels[i].g, pixels[i].b,
-			/* algo: */ 4
-		);
-
-		for (uint16_t j = 0; j < cfg->num_colors; j++) {
-			uint8_t pixel;
-
-			switch (cfg->color_mapping[j]) {
-			/* White channel is not supported by LED strip API. */
-			case LED_COLOR_ID_WHITE:
-				pixel = wo;
-				break;
-			case LED_COLOR_ID_RED:
-				pixel = ro;
-				break;
-			case LED_COLOR_ID_GREEN:
-				pixel = go;
-				break;
-			case LED_COLOR_ID_BLUE:
-				pixel = bo;
-				break;
-			default:
-				return -EINVAL;
-			}
-			ws2812_i2s_ser(tx_buf, pixel, sym_one, sym_zero);
-			tx_buf++;
-		}
-	}
+	ws2812_i2s_fill(cfg, src, tx_buf, 0, units);
+	tx_buf += units * cfg->unit_words;
+	ws2812_stats_lap(&data->stats.encode_cycles, &mark);
 
 	for (uint16_t i = 0; i < cfg->reset_words; i++) {
 		*tx_buf = reset_word;
 		tx_buf++;
 	}
 
-	/* Flush the buffer on the wire. */
-	ret = i2s_write(cfg->dev, mem_block, cfg->tx_buf_bytes);
+	/* The previous frame may still be latching. */
+	ws2812_latch_wait(&data->latch);
+	ws2812_stats_lap(&data->stats.latch_cycles, &mark);
+
+	/* Flush the buffer on the wire, only as far as it was filled. */
+	tx_bytes = (uint8_t *)tx_buf - (uint8_t *)mem_block;
+	ret = i2s_write(cfg->dev, mem_block, tx_bytes);
 	if (ret < 0) {
 		k_mem_slab_free(cfg->mem_slab, mem_block);
 		LOG_ERR("Failed to write data: %d", ret);
@@ -166,13 +521,78 @@ static int ws2812_strip_update_rgb(const struct device *dev, struct led_rgb *pix
 		return ret;
 	}
 
-	/* Wait until transaction is over */
-	flush_time_us = cfg->lrck_period * cfg->tx_buf_bytes / sizeof(uint32_t);
-	k_usleep(flush_time_us + cfg->extra_wait_time_us);
+	ws2812_stats_lap(&data->stats.transfer_cycles, &mark);
+
+	/* Let the next update wait until the transaction is over. */
+	flush_time_us = cfg->word_period * tx_bytes / sizeof(uint32_t);
+	ws2812_latch_start(&data->latch, flush_time_us + cfg->extra_wait_time_us);
 
 	return ret;
 }
 
+#endif /* CONFIG_LUMEN_WS2812_STRIP_I2S_STREAM */
+
+static int ws2812_strip_update_rgb(const struct device *dev, struct led_rgb *pixels,
+				   size_t num_pixels)
+{
+	const struct ws2812_i2s_src src = { .pixels = pixels };
+
+	return ws2812_i2s_update(dev, &src, num_pixels);
+}
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PALETTE
+int ws2812_update_indexed(const struct device *dev, const uint8_t *indices, size_t num_pixels,
+			  uint8_t bits, const struct led_rgb *palette, size_t palette_len)
+{
+	const struct ws2812_i2s_cfg *cfg = dev->config;
+	const struct ws2812_i2s_src src = { .indices = indices, .bits = bits };
+	int ret;
+
+	/* Pixels of both chains share words, there is no word per entry. */
+	if (cfg->encode_dual != NULL) {
+		return -ENOTSUP;
+	}
+
+	ret = ws2812_palette_check(bits, palette_len);
+	if (ret < 0) {
+		return ret;
+	}
+
+	/* Check up front, a streamed frame cannot be taken back half way. */
+	ret = ws2812_palette_check_indices(indices, num_pixels, bits, palette_len);
+	if (ret < 0) {
+		return ret;
+	}
+
+	/* Convert each palette entry once, pixels only copy its words. */
+	cfg->encode(cfg->pal_buf, palette, palette_len);
+
+	return ws2812_i2s_update(dev, &src, num_pixels);
+}
+#endif /* CONFIG_LUMEN_WS2812_STRIP_PALETTE */
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_STATS
+int ws2812_get_stats(const struct device *dev, struct ws2812_stats *stats)
+{
+	const struct ws2812_i2s_data *data = dev->data;
+
+	*stats = data->stats;
+
+	return 0;
+}
+#endif
+
+int ws2812_update_rgb_range(const struct device *dev, struct led_rgb *pixels, size_t num_pixels,
+			    size_t first, size_t count)
+{
+	if (first > num_pixels || count > num_pixels - first) {
+		return -EINVAL;
+	}
+
+	/* TX blocks are not kept between updates, convert everything. */
+	return ws2812_strip_update_rgb(dev, pixels, num_pixels);
+}
+
 static int ws2812_strip_update_channels(const struct device *dev, uint8_t *channels,
 					size_t num_channels)
 {
@@ -191,10 +611,19 @@ static int ws2812_i2s_init(const struct device *dev)
 	LOG_DBG("Word clock: freq %u Hz period %u us",
 		lrck_hz, cfg->lrck_period);
 
-	/* 16-bit stereo, 100kHz LCLK */
-	config.word_size = 16;
+	if (cfg->encode_dual != NULL) {
+		/*
+		 * 8-bit stereo, left justified so that the slots start with
+		 * the LRCK edges the demux switches on.
+		 */
+		config.word_size = 8;
+		config.format = I2S_FMT_DATA_FORMAT_LEFT_JUSTIFIED;
+	} else {
+		/* 16-bit stereo, 100kHz LCLK */
+		config.word_size = 16;
+		config.format = I2S_FMT_DATA_FORMAT_I2S;
+	}
 	config.channels = 2;
-	config.format = I2S_FMT_DATA_FORMAT_I2S;
 	config.options = I2S_OPT_BIT_CLK_MASTER | I2S_OPT_FRAME_CLK_MASTER;
 	config.frame_clk_freq = lrck_hz; /* WS (or LRCK) */
 	config.mem_slab = cfg->mem_slab;
@@ -207,21 +636,6 @@ static int ws2812_i2s_init(const struct device *dev)
 		return ret;
 	}
 
-	for (uint16_t i = 0; i < cfg->num_colors; i++) {
-		switch (cfg->color_mapping[i]) {
-		case LED_COLOR_ID_WHITE:
-		case LED_COLOR_ID_RED:
-		case LED_COLOR_ID_GREEN:
-		case LED_COLOR_ID_BLUE:
-			break;
-		default:
-			LOG_ERR("%s: invalid channel to color mapping."
-				"Check the color-mapping DT property",
-				dev->name);
-			return -EINVAL;
-		}
-	}
-
 	return 0;
 }
 
@@ -233,43 +647,177 @@ static const struct led_strip_driver_api ws2812_i2s_api = {
 /* Integer division, but always rounds up: e.g. 10/3 = 4 */
 #define WS2812_ROUNDED_DIVISION(x, y) ((x + (y - 1)) / y)
 
-#define WS2812_I2S_LRCK_PERIOD_US(idx) DT_INST_PROP(idx, lrck_period)
+#define WS2812_I2S_LRCK_PERIOD_US(idx)                                                             \
+	WS2812_TIMING_OR(DT_DRV_INST(idx), I2S_LRCK_PERIOD, lrck_period)
+
+#define WS2812_I2S_DUAL(idx) DT_INST_PROP(idx, dual_strip)
 
-#define WS2812_RESET_DELAY_US(idx)    DT_INST_PROP(idx, reset_delay)
+/* A word is one LRCK period of 16-bit samples or two of 8-bit samples. */
+#define WS2812_I2S_WORD_PERIOD_US(idx)                                                             \
+	(WS2812_I2S_LRCK_PERIOD_US(idx) * (WS2812_I2S_DUAL(idx) ? 2 : 1))
+
+/* Words per pixel, or per pair of pixels, of each color. */
+#define WS2812_I2S_COLOR_WORDS(idx) (WS2812_I2S_DUAL(idx) ? 4 : 1)
+#define WS2812_I2S_UNIT_WORDS(idx) (WS2812_NUM_COLORS(idx) * WS2812_I2S_COLOR_WORDS(idx))
+
+#define WS2812_RESET_DELAY_US(idx)                                                                 \
+	WS2812_TIMING_OR(DT_DRV_INST(idx), RESET_DELAY, reset_delay)
 /* Rounds up to the next 20us. */
 #define WS2812_RESET_DELAY_WORDS(idx) WS2812_ROUNDED_DIVISION(WS2812_RESET_DELAY_US(idx), \
-							      WS2812_I2S_LRCK_PERIOD_US(idx))
-
-#define WS2812_NUM_COLORS(idx) (DT_INST_PROP_LEN(idx, color_mapping))
+							      WS2812_I2S_WORD_PERIOD_US(idx))
 
 #define WS2812_I2S_NUM_PIXELS(idx) (DT_INST_PROP(idx, chain_length))
 
+/* Encoded units, pixels or pairs of pixels of both chains. */
+#define WS2812_I2S_NUM_UNITS(idx)                                                                  \
+	(WS2812_I2S_NUM_PIXELS(idx) / (WS2812_I2S_DUAL(idx) ? 2 : 1))
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_I2S_STREAM
+/* One chunk, frames are streamed through a ring of these. */
 #define WS2812_I2S_BUFSIZE(idx)                                                                    \
-	(((WS2812_NUM_COLORS(idx) * WS2812_I2S_NUM_PIXELS(idx)) +	                           \
+	(WS2812_I2S_UNIT_WORDS(idx) * CONFIG_LUMEN_WS2812_STRIP_I2S_STREAM_CHUNK_PIXELS * 4)
+#define WS2812_I2S_BUFCOUNT CONFIG_LUMEN_WS2812_STRIP_I2S_STREAM_CHUNKS
+#else
+#define WS2812_I2S_BUFSIZE(idx)                                                                    \
+	(((WS2812_I2S_UNIT_WORDS(idx) * WS2812_I2S_NUM_UNITS(idx)) +	                           \
 	  WS2812_I2S_PRE_DELAY_WORDS + WS2812_RESET_DELAY_WORDS(idx)) * 4)
+#define WS2812_I2S_BUFCOUNT 2
+#endif
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PALETTE
+/* Words of each palette entry. */
+#define WS2812_I2S_PALETTE_BUF(idx)                                                                \
+	static uint32_t ws2812_i2s_##idx##_pal_buf[WS2812_NUM_COLORS(idx) *                       \
+						   CONFIG_LUMEN_WS2812_STRIP_PALETTE_SIZE];
+#define WS2812_I2S_PALETTE_CFG(idx) .pal_buf = ws2812_i2s_##idx##_pal_buf,
+#else
+#define WS2812_I2S_PALETTE_BUF(idx)
+#define WS2812_I2S_PALETTE_CFG(idx)
+#endif
+
+/*
+ * Symbols for a one and a zero bit, from "led-timing" or the nibble DT
+ * property, inverted for active low outputs.
+ */
+#define WS2812_I2S_NIBBLE(node_id, name, nibble) WS2812_TIMING_OR(node_id, name, nibble)
+
+#define WS2812_I2S_SYM(node_id, name, nibble)                                                      \
+	(DT_PROP(node_id, out_active_low) ? (~WS2812_I2S_NIBBLE(node_id, name, nibble) & 0x0F)     \
+					  : (WS2812_I2S_NIBBLE(node_id, name, nibble) & 0x0F))
+
+/*
+ * Serialize one channel of the current pixel, the channel is picked from the
+ * "color-mapping" DT property at compile time.
+ */
+#define WS2812_I2S_SER_CHANNEL(node_id, prop, n)                                                   \
+	ws2812_i2s_ser(tx_buf, WS2812_CHANNEL_BY_IDX(node_id, prop, n, ro, go, bo, wo),           \
+		       WS2812_I2S_SYM(node_id, I2S_NIBBLE_ONE, nibble_one),                       \
+		       WS2812_I2S_SYM(node_id, I2S_NIBBLE_ZERO, nibble_zero));                    \
+	tx_buf++;
+
+/*
+ * Generate the encoder of an instance, with its channel order, channel count and
+ * symbols folded in.
+ */
+#define WS2812_I2S_ENCODER(idx)                                                                    \
+	static void ws2812_i2s_##idx##_encode(uint32_t *tx_buf, const struct led_rgb *pixels,      \
+					      size_t num_pixels)                                   \
+	{                                                                                          \
+		for (size_t i = 0; i < num_pixels; i++) {                                          \
+			uint8_t ro, go, bo, wo;                                                    \
+                                                                                                   \
+			rgbw_conversion(                                                           \
+				/* outs: */ &ro, &go, &bo, &wo,                                    \
+				/*  ins: */ pixels[i].r, pixels[i].g, pixels[i].b,                 \
+				/* algo: */ WS2812_RGBW_ALGO(idx)                                  \
+			);                                                                         \
+                                                                                                   \
+			DT_INST_FOREACH_PROP_ELEM(idx, color_mapping, WS2812_I2S_SER_CHANNEL)      \
+		}                                                                                  \
+	}
+
+/* Byte symbols of dual strip mode, which only come from "led-timing". */
+#define WS2812_I2S_SLOT(node_id, name)                                                             \
+	(DT_PROP(node_id, out_active_low) ? (~WS2812_TIMING(node_id, name) & 0xFF)                 \
+					  : (WS2812_TIMING(node_id, name) & 0xFF))
+
+/* Serialize one channel of the current pair of pixels. */
+#define WS2812_I2S_SER_PAIR_CHANNEL(node_id, prop, n)                                              \
+	ws2812_i2s_ser_pair(tx_buf, WS2812_CHANNEL_BY_IDX(node_id, prop, n, lro, lgo, lbo, lwo),  \
+			    WS2812_CHANNEL_BY_IDX(node_id, prop, n, rro, rgo, rbo, rwo),           \
+			    WS2812_I2S_SLOT(node_id, I2S_SLOT_ONE),                                \
+			    WS2812_I2S_SLOT(node_id, I2S_SLOT_ZERO));                              \
+	tx_buf += 4;
+
+#define WS2812_I2S_DUAL_ENCODER(idx)                                                               \
+	static void ws2812_i2s_##idx##_encode_dual(uint32_t *tx_buf, const struct led_rgb *left,   \
+						   const struct led_rgb *right, size_t num_pairs)  \
+	{                                                                                          \
+		for (size_t i = 0; i < num_pairs; i++) {                                           \
+			uint8_t lro, lgo, lbo, lwo;                                                \
+			uint8_t rro, rgo, rbo, rwo;                                                \
+                                                                                                   \
+			rgbw_conversion(&lro, &lgo, &lbo, &lwo, left[i].r, left[i].g, left[i].b,   \
+					WS2812_RGBW_ALGO(idx));                                    \
+			rgbw_conversion(&rro, &rgo, &rbo, &rwo, right[i].r, right[i].g,            \
+					right[i].b, WS2812_RGBW_ALGO(idx));                        \
+                                                                                                   \
+			DT_INST_FOREACH_PROP_ELEM(idx, color_mapping,                              \
+						  WS2812_I2S_SER_PAIR_CHANNEL)                     \
+		}                                                                                  \
+	}
+
+#define WS2812_I2S_CHECK_DUAL(idx)                                                                 \
+	BUILD_ASSERT(!WS2812_I2S_DUAL(idx) || (DT_INST_NODE_HAS_PROP(idx, led_timing) &&          \
+					       WS2812_I2S_NUM_PIXELS(idx) % 2 == 0),               \
+		     "dual-strip needs led-timing and an even chain-length, check the DT "        \
+		     "node " DT_NODE_PATH(DT_DRV_INST(idx)));                                      \
+	BUILD_ASSERT(!WS2812_I2S_DUAL(idx) || !DT_INST_PROP(idx, out_active_low),                  \
+		     "dual-strip needs SDOUT low between pulses for the LRCK gates, drop "         \
+		     "out-active-low from " DT_NODE_PATH(DT_DRV_INST(idx)));
+
+#define WS2812_I2S_CHECK_UNIT(idx)                                                                 \
+	BUILD_ASSERT(WS2812_I2S_UNIT_WORDS(idx) <= WS2812_I2S_MAX_UNIT_WORDS,                      \
+		     "pixels of " DT_NODE_PATH(DT_DRV_INST(idx)) " take more words than "          \
+		     "WS2812_I2S_MAX_UNIT_WORDS");
 
 #define WS2812_I2S_DEVICE(idx)                                                                     \
                                                                                                    \
-	K_MEM_SLAB_DEFINE_STATIC(ws2812_i2s_##idx##_slab, WS2812_I2S_BUFSIZE(idx), 2, 4);          \
+	K_MEM_SLAB_DEFINE_STATIC(ws2812_i2s_##idx##_slab, WS2812_I2S_BUFSIZE(idx),                \
+				 WS2812_I2S_BUFCOUNT, 4);                                          \
+	WS2812_I2S_PALETTE_BUF(idx)                                                                \
+                                                                                                   \
+	WS2812_CHECK_COLOR_MAPPING(idx)                                                            \
+	WS2812_CHECK_RGBW_ALGO(idx)                                                            \
+	WS2812_I2S_CHECK_DUAL(idx)                                                                 \
+	WS2812_I2S_CHECK_UNIT(idx)                                                                 \
+                                                                                                   \
+	COND_CODE_1(WS2812_I2S_DUAL(idx), (WS2812_I2S_DUAL_ENCODER(idx)),                          \
+		    (WS2812_I2S_ENCODER(idx)))                                                     \
                                                                                                    \
-	static const uint8_t ws2812_i2s_##idx##_color_mapping[] =                                  \
-		DT_INST_PROP(idx, color_mapping);                                                  \
+	static struct ws2812_i2s_data ws2812_i2s_##idx##_data;                                     \
                                                                                                    \
 	static const struct ws2812_i2s_cfg ws2812_i2s_##idx##_cfg = {                              \
 		.dev = DEVICE_DT_GET(DT_INST_PROP(idx, i2s_dev)),                                  \
 		.tx_buf_bytes = WS2812_I2S_BUFSIZE(idx),                                           \
 		.mem_slab = &ws2812_i2s_##idx##_slab,                                              \
 		.num_colors = WS2812_NUM_COLORS(idx),                                              \
-		.color_mapping = ws2812_i2s_##idx##_color_mapping,                                 \
+		.encode = COND_CODE_1(WS2812_I2S_DUAL(idx), (NULL),                                \
+				      (ws2812_i2s_##idx##_encode)),                                \
+		.encode_dual = COND_CODE_1(WS2812_I2S_DUAL(idx),                                   \
+					   (ws2812_i2s_##idx##_encode_dual), (NULL)),              \
+		.half = WS2812_I2S_NUM_PIXELS(idx) / 2,                                            \
+		.unit_words = WS2812_I2S_UNIT_WORDS(idx),                                          \
 		.lrck_period = WS2812_I2S_LRCK_PERIOD_US(idx),                                     \
+		.word_period = WS2812_I2S_WORD_PERIOD_US(idx),                                     \
 		.extra_wait_time_us = DT_INST_PROP(idx, extra_wait_time),                          \
 		.reset_words = WS2812_RESET_DELAY_WORDS(idx),                                      \
 		.active_low = DT_INST_PROP(idx, out_active_low),                                   \
-		.nibble_one = DT_INST_PROP(idx, nibble_one),                                       \
-		.nibble_zero = DT_INST_PROP(idx, nibble_zero),                                     \
+		WS2812_I2S_PALETTE_CFG(idx)                                                        \
 	};                                                                                         \
                                                                                                    \
-	DEVICE_DT_INST_DEFINE(idx, ws2812_i2s_init, NULL, NULL, &ws2812_i2s_##idx##_cfg,           \
-			      POST_KERNEL, CONFIG_LED_STRIP_INIT_PRIORITY, &ws2812_i2s_api);
+	DEVICE_DT_INST_DEFINE(idx, ws2812_i2s_init, NULL, &ws2812_i2s_##idx##_data,                \
+			      &ws2812_i2s_##idx##_cfg, POST_KERNEL,                                \
+			      CONFIG_LED_STRIP_INIT_PRIORITY, &ws2812_i2s_api);
 
 DT_INST_FOREACH_STATUS_OKAY(WS2812_I2S_DEVICE)
@@ -7,7 +7,7 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
-#define DT_DRV_COMPAT worldsemi_ws2812_spi
+#define DT_DRV_COMPAT leonfyi_ws2812_spi
 
 #include <zephyr/drivers/led_strip.h>
 
@@ -24,9 +24,27 @@ LOG_MODULE_REGISTER(ws2812_spi);
 #include <zephyr/sys/util.h>
 #include <zephyr/dt-bindings/led/led.h>
 
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PRESENT
+#include <hal/nrf_spim.h>
+#endif
+
+#include <lumen/drivers/ws2812.h>
+#include <ws2812_timing.h>
+
 #include "rgbw.h"
+#include "ws2812.h"
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PRESENT
+#include "present.h"
+#endif
+#ifdef CONFIG_LUMEN_WS2812_STRIP_RING
+#include "ring.h"
+#endif
 
-/* spi-one-frame and spi-zero-frame in DT are for 8-bit frames. */
+/*
+ * spi-one-frame and spi-zero-frame in DT are for 8-bit frames. Symbols of
+ * nodes with led-timing are as wide as the timing needs, they are packed
+ * into the 8-bit frames back to back.
+ */
 #define SPI_FRAME_BITS 8
 
 /*
@@ -41,15 +59,47 @@ LOG_MODULE_REGISTER(ws2812_spi);
 		  COND_CODE_1(DT_INST_PROP(idx, spi_cpha), (SPI_MODE_CPHA), (0)) | \
 		  SPI_WORD_SET(SPI_FRAME_BITS))
 
+/*
+ * Per-instance encoder, converts num_pixels RGB color values into SPI frames
+ * in the instance's on-wire channel order.
+ */
+typedef void (*ws2812_spi_encode_t)(uint8_t *px_buf,
+				    const struct led_rgb *pixels,
+				    size_t num_pixels);
+
 struct ws2812_spi_cfg {
 	struct spi_dt_spec bus;
 	uint8_t *px_buf;
 	size_t px_buf_size;
-	uint8_t one_frame;
-	uint8_t zero_frame;
-	uint8_t num_colors;
-	const uint8_t *color_mapping;
+	/* Bytes of SPI frames per pixel, colors times symbol bits. */
+	uint8_t pixel_bytes;
+	ws2812_spi_encode_t encode;
 	uint16_t reset_delay;
+	uint32_t frequency;
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PALETTE
+	uint8_t *pal_buf;
+#endif
+#ifdef CONFIG_LUMEN_WS2812_STRIP_RING
+	uint8_t *ring_buf;
+#endif
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PRESENT
+	NRF_SPIM_Type *spim;
+#endif
+};
+
+struct ws2812_spi_data {
+	/* cfg->bus, at the clock derived from the LED timing. */
+	struct spi_dt_spec bus;
+	k_timepoint_t latch;
+	struct ws2812_stats stats;
+#ifdef CONFIG_LUMEN_WS2812_STRIP_RING
+	struct ws2812_rings rings;
+#endif
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PRESENT
+	struct ws2812_present present;
+	/* Time it takes to shift out the armed frame. */
+	uint32_t armed_us;
+#endif
 };
 
 static const struct ws2812_spi_cfg *dev_cfg(const struct device *dev)
@@ -57,18 +107,33 @@ static const struct ws2812_spi_cfg *dev_cfg(const struct device *dev)
 	return dev->config;
 }
 
+static struct ws2812_spi_data *dev_data(const struct device *dev)
+{
+	return dev->data;
+}
+
 /*
  * Serialize an 8-bit color channel value into an equivalent sequence
- * of SPI frames, MSbit first, where a one bit becomes SPI frame
- * one_frame, and zero bit becomes zero_frame.
+ * of SPI frames, MSbit first, where a one bit becomes the bits wide symbol
+ * one_frame, and zero bit becomes zero_frame. Eight symbols take bits
+ * bytes. Inlined with a constant width, 8-bit symbols are plain stores.
  */
-static inline void ws2812_spi_ser(uint8_t buf[8], uint8_t color,
-				  const uint8_t one_frame, const uint8_t zero_frame)
+static ALWAYS_INLINE void ws2812_spi_ser(uint8_t *buf, uint8_t color,
+					 const uint16_t one_frame,
+					 const uint16_t zero_frame,
+					 const uint8_t bits)
 {
+	uint32_t acc = 0;
+	uint8_t n = 0;
 	int i;
 
 	for (i = 0; i < 8; i++) {
-		buf[i] = color & BIT(7 - i) ? one_frame : zero_frame;
+		acc = (acc << bits) | (color & BIT(7 - i) ? one_frame : zero_frame);
+		n += bits;
+		while (n >= 8) {
+			n -= 8;
+			*buf++ = acc >> n;
+		}
 	}
 }
 
@@ -82,87 +147,438 @@ static inline bool num_pixels_ok(const struct ws2812_spi_cfg *cfg,
 	size_t nbytes;
 	bool overflow;
 
-	overflow = size_mul_overflow(num_pixels, cfg->num_colors * 8, &nbytes);
+	overflow = size_mul_overflow(num_pixels, cfg->pixel_bytes, &nbytes);
 	return !overflow && (nbytes <= cfg->px_buf_size);
 }
 
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PRESENT
+int ws2812_present_at(const struct device *dev, int64_t tick)
+{
+	ws2812_present_set(&dev_data(dev)->present, tick);
+
+	return 0;
+}
+
+static void ws2812_spi_present_start(void *user_data)
+{
+	NRF_SPIM_Type *spim = user_data;
+
+	nrf_spim_task_trigger(spim, NRF_SPIM_TASK_START);
+}
+
 /*
- * Latch current color values on strip and reset its state machines.
+ * Hand len bytes of frames to the SPIM and let the present timer start it.
+ * The SPI driver configured the SPIM with the same settings before, and is
+ * not involved until the frame is out.
  */
-static inline void ws2812_reset_delay(uint16_t delay)
+static int ws2812_spi_present(const struct device *dev, const uint8_t *frames,
+			      size_t len)
+{
+	const struct ws2812_spi_cfg *cfg = dev_cfg(dev);
+	struct ws2812_spi_data *data = dev_data(dev);
+	int rc;
+
+	nrf_spim_int_disable(cfg->spim, NRF_SPIM_INT_END_MASK);
+	nrf_spim_event_clear(cfg->spim, NRF_SPIM_EVENT_END);
+	nrf_spim_tx_buffer_set(cfg->spim, frames, len);
+	nrf_spim_rx_buffer_set(cfg->spim, NULL, 0);
+
+	data->armed_us = (uint64_t)len * SPI_FRAME_BITS * USEC_PER_SEC /
+			 data->bus.config.frequency;
+
+	rc = ws2812_present_arm(&data->present);
+
+	/* A late frame was started right away, which is all we can do. */
+	return rc == -ETIME ? 0 : rc;
+}
+
+/* Wait until an armed frame is out, its frames must not change before. */
+static int ws2812_spi_present_wait(const struct device *dev)
 {
-	k_usleep(delay);
+	const struct ws2812_spi_cfg *cfg = dev_cfg(dev);
+	struct ws2812_spi_data *data = dev_data(dev);
+	int rc;
+
+	if (!data->present.armed) {
+		return 0;
+	}
+
+	rc = ws2812_present_wait(&data->present);
+	if (rc < 0) {
+		LOG_ERR("Armed frame did not start (err %d)", rc);
+		return rc;
+	}
+
+	k_sleep(K_TIMEOUT_ABS_TICKS(data->present.started_at +
+				    k_us_to_ticks_ceil64(data->armed_us)));
+	while (!nrf_spim_event_check(cfg->spim, NRF_SPIM_EVENT_END)) {
+		k_busy_wait(1);
+	}
+	nrf_spim_event_clear(cfg->spim, NRF_SPIM_EVENT_END);
+
+	ws2812_latch_start(&data->latch, cfg->reset_delay);
+
+	return 0;
 }
+#else
+static inline int ws2812_spi_present_wait(const struct device *dev)
+{
+	ARG_UNUSED(dev);
 
-static int ws2812_strip_update_rgb(const struct device *dev,
-				   struct led_rgb *pixels,
-				   size_t num_pixels)
+	return 0;
+}
+#endif /* CONFIG_LUMEN_WS2812_STRIP_PRESENT */
+
+/*
+ * Display num_pixels pixels of SPI frames, cfg->px_buf or a ring. Pixels
+ * further down the chain keep their colors, so short frames are shifted out
+ * in proportionally less time.
+ */
+static int ws2812_spi_transmit(const struct device *dev, const uint8_t *frames,
+			       size_t num_pixels, uint64_t *mark)
 {
 	const struct ws2812_spi_cfg *cfg = dev_cfg(dev);
-	const uint8_t one = cfg->one_frame, zero = cfg->zero_frame;
+	struct ws2812_spi_data *data = dev_data(dev);
 	struct spi_buf buf = {
-		.buf = cfg->px_buf,
-		.len = cfg->px_buf_size,
+		.buf = (uint8_t *)frames,
+		.len = num_pixels * cfg->pixel_bytes,
 	};
 	const struct spi_buf_set tx = {
 		.buffers = &buf,
 		.count = 1
 	};
-	uint8_t *px_buf = cfg->px_buf;
-	size_t i;
+	int rc;
+
+	/* The previous frame may still be latching. */
+	ws2812_latch_wait(&data->latch);
+	ws2812_stats_lap(&data->stats.latch_cycles, mark);
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PRESENT
+	if (ws2812_present_pending(&data->present)) {
+		if (buf.len <= SPIM_TXD_MAXCNT_MAXCNT_Msk) {
+			rc = ws2812_spi_present(dev, frames, buf.len);
+			ws2812_stats_lap(&data->stats.transfer_cycles, mark);
+			return rc;
+		}
+
+		/* Too long for a single EasyDMA transfer, send it now. */
+		ws2812_present_set(&data->present, WS2812_PRESENT_NONE);
+	}
+#endif
+
+	rc = spi_write_dt(&data->bus, &tx);
+	ws2812_stats_lap(&data->stats.transfer_cycles, mark);
+	ws2812_latch_start(&data->latch, cfg->reset_delay);
+
+	return rc;
+}
+
+static int ws2812_strip_update_rgb(const struct device *dev,
+				   struct led_rgb *pixels,
+				   size_t num_pixels)
+{
+	const struct ws2812_spi_cfg *cfg = dev_cfg(dev);
+	struct ws2812_spi_data *data = dev_data(dev);
+	uint64_t mark;
 	int rc;
 
 	if (!num_pixels_ok(cfg, num_pixels)) {
 		return -ENOMEM;
 	}
 
+	rc = ws2812_spi_present_wait(dev);
+	if (rc < 0) {
+		return rc;
+	}
+
+	mark = ws2812_stats_begin(&data->stats);
+
 	/*
 	 * Convert pixel data into SPI frames. Each frame has pixel data
 	 * in color mapping on-wire format (e.g. GRB, GRBW, RGB, etc).
 	 */
-	for (i = 0; i < num_pixels; i++) {
-		uint8_t j;
-
-		uint8_t ro, go, bo, wo;
-		rgbw_conversion(
-			/* outs: */ &ro, &go, &bo, &wo,
-			/*  ins: */ pixels[i].r, pixels[i].g, pixels[i].b,
-			/* algo: */ 4
-		);
-
-		for (j = 0; j < cfg->num_colors; j++) {
-			uint8_t pixel;
-
-			switch (cfg->color_mapping[j]) {
-			/* White channel is not supported by LED strip API. */
-			case LED_COLOR_ID_WHITE:
-				pixel = wo;
-				break;
-			case LED_COLOR_ID_RED:
-				pixel = ro;
-				break;
-			case LED_COLOR_ID_GREEN:
-				pixel = go;
-				break;
-			case LED_COLOR_ID_BLUE:
-				pixel = bo;
-				break;
-			default:
-				return -EINVAL;
-			}
-			ws2812_spi_ser(px_buf, pixel, one, zero);
-			px_buf += 8;
-		}
+	cfg->encode(cfg->px_buf, pixels, num_pixels);
+	ws2812_stats_lap(&data->stats.encode_cycles, &mark);
+
+	return ws2812_spi_transmit(dev, cfg->px_buf, num_pixels, &mark);
+}
+
+int ws2812_update_rgb_range(const struct device *dev, struct led_rgb *pixels,
+			    size_t num_pixels, size_t first, size_t count)
+{
+	const struct ws2812_spi_cfg *cfg = dev_cfg(dev);
+	struct ws2812_spi_data *data = dev_data(dev);
+	uint64_t mark;
+	int rc;
+
+	if (!num_pixels_ok(cfg, num_pixels)) {
+		return -ENOMEM;
+	}
+
+	if (first > num_pixels || count > num_pixels - first) {
+		return -EINVAL;
+	}
+
+	rc = ws2812_spi_present_wait(dev);
+	if (rc < 0) {
+		return rc;
+	}
+
+	mark = ws2812_stats_begin(&data->stats);
+
+	/* Frames of all other pixels are still in px_buf. */
+	cfg->encode(&cfg->px_buf[first * cfg->pixel_bytes], &pixels[first],
+		    count);
+	ws2812_stats_lap(&data->stats.encode_cycles, &mark);
+
+	return ws2812_spi_transmit(dev, cfg->px_buf, num_pixels, &mark);
+}
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PALETTE
+int ws2812_update_indexed(const struct device *dev, const uint8_t *indices,
+			  size_t num_pixels, uint8_t bits,
+			  const struct led_rgb *palette, size_t palette_len)
+{
+	const struct ws2812_spi_cfg *cfg = dev_cfg(dev);
+	struct ws2812_spi_data *data = dev_data(dev);
+	const size_t stride = cfg->pixel_bytes;
+	uint64_t mark;
+	size_t i;
+	int rc;
+
+	if (!num_pixels_ok(cfg, num_pixels)) {
+		return -ENOMEM;
+	}
+
+	rc = ws2812_palette_check(bits, palette_len);
+	if (rc < 0) {
+		return rc;
 	}
 
 	/*
-	 * Display the pixel data.
+	 * Check up front, px_buf keeps the frames of pixels later updates do
+	 * not convert again.
 	 */
-	rc = spi_write_dt(&cfg->bus, &tx);
-	ws2812_reset_delay(cfg->reset_delay);
+	rc = ws2812_palette_check_indices(indices, num_pixels, bits,
+					  palette_len);
+	if (rc < 0) {
+		return rc;
+	}
 
-	return rc;
+	rc = ws2812_spi_present_wait(dev);
+	if (rc < 0) {
+		return rc;
+	}
+
+	mark = ws2812_stats_begin(&data->stats);
+
+	/* Convert each palette entry once, pixels only copy its frames. */
+	cfg->encode(cfg->pal_buf, palette, palette_len);
+
+	for (i = 0; i < num_pixels; i++) {
+		uint8_t index = ws2812_palette_index(indices, bits, i);
+
+		memcpy(&cfg->px_buf[i * stride], &cfg->pal_buf[index * stride],
+		       stride);
+	}
+	ws2812_stats_lap(&data->stats.encode_cycles, &mark);
+
+	return ws2812_spi_transmit(dev, cfg->px_buf, num_pixels, &mark);
+}
+#endif /* CONFIG_LUMEN_WS2812_STRIP_PALETTE */
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_WINDOW
+int ws2812_acquire(const struct device *dev, size_t num_pixels, size_t first,
+		   size_t count, struct ws2812_window *win)
+{
+	const struct ws2812_spi_cfg *cfg = dev_cfg(dev);
+	struct ws2812_spi_data *data = dev_data(dev);
+	int rc;
+
+	if (!num_pixels_ok(cfg, num_pixels)) {
+		return -ENOMEM;
+	}
+
+	if (first > num_pixels || count > num_pixels - first) {
+		return -EINVAL;
+	}
+
+	rc = ws2812_spi_present_wait(dev);
+	if (rc < 0) {
+		return rc;
+	}
+
+	(void)ws2812_stats_begin(&data->stats);
+
+	*win = (struct ws2812_window){
+		.dev = dev,
+		.num_pixels = num_pixels,
+		.first = first,
+		.count = count,
+	};
+
+	return 0;
+}
+
+int ws2812_window_write(struct ws2812_window *win, size_t offset,
+			const struct led_rgb *pixels, size_t n)
+{
+	const struct ws2812_spi_cfg *cfg = dev_cfg(win->dev);
+	struct ws2812_spi_data *data = dev_data(win->dev);
+	uint64_t mark;
+	int rc;
+
+	rc = ws2812_window_check(win, offset, n);
+	if (rc < 0) {
+		return rc;
+	}
+
+	mark = ws2812_stats_mark();
+	cfg->encode(&cfg->px_buf[(win->first + offset) * cfg->pixel_bytes], pixels,
+		    n);
+	ws2812_stats_lap(&data->stats.encode_cycles, &mark);
+
+	return 0;
+}
+
+int ws2812_window_write_rgb24(struct ws2812_window *win, size_t offset,
+			      const uint8_t *rgb, size_t n)
+{
+	const struct ws2812_spi_cfg *cfg = dev_cfg(win->dev);
+	struct ws2812_spi_data *data = dev_data(win->dev);
+	struct led_rgb chunk[WS2812_RGB24_CHUNK];
+	uint8_t *px_buf;
+	uint64_t mark;
+	int rc;
+
+	rc = ws2812_window_check(win, offset, n);
+	if (rc < 0) {
+		return rc;
+	}
+
+	mark = ws2812_stats_mark();
+	px_buf = &cfg->px_buf[(win->first + offset) * cfg->pixel_bytes];
+
+	/* Only a few pixels at a time ever exist as struct led_rgb. */
+	while (n > 0) {
+		size_t m = MIN(n, ARRAY_SIZE(chunk));
+
+		ws2812_rgb24_unpack(chunk, rgb, m);
+		cfg->encode(px_buf, chunk, m);
+		px_buf += m * cfg->pixel_bytes;
+		rgb += 3 * m;
+		n -= m;
+	}
+	ws2812_stats_lap(&data->stats.encode_cycles, &mark);
+
+	return 0;
+}
+
+int ws2812_commit(struct ws2812_window *win)
+{
+	uint64_t mark = ws2812_stats_mark();
+
+	/* Frames of all other pixels are still in px_buf. */
+	return ws2812_spi_transmit(win->dev, dev_cfg(win->dev)->px_buf,
+				   win->num_pixels, &mark);
+}
+#endif /* CONFIG_LUMEN_WS2812_STRIP_WINDOW */
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_RING
+/*
+ * Pixels a ring of len pixels takes in cfg->ring_buf. Its first
+ * chain-length - 1 pixels are repeated after its end, so any chain-length
+ * pixels from any offset are a single transfer without a seam.
+ */
+static size_t ws2812_spi_ring_stride(const struct ws2812_spi_cfg *cfg,
+				     size_t len)
+{
+	return len + cfg->px_buf_size / cfg->pixel_bytes - 1;
+}
+
+int ws2812_ring_load(const struct device *dev, size_t ring,
+		     const struct led_rgb *pixels, size_t len)
+{
+	const struct ws2812_spi_cfg *cfg = dev_cfg(dev);
+	struct ws2812_spi_data *data = dev_data(dev);
+	const size_t pixel_size = cfg->pixel_bytes;
+	size_t stride;
+	uint8_t *buf;
+	size_t i, n;
+	int rc;
+
+	if (len == 0) {
+		return -EINVAL;
+	}
+
+	stride = ws2812_spi_ring_stride(cfg, len);
+	if (ring >= MIN(CONFIG_LUMEN_WS2812_STRIP_RING_PIXELS / stride,
+			WS2812_RING_MAX)) {
+		return -ENOMEM;
+	}
+
+	/* The ring may be on its way out. */
+	rc = ws2812_spi_present_wait(dev);
+	if (rc < 0) {
+		return rc;
+	}
+
+	buf = &cfg->ring_buf[ring * stride * pixel_size];
+	cfg->encode(buf, pixels, len);
+
+	for (i = len; i < stride; i += n) {
+		n = MIN(len, stride - i);
+		memcpy(&buf[i * pixel_size], buf, n * pixel_size);
+	}
+
+	ws2812_rings_add(&data->rings, ring, len);
+
+	return 0;
+}
+
+int ws2812_ring_show(const struct device *dev, size_t num_pixels, size_t ring,
+		     size_t offset)
+{
+	const struct ws2812_spi_cfg *cfg = dev_cfg(dev);
+	struct ws2812_spi_data *data = dev_data(dev);
+	size_t stride;
+	uint64_t mark;
+	int rc;
+
+	if (!num_pixels_ok(cfg, num_pixels)) {
+		return -ENOMEM;
+	}
+
+	if (!ws2812_rings_loaded(&data->rings, ring) ||
+	    offset >= data->rings.len) {
+		return -EINVAL;
+	}
+
+	stride = ws2812_spi_ring_stride(cfg, data->rings.len);
+
+	rc = ws2812_spi_present_wait(dev);
+	if (rc < 0) {
+		return rc;
+	}
+
+	mark = ws2812_stats_begin(&data->stats);
+
+	/* Nothing to convert, the frames are sent straight from the ring. */
+	return ws2812_spi_transmit(dev,
+				   &cfg->ring_buf[(ring * stride + offset) *
+						  cfg->pixel_bytes],
+				   num_pixels, &mark);
+}
+#endif /* CONFIG_LUMEN_WS2812_STRIP_RING */
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_STATS
+int ws2812_get_stats(const struct device *dev, struct ws2812_stats *stats)
+{
+	*stats = dev_data(dev)->stats;
+
+	return 0;
 }
+#endif
 
 static int ws2812_strip_update_channels(const struct device *dev,
 					uint8_t *channels,
@@ -175,28 +591,38 @@ static int ws2812_strip_update_channels(const struct device *dev,
 static int ws2812_spi_init(const struct device *dev)
 {
 	const struct ws2812_spi_cfg *cfg = dev_cfg(dev);
-	uint8_t i;
+	struct ws2812_spi_data *data = dev_data(dev);
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PRESENT
+	const struct spi_buf_set none = { .count = 0 };
+	int rc;
+#endif
 
 	if (!spi_is_ready_dt(&cfg->bus)) {
 		LOG_ERR("SPI device %s not ready", cfg->bus.bus->name);
 		return -ENODEV;
 	}
 
-	for (i = 0; i < cfg->num_colors; i++) {
-		switch (cfg->color_mapping[i]) {
-		case LED_COLOR_ID_WHITE:
-		case LED_COLOR_ID_RED:
-		case LED_COLOR_ID_GREEN:
-		case LED_COLOR_ID_BLUE:
-			break;
-		default:
-			LOG_ERR("%s: invalid channel to color mapping."
-				"Check the color-mapping DT property",
-				dev->name);
-			return -EINVAL;
-		}
+	data->bus = cfg->bus;
+	data->bus.config.frequency = cfg->frequency;
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PRESENT
+	/* Armed frames bypass the SPI driver, have it configure the SPIM. */
+	rc = spi_write_dt(&data->bus, &none);
+	if (rc < 0) {
+		LOG_ERR("Failed to configure SPI device (err %d)", rc);
+		return rc;
 	}
 
+	rc = ws2812_present_init(&data->present,
+				 nrf_spim_task_address_get(cfg->spim,
+							   NRF_SPIM_TASK_START),
+				 ws2812_spi_present_start, cfg->spim);
+	if (rc < 0) {
+		LOG_ERR("No RTC channel or PPI channel to present frames");
+		return rc;
+	}
+#endif
+
 	return 0;
 }
 
@@ -209,47 +635,130 @@ static const struct led_strip_driver_api ws2812_spi_api = {
 	(DT_INST_PROP(idx, chain_length))
 #define WS2812_SPI_HAS_WHITE(idx) \
 	(DT_INST_PROP(idx, has_white_channel) == 1)
-#define WS2812_SPI_ONE_FRAME(idx) \
-	(DT_INST_PROP(idx, spi_one_frame))
-#define WS2812_SPI_ZERO_FRAME(idx) \
-	(DT_INST_PROP(idx, spi_zero_frame))
+
+/* Bits per symbol, from "led-timing" or 8 for spi-one-frame/spi-zero-frame. */
+#define WS2812_SPI_NODE_SYMBOL_BITS(node_id)				 \
+	COND_CODE_1(DT_NODE_HAS_PROP(node_id, led_timing),		 \
+		    (WS2812_TIMING(node_id, SPI_SYMBOL_BITS)),		 \
+		    (SPI_FRAME_BITS))
+#define WS2812_SPI_PIXEL_BYTES(idx)					 \
+	(WS2812_NUM_COLORS(idx) *					 \
+	 WS2812_SPI_NODE_SYMBOL_BITS(DT_DRV_INST(idx)))
 #define WS2812_SPI_BUFSZ(idx) \
-	(WS2812_NUM_COLORS(idx) * 8 * WS2812_SPI_NUM_PIXELS(idx))
+	(WS2812_SPI_PIXEL_BYTES(idx) * WS2812_SPI_NUM_PIXELS(idx))
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PALETTE
+/* Frames of each palette entry. */
+#define WS2812_SPI_PALETTE_BUF(idx)					 \
+	static uint8_t ws2812_spi_##idx##_pal_buf[			 \
+		WS2812_SPI_PIXEL_BYTES(idx) *				 \
+		CONFIG_LUMEN_WS2812_STRIP_PALETTE_SIZE];
+#define WS2812_SPI_PALETTE_CFG(idx) .pal_buf = ws2812_spi_##idx##_pal_buf,
+#else
+#define WS2812_SPI_PALETTE_BUF(idx)
+#define WS2812_SPI_PALETTE_CFG(idx)
+#endif
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_RING
+/* Rings in SPI frames, see ws2812_spi_ring_stride(). */
+#define WS2812_SPI_RING_BUF(idx)					 \
+	static uint8_t ws2812_spi_##idx##_ring_buf[			 \
+		WS2812_SPI_PIXEL_BYTES(idx) *				 \
+		CONFIG_LUMEN_WS2812_STRIP_RING_PIXELS];
+#define WS2812_SPI_RING_CFG(idx) .ring_buf = ws2812_spi_##idx##_ring_buf,
+#else
+#define WS2812_SPI_RING_BUF(idx)
+#define WS2812_SPI_RING_CFG(idx)
+#endif
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_PRESENT
+#define WS2812_SPI_PRESENT_CFG(idx) \
+	.spim = (NRF_SPIM_Type *)DT_REG_ADDR(DT_INST_BUS(idx)),
+#else
+#define WS2812_SPI_PRESENT_CFG(idx)
+#endif
+
+/* Get the latch/reset delay from "led-timing" or "reset-delay". */
+#define WS2812_RESET_DELAY(idx) \
+	WS2812_TIMING_OR(DT_DRV_INST(idx), RESET_DELAY, reset_delay)
+
+/* SPI clock, derived from "led-timing" or "spi-max-frequency". */
+#define WS2812_SPI_FREQUENCY(idx) \
+	WS2812_TIMING_OR(DT_DRV_INST(idx), SPI_FREQUENCY, spi_max_frequency)
 
 /*
- * Retrieve the channel to color mapping (e.g. RGB, BGR, GRB, ...) from the
- * "color-mapping" DT property.
+ * Serialize one channel of the current pixel, the channel is picked from the
+ * "color-mapping" DT property at compile time.
  */
-#define WS2812_COLOR_MAPPING(idx)				  \
-	static const uint8_t ws2812_spi_##idx##_color_mapping[] = \
-		DT_INST_PROP(idx, color_mapping)
-
-#define WS2812_NUM_COLORS(idx) (DT_INST_PROP_LEN(idx, color_mapping))
+#define WS2812_SPI_SER_CHANNEL(node_id, prop, n)			 \
+	ws2812_spi_ser(px_buf,						 \
+		       WS2812_CHANNEL_BY_IDX(node_id, prop, n,		 \
+					     ro, go, bo, wo),		 \
+		       WS2812_TIMING_OR(node_id, SPI_ONE_FRAME,		 \
+					spi_one_frame),			 \
+		       WS2812_TIMING_OR(node_id, SPI_ZERO_FRAME,	 \
+					spi_zero_frame),		 \
+		       WS2812_SPI_NODE_SYMBOL_BITS(node_id));		 \
+	px_buf += WS2812_SPI_NODE_SYMBOL_BITS(node_id);
 
-/* Get the latch/reset delay from the "reset-delay" DT property. */
-#define WS2812_RESET_DELAY(idx) DT_INST_PROP(idx, reset_delay)
+/*
+ * Generate the encoder of an instance, with its channel order, channel
+ * count and SPI frames folded in.
+ */
+#define WS2812_SPI_ENCODER(idx)						 \
+	static void ws2812_spi_##idx##_encode(uint8_t *px_buf,		 \
+					      const struct led_rgb *pixels, \
+					      size_t num_pixels)	 \
+	{								 \
+		size_t i;						 \
+									 \
+		for (i = 0; i < num_pixels; i++) {			 \
+			uint8_t ro, go, bo, wo;				 \
+									 \
+			rgbw_conversion(				 \
+				/* outs: */ &ro, &go, &bo, &wo,		 \
+				/*  ins: */ pixels[i].r, pixels[i].g,	 \
+					    pixels[i].b,		 \
+				/* algo: */ WS2812_RGBW_ALGO(idx)	 \
+			);						 \
+									 \
+			DT_INST_FOREACH_PROP_ELEM(idx, color_mapping,	 \
+						  WS2812_SPI_SER_CHANNEL) \
+		}							 \
+	}
 
 #define WS2812_SPI_DEVICE(idx)						 \
 									 \
 	static uint8_t ws2812_spi_##idx##_px_buf[WS2812_SPI_BUFSZ(idx)]; \
+	WS2812_SPI_PALETTE_BUF(idx)					 \
+	WS2812_SPI_RING_BUF(idx)					 \
 									 \
-	WS2812_COLOR_MAPPING(idx);					 \
+	WS2812_CHECK_COLOR_MAPPING(idx)					 \
+	WS2812_CHECK_RGBW_ALGO(idx)					 \
+	WS2812_CHECK_TIMING(idx, spi_one_frame)				 \
+	WS2812_CHECK_TIMING(idx, spi_zero_frame)			 \
+									 \
+	WS2812_SPI_ENCODER(idx)						 \
+									 \
+	static struct ws2812_spi_data ws2812_spi_##idx##_data;		 \
 									 \
 	static const struct ws2812_spi_cfg ws2812_spi_##idx##_cfg = {	 \
 		.bus = SPI_DT_SPEC_INST_GET(idx, SPI_OPER(idx), 0),	 \
 		.px_buf = ws2812_spi_##idx##_px_buf,			 \
 		.px_buf_size = WS2812_SPI_BUFSZ(idx),			 \
-		.one_frame = WS2812_SPI_ONE_FRAME(idx),			 \
-		.zero_frame = WS2812_SPI_ZERO_FRAME(idx),		 \
-		.num_colors = WS2812_NUM_COLORS(idx),			 \
-		.color_mapping = ws2812_spi_##idx##_color_mapping,	 \
+		.pixel_bytes = WS2812_SPI_PIXEL_BYTES(idx),		 \
+		.encode = ws2812_spi_##idx##_encode,			 \
 		.reset_delay = WS2812_RESET_DELAY(idx),			 \
+		.frequency = WS2812_SPI_FREQUENCY(idx),			 \
+		WS2812_SPI_PALETTE_CFG(idx)				 \
+		WS2812_SPI_RING_CFG(idx)				 \
+		WS2812_SPI_PRESENT_CFG(idx)				 \
 	};								 \
 									 \
 	DEVICE_DT_INST_DEFINE(idx,					 \
 			      ws2812_spi_init,				 \
 			      NULL,					 \
-			      NULL,					 \
+			      &ws2812_spi_##idx##_data,			 \
 			      &ws2812_spi_##idx##_cfg,			 \
 			      POST_KERNEL,				 \
 			      CONFIG_LED_STRIP_INIT_PRIORITY,		 \
@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ *
+ * Uses an nRF UARTE with EasyDMA. Each UART frame carries three data bits,
+ * three UART bits per data bit on an inverted line:
+ *
+ *   line:  start d0 d1 | d2 d3 d4 | d5 d6 d7 stop
+ *   zero:    H   L  L  |  H  L  L |  H  L  L  L
+ *   one:     H   H  L  |  H  H  L |  H  H  L  L
+ *
+ * The UART has no 7 bit frames, so the low time of every third data bit is
+ * one UART bit longer, which is well within the timing slack of the LEDs.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define DT_DRV_COMPAT leonfyi_ws2812_uart
+
+#include <zephyr/drivers/led_strip.h>
+
+#include <string.h>
+
+#define LOG_LEVEL CONFIG_LED_STRIP_LOG_LEVEL
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(ws2812_uart);
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/sys/math_extras.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/dt-bindings/led/led.h>
+#include <hal/nrf_uarte.h>
+
+#include <lumen/drivers/ws2812.h>
+
+#include "rgbw.h"
+#include "ws2812.h"
+
+/* Data bits carried by one UART frame. */
+#define UART_FRAME_BITS 3
+
+/* The BAUDRATE register is relative to this clock. */
+#define UARTE_BASE_CLOCK_HZ 16000000ULL
+
+/*
+ * UART data bits for three data bits, MSbit first in bits 2..0. The line is
+ * inverted, so a high level is sent as a zero bit.
+ */
+static const uint8_t ws2812_uart_sym[8] = {
+	0xDB, 0x9B, 0xD3, 0x93, 0xDA, 0x9A, 0xD2, 0x92,
+};
+
+/*
+ * Per-instance encoder, converts num_pixels RGB color values into UART
+ * frames in the instance's on-wire channel order. Returns the number of
+ * frames written.
+ */
+typedef size_t (*ws2812_uart_encode_t)(uint8_t *px_buf,
+				       const struct led_rgb *pixels,
+				       size_t num_pixels);
+
+struct ws2812_uart_cfg {
+	const struct device *uart;
+	NRF_UARTE_Type *uarte;
+	uint8_t *px_buf;
+	size_t px_buf_size;
+	uint8_t num_colors;
+	ws2812_uart_encode_t encode;
+	uint32_t bit_rate;
+	uint16_t reset_delay;
+};
+
+struct ws2812_uart_data {
+	struct k_sem tx_done;
+	int tx_result;
+	k_timepoint_t latch;
+	struct ws2812_stats stats;
+};
+
+static const struct ws2812_uart_cfg *dev_cfg(const struct device *dev)
+{
+	return dev->config;
+}
+
+static struct ws2812_uart_data *dev_data(const struct device *dev)
+{
+	return dev->data;
+}
+
+/*
+ * Shift an 8-bit color channel value into the bit accumulator and emit a
+ * UART frame for every three bits collected.
+ */
+static inline uint8_t *ws2812_uart_ser(uint8_t *buf, uint8_t color,
+				       uint32_t *acc, uint8_t *nbits)
+{
+	*acc = (*acc << 8) | color;
+	*nbits += 8;
+
+	while (*nbits >= UART_FRAME_BITS) {
+		*nbits -= UART_FRAME_BITS;
+		*buf++ = ws2812_uart_sym[(*acc >> *nbits) & 0x07];
+	}
+
+	return buf;
+}
+
+/* Emit the remaining bits, padded with zero bits past the end of the chain. */
+static inline uint8_t *ws2812_uart_ser_flush(uint8_t *buf, uint32_t acc,
+					     uint8_t nbits)
+{
+	if (nbits > 0) {
+		*buf++ = ws2812_uart_sym[(acc << (UART_FRAME_BITS - nbits)) & 0x07];
+	}
+
+	return buf;
+}
+
+/* Number of UART frames needed for num_pixels pixels. */
+static inline size_t ws2812_uart_frames(uint8_t num_colors, size_t num_pixels)
+{
+	return DIV_ROUND_UP(num_pixels * num_colors * 8, UART_FRAME_BITS);
+}
+
+/*
+ * Returns true if and only if cfg->px_buf is big enough to convert
+ * num_pixels RGB color values into UART frames.
+ */
+static inline bool num_pixels_ok(const struct ws2812_uart_cfg *cfg,
+				 size_t num_pixels)
+{
+	size_t nbits;
+	bool overflow;
+
+	overflow = size_mul_overflow(num_pixels, cfg->num_colors * 8, &nbits);
+	return !overflow &&
+	       (DIV_ROUND_UP(nbits, UART_FRAME_BITS) <= cfg->px_buf_size);
+}
+
+static void ws2812_uart_callback(const struct device *uart,
+				 struct uart_event *evt, void *user_data)
+{
+	const struct device *dev = user_data;
+	struct ws2812_uart_data *data = dev_data(dev);
+
+	switch (evt->type) {
+	case UART_TX_DONE:
+		data->tx_result = 0;
+		k_sem_give(&data->tx_done);
+		break;
+	case UART_TX_ABORTED:
+		data->tx_result = -EIO;
+		k_sem_give(&data->tx_done);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Display the first len UART frames held in cfg->px_buf.
+ */
+static int ws2812_uart_transmit(const struct device *dev, size_t len,
+				uint64_t *mark)
+{
+	const struct ws2812_uart_cfg *cfg = dev_cfg(dev);
+	struct ws2812_uart_data *data = dev_data(dev);
+	int rc;
+
+	k_sem_reset(&data->tx_done);
+
+	/* The previous frame may still be latching. */
+	ws2812_latch_wait(&data->latch);
+	ws2812_stats_lap(&data->stats.latch_cycles, mark);
+
+	rc = uart_tx(cfg->uart, cfg->px_buf, len, SYS_FOREVER_US);
+	if (rc < 0) {
+		LOG_ERR("Failed to start TX (err %d)", rc);
+		return rc;
+	}
+
+	rc = k_sem_take(&data->tx_done, K_SECONDS(1));
+	if (rc < 0) {
+		LOG_ERR("Timed out waiting for TX (err %d)", rc);
+		(void)uart_tx_abort(cfg->uart);
+		return rc;
+	}
+
+	ws2812_stats_lap(&data->stats.transfer_cycles, mark);
+	ws2812_latch_start(&data->latch, cfg->reset_delay);
+
+	return data->tx_result;
+}
+
+static int ws2812_strip_update_rgb(const struct device *dev,
+				   struct led_rgb *pixels,
+				   size_t num_pixels)
+{
+	const struct ws2812_uart_cfg *cfg = dev_cfg(dev);
+	struct ws2812_uart_data *data = dev_data(dev);
+	uint64_t mark;
+	size_t len;
+
+	if (!num_pixels_ok(cfg, num_pixels)) {
+		return -ENOMEM;
+	}
+
+	mark = ws2812_stats_begin(&data->stats);
+
+	/*
+	 * Convert pixel data into UART frames. The frames carry pixel data
+	 * in color mapping on-wire format (e.g. GRB, GRBW, RGB, etc).
+	 */
+	len = cfg->encode(cfg->px_buf, pixels, num_pixels);
+	ws2812_stats_lap(&data->stats.encode_cycles, &mark);
+
+	return ws2812_uart_transmit(dev, len, &mark);
+}
+
+int ws2812_update_rgb_range(const struct device *dev, struct led_rgb *pixels,
+			    size_t num_pixels, size_t first, size_t count)
+{
+	const struct ws2812_uart_cfg *cfg = dev_cfg(dev);
+	struct ws2812_uart_data *data = dev_data(dev);
+	uint64_t mark;
+	size_t last;
+
+	if (!num_pixels_ok(cfg, num_pixels)) {
+		return -ENOMEM;
+	}
+
+	if (first > num_pixels || count > num_pixels - first) {
+		return -EINVAL;
+	}
+
+	/*
+	 * Frames are shared between neighbouring pixels, but every third
+	 * pixel starts on a frame boundary. Widen the range to those, so no
+	 * frame of an untouched pixel is overwritten.
+	 */
+	last = MIN(ROUND_UP(first + count, UART_FRAME_BITS), num_pixels);
+	first = ROUND_DOWN(first, UART_FRAME_BITS);
+
+	mark = ws2812_stats_begin(&data->stats);
+
+	/* Frames of all other pixels are still in px_buf. */
+	cfg->encode(&cfg->px_buf[first * cfg->num_colors * 8 / UART_FRAME_BITS],
+		    &pixels[first], last - first);
+	ws2812_stats_lap(&data->stats.encode_cycles, &mark);
+
+	return ws2812_uart_transmit(dev, ws2812_uart_frames(cfg->num_colors,
+							    num_pixels),
+				    &mark);
+}
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP_STATS
+int ws2812_get_stats(const struct device *dev, struct ws2812_stats *stats)
+{
+	*stats = dev_data(dev)->stats;
+
+	return 0;
+}
+#endif
+
+static int ws2812_strip_update_channels(const struct device *dev,
+					uint8_t *channels,
+					size_t num_channels)
+{
+	LOG_ERR("update_channels not implemented");
+	return -ENOTSUP;
+}
+
+static int ws2812_uart_init(const struct device *dev)
+{
+	const struct ws2812_uart_cfg *cfg = dev_cfg(dev);
+	struct ws2812_uart_data *data = dev_data(dev);
+	const struct uart_config uart_cfg = {
+		.baudrate = 1000000,
+		.parity = UART_CFG_PARITY_NONE,
+		.stop_bits = UART_CFG_STOP_BITS_1,
+		.data_bits = UART_CFG_DATA_BITS_8,
+		.flow_ctrl = UART_CFG_FLOW_CTRL_NONE,
+	};
+	uint32_t baudrate;
+	int rc;
+
+	if (!device_is_ready(cfg->uart)) {
+		LOG_ERR("UART device %s not ready", cfg->uart->name);
+		return -ENODEV;
+	}
+
+	k_sem_init(&data->tx_done, 0, 1);
+
+	rc = uart_configure(cfg->uart, &uart_cfg);
+	if (rc < 0) {
+		LOG_ERR("Failed to configure UART (err %d)", rc);
+		return rc;
+	}
+
+	/*
+	 * The UART API only accepts the documented baud rates, so program the
+	 * BAUDRATE register directly. Only the upper 20 bits are used.
+	 */
+	baudrate = (((uint64_t)cfg->bit_rate << 32) / UARTE_BASE_CLOCK_HZ +
+		    0x800) & 0xFFFFF000;
+	nrf_uarte_baudrate_set(cfg->uarte, (nrf_uarte_baudrate_t)baudrate);
+
+	rc = uart_callback_set(cfg->uart, ws2812_uart_callback, (void *)dev);
+	if (rc < 0) {
+		LOG_ERR("Failed to set UART callback (err %d)", rc);
+		return rc;
+	}
+
+	return 0;
+}
+
+static const struct led_strip_driver_api ws2812_uart_api = {
+	.update_rgb = ws2812_strip_update_rgb,
+	.update_channels = ws2812_strip_update_channels,
+};
+
+#define WS2812_UART_NUM_PIXELS(idx) \
+	(DT_INST_PROP(idx, chain_length))
+#define WS2812_UART_BUFSZ(idx) \
+	DIV_ROUND_UP(WS2812_NUM_COLORS(idx) * 8 * WS2812_UART_NUM_PIXELS(idx), \
+		     UART_FRAME_BITS)
+
+/* Get the latch/reset delay from the "reset-delay" DT property. */
+#define WS2812_RESET_DELAY(idx) DT_INST_PROP(idx, reset_delay)
+
+/*
+ * Serialize one channel of the current pixel, the channel is picked from the
+ * "color-mapping" DT property at compile time.
+ */
+#define WS2812_UART_SER_CHANNEL(node_id, prop, n)			 \
+	px_buf = ws2812_uart_ser(px_buf,				 \
+				 WS2812_CHANNEL_BY_IDX(node_id, prop, n, \
+						       ro, go, bo, wo),	 \
+				 &acc, &nbits);
+
+/*
+ * Generate the encoder of an instance, with its channel order and channel
+ * count folded in.
+ */
+#define WS2812_UART_ENCODER(idx)					 \
+	static size_t ws2812_uart_##idx##_encode(uint8_t *px_buf,	 \
+						 const struct led_rgb *pixels, \
+						 size_t num_pixels)	 \
+	{								 \
+		uint8_t *start = px_buf;				 \
+		uint32_t acc = 0;					 \
+		uint8_t nbits = 0;					 \
+		size_t i;						 \
+									 \
+		for (i = 0; i < num_pixels; i++) {			 \
+			uint8_t ro, go, bo, wo;				 \
+									 \
+			rgbw_conversion(				 \
+				/* outs: */ &ro, &go, &bo, &wo,		 \
+				/*  ins: */ pixels[i].r, pixels[i].g,	 \
+					    pixels[i].b,		 \
+				/* algo: */ WS2812_RGBW_ALGO(idx)	 \
+			);						 \
+									 \
+			DT_INST_FOREACH_PROP_ELEM(idx, color_mapping,	 \
+						  WS2812_UART_SER_CHANNEL) \
+		}							 \
+									 \
+		px_buf = ws2812_uart_ser_flush(px_buf, acc, nbits);	 \
+									 \
+		return px_buf - start;					 \
+	}
+
+#define WS2812_UART_DEVICE(idx)						 \
+									 \
+	static uint8_t ws2812_uart_##idx##_px_buf[WS2812_UART_BUFSZ(idx)]; \
+									 \
+	WS2812_CHECK_COLOR_MAPPING(idx)					 \
+	WS2812_CHECK_RGBW_ALGO(idx)					 \
+									 \
+	WS2812_UART_ENCODER(idx)					 \
+									 \
+	static struct ws2812_uart_data ws2812_uart_##idx##_data;	 \
+									 \
+	static const struct ws2812_uart_cfg ws2812_uart_##idx##_cfg = {	 \
+		.uart = DEVICE_DT_GET(DT_INST_BUS(idx)),		 \
+		.uarte = (NRF_UARTE_Type *)DT_REG_ADDR(DT_INST_BUS(idx)), \
+		.px_buf = ws2812_uart_##idx##_px_buf,			 \
+		.px_buf_size = WS2812_UART_BUFSZ(idx),			 \
+		.num_colors = WS2812_NUM_COLORS(idx),			 \
+		.encode = ws2812_uart_##idx##_encode,			 \
+		.bit_rate = DT_INST_PROP(idx, bit_rate),		 \
+		.reset_delay = WS2812_RESET_DELAY(idx),			 \
+	};								 \
+									 \
+	DEVICE_DT_INST_DEFINE(idx,					 \
+			      ws2812_uart_init,				 \
+			      NULL,					 \
+			      &ws2812_uart_##idx##_data,		 \
+			      &ws2812_uart_##idx##_cfg,			 \
+			      POST_KERNEL,				 \
+			      CONFIG_LED_STRIP_INIT_PRIORITY,		 \
+			      &ws2812_uart_api);
+
+DT_INST_FOREACH_STATUS_OKAY(WS2812_UART_DEVICE)
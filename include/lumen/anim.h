@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Pre-rendered animations.
+ *
+ * Container and codec of animations rendered on a PC, see
+ * scripts/lumen_anim.py. A file starts with a struct anim_hdr, followed
+ * by the frames. Each frame is a struct anim_frame_hdr and len bytes of
+ * codes that build the RGB pixels of the frame from start to end. Key
+ * frames stand on their own, delta frames may keep pixels of the frame
+ * before. The first frame is a key frame, so playback can loop.
+ *
+ * A code byte holds an op in its top two bits and a pixel count minus one
+ * in the low six bits:
+ *
+ *   ANIM_OP_LITERAL  count R, G, B triplets follow
+ *   ANIM_OP_RUN      one R, G, B triplet follows, repeated count times
+ *   ANIM_OP_SKIP     count pixels keep their value, delta frames only
+ *   ANIM_OP_COPY     a byte follows, count pixels are copied from that
+ *                    many plus one pixels before, overlapping repeats
+ *
+ * Decoding is a single pass of byte copies, so it costs little more than
+ * reading the frame from flash.
+ */
+
+#ifndef LUMEN_ANIM_H_
+#define LUMEN_ANIM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/drivers/led_strip.h>
+#include <zephyr/toolchain.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** "LANM" read as a little endian word. */
+#define ANIM_MAGIC 0x4d4e414cU
+#define ANIM_VERSION 1
+
+/** Playback starts over after the last frame. */
+#define ANIM_FLAG_LOOP BIT(0)
+
+#define ANIM_FRAME_KEY 0
+#define ANIM_FRAME_DELTA 1
+
+#define ANIM_OP_LITERAL 0
+#define ANIM_OP_RUN 1
+#define ANIM_OP_SKIP 2
+#define ANIM_OP_COPY 3
+
+/** @brief Header at the start of an animation, all fields little endian. */
+struct anim_hdr {
+	/** ANIM_MAGIC. */
+	uint32_t magic;
+	/** ANIM_VERSION. */
+	uint8_t version;
+	/** ANIM_FLAG_* bits. */
+	uint8_t flags;
+	/** Pixels per frame. */
+	uint16_t num_pixels;
+	/** Number of frames. */
+	uint32_t num_frames;
+	/** Time between frames in ms. */
+	uint16_t interval_ms;
+	/** Longest codes of a frame, a reader has to buffer this much. */
+	uint16_t max_frame_len;
+} __packed;
+
+/** @brief Header of a frame, all fields little endian. */
+struct anim_frame_hdr {
+	/** ANIM_FRAME_KEY or ANIM_FRAME_DELTA. */
+	uint8_t type;
+	uint8_t reserved;
+	/** Length of the codes following the header. */
+	uint16_t len;
+} __packed;
+
+/**
+ * @brief Read an animation header.
+ *
+ * @param buf The first sizeof(struct anim_hdr) bytes of the animation.
+ * @param hdr Header in CPU byte order.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if this is no animation or one without frames.
+ * @retval -ENOTSUP for animations of another version.
+ */
+int anim_hdr_parse(const void *buf, struct anim_hdr *hdr);
+
+/**
+ * @brief Read a frame header.
+ *
+ * @param hdr Header of the animation.
+ * @param buf The sizeof(struct anim_frame_hdr) bytes of the frame header.
+ * @param frame Frame header in CPU byte order.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if the frame type is unknown or the codes are longer
+ *         than the animation declares.
+ */
+int anim_frame_parse(const struct anim_hdr *hdr, const void *buf,
+		     struct anim_frame_hdr *frame);
+
+/**
+ * @brief Decode a frame.
+ *
+ * @param frame Header of the frame.
+ * @param codes The frame->len bytes of codes of the frame.
+ * @param pixels Pixels of the previous frame, replaced by this frame.
+ * @param num_pixels Pixels per frame.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if the codes are malformed or do not cover exactly
+ *         num_pixels pixels. pixels is partially updated then.
+ */
+int anim_decode(const struct anim_frame_hdr *frame, const uint8_t *codes,
+		struct led_rgb *pixels, size_t num_pixels);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LUMEN_ANIM_H_ */
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Extensions of the LED strip API for the lumen WS2812 driver.
+ */
+
+#ifndef LUMEN_DRIVERS_WS2812_H_
+#define LUMEN_DRIVERS_WS2812_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/led_strip.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Update a range of pixels of a WS2812 strip.
+ *
+ * Like led_strip_update_rgb(), but only pixels [first, first + count) are
+ * converted again. The wire data of all other pixels is reused from the
+ * previous update, which therefore must have covered the same num_pixels.
+ * Backends which do not keep a wire buffer between updates convert all
+ * pixels.
+ *
+ * @param dev        WS2812 LED strip device.
+ * @param pixels     Array of pixel data, as for led_strip_update_rgb().
+ * @param num_pixels Length of pixels array.
+ * @param first      Index of the first changed pixel.
+ * @param count      Number of changed pixels.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if the range exceeds num_pixels.
+ * @retval -errno negative errno code on other failure.
+ */
+int ws2812_update_rgb_range(const struct device *dev, struct led_rgb *pixels,
+			    size_t num_pixels, size_t first, size_t count);
+
+/**
+ * @brief Update a WS2812 strip from palette indices.
+ *
+ * Every palette entry is converted to wire format once, which is then
+ * copied for each pixel. Animations that only change the palette cost
+ * O(palette) conversions per frame instead of O(pixels).
+ *
+ * With 4-bit indices, two pixels share a byte, the first one in the high
+ * nibble.
+ *
+ * Only available with CONFIG_LUMEN_WS2812_STRIP_PALETTE.
+ *
+ * @param dev         WS2812 LED strip device.
+ * @param indices     Palette index of each pixel.
+ * @param num_pixels  Number of pixels.
+ * @param bits        Bits per index, 4 or 8.
+ * @param palette     Palette colors.
+ * @param palette_len Number of palette colors, at most
+ *                    CONFIG_LUMEN_WS2812_STRIP_PALETTE_SIZE.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if bits or palette_len are invalid or an index is out of
+ *         the palette, nothing is sent then.
+ * @retval -errno negative errno code on other failure.
+ */
+int ws2812_update_indexed(const struct device *dev, const uint8_t *indices,
+			  size_t num_pixels, uint8_t bits,
+			  const struct led_rgb *palette, size_t palette_len);
+
+/**
+ * @brief Window into the wire buffer of a WS2812 strip.
+ *
+ * Filled by ws2812_acquire(), the fields are private to the driver.
+ */
+struct ws2812_window {
+	const struct device *dev;
+	size_t num_pixels;
+	size_t first;
+	size_t count;
+};
+
+/**
+ * @brief Acquire a window of the wire buffer of a WS2812 strip.
+ *
+ * Pixels written into the window with ws2812_window_write() and friends are
+ * converted to wire format right away, without an RGB frame buffer in
+ * between, and ws2812_commit() sends the frame. Pixels outside of the window
+ * keep the wire data of the previous update, which therefore must have
+ * covered the same num_pixels. Pixels of the window that are not written
+ * keep it as well.
+ *
+ * Other updates of the strip must not happen until the window is committed.
+ *
+ * Only available with CONFIG_LUMEN_WS2812_STRIP_WINDOW.
+ *
+ * @param dev        WS2812 LED strip device.
+ * @param num_pixels Number of pixels of the frame.
+ * @param first      Index of the first pixel of the window.
+ * @param count      Number of pixels of the window.
+ * @param win        Filled with the window.
+ *
+ * @retval 0 on success.
+ * @retval -ENOMEM if num_pixels exceeds the wire buffer.
+ * @retval -EINVAL if the window exceeds num_pixels.
+ */
+int ws2812_acquire(const struct device *dev, size_t num_pixels, size_t first,
+		   size_t count, struct ws2812_window *win);
+
+/**
+ * @brief Convert pixels straight into a window of the wire buffer.
+ *
+ * @param win    Window acquired with ws2812_acquire().
+ * @param offset Index of the first pixel, relative to the window.
+ * @param pixels Pixel data.
+ * @param n      Number of pixels.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if the pixels exceed the window.
+ */
+int ws2812_window_write(struct ws2812_window *win, size_t offset,
+			const struct led_rgb *pixels, size_t n);
+
+/**
+ * @brief Convert packed 8-bit R, G, B triplets straight into a window of the
+ * wire buffer, e.g. from a received Bluetooth payload.
+ *
+ * @param win    Window acquired with ws2812_acquire().
+ * @param offset Index of the first pixel, relative to the window.
+ * @param rgb    3 * n bytes of pixel data.
+ * @param n      Number of pixels.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if the pixels exceed the window.
+ */
+int ws2812_window_write_rgb24(struct ws2812_window *win, size_t offset,
+			      const uint8_t *rgb, size_t n);
+
+/**
+ * @brief Set a single pixel of a window of the wire buffer.
+ *
+ * @param win   Window acquired with ws2812_acquire().
+ * @param i     Index of the pixel, relative to the window.
+ * @param color Color of the pixel.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if i is outside of the window.
+ */
+static inline int ws2812_window_set(struct ws2812_window *win, size_t i,
+				    struct led_rgb color)
+{
+	return ws2812_window_write(win, i, &color, 1);
+}
+
+/**
+ * @brief Send the frame a window was written into.
+ *
+ * The window must not be used afterwards.
+ *
+ * @param win Window acquired with ws2812_acquire().
+ *
+ * @retval 0 on success.
+ * @retval -errno negative errno code on failure.
+ */
+int ws2812_commit(struct ws2812_window *win);
+
+/**
+ * @brief Convert a ring of pixels into wire format and keep it.
+ *
+ * Loaded rings are sent with ws2812_ring_show() without converting their
+ * pixels again. All rings of an instance have the same length, loading a
+ * ring of another length drops the others.
+ *
+ * Only available with CONFIG_LUMEN_WS2812_STRIP_RING.
+ *
+ * @param dev    WS2812 LED strip device.
+ * @param ring   Index of the ring.
+ * @param pixels Pixels of the ring.
+ * @param len    Number of pixels of the ring.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if len is 0.
+ * @retval -ENOMEM if the ring does not fit into
+ *         CONFIG_LUMEN_WS2812_STRIP_RING_PIXELS or ring is 32 or more.
+ */
+int ws2812_ring_load(const struct device *dev, size_t ring,
+		     const struct led_rgb *pixels, size_t len);
+
+/**
+ * @brief Update a WS2812 strip from a loaded ring.
+ *
+ * Pixel i of the strip shows pixel (offset + i) % len of the ring, so
+ * stepping the offset scrolls the ring along the strip. Rings shorter than
+ * the strip repeat. No pixel is converted, the wire buffer of the other
+ * updates is left alone and the next one of them therefore has to cover
+ * all pixels again.
+ *
+ * @param dev        WS2812 LED strip device.
+ * @param num_pixels Number of pixels of the frame.
+ * @param ring       Index of a ring loaded with the current length.
+ * @param offset     Ring pixel shown by the first pixel of the strip.
+ *
+ * @retval 0 on success.
+ * @retval -ENOMEM if num_pixels exceeds the wire buffer.
+ * @retval -EINVAL if ring is not loaded, or was dropped by loading a ring
+ *         of another length, or offset exceeds the ring.
+ * @retval -errno negative errno code on other failure.
+ */
+int ws2812_ring_show(const struct device *dev, size_t num_pixels, size_t ring,
+		     size_t offset);
+
+/**
+ * @brief Show the next update of a WS2812 strip at an exact tick.
+ *
+ * The next update converts its pixels right away, but its transfer is
+ * started by hardware at the given tick, without the jitter of thread
+ * wake-ups and interrupt latency. That update returns once the transfer is
+ * armed, the following one waits until it is out. A frame armed after its
+ * tick has passed is started right away.
+ *
+ * Only available with CONFIG_LUMEN_WS2812_STRIP_PRESENT.
+ *
+ * @param dev  WS2812 LED strip device.
+ * @param tick Uptime in system ticks, as k_uptime_ticks().
+ *
+ * @retval 0 on success.
+ */
+int ws2812_present_at(const struct device *dev, int64_t tick);
+
+/** @brief Time spent in the phases of the last update, in timing cycles. */
+struct ws2812_stats {
+	/** Converting pixels into wire format. */
+	uint64_t encode_cycles;
+	/** Waiting for the previous frame to latch. */
+	uint64_t latch_cycles;
+	/** Handing the frame to the peripheral, or shifting it out where
+	 *  that blocks.
+	 */
+	uint64_t transfer_cycles;
+};
+
+/**
+ * @brief Get the timing of the last update of a WS2812 strip.
+ *
+ * Only available with CONFIG_LUMEN_WS2812_STRIP_STATS. The timing API has to
+ * be started with timing_init() and timing_start() for the counts to be
+ * meaningful, see timing_cycles_to_ns() to convert them.
+ *
+ * @param dev   WS2812 LED strip device.
+ * @param stats Filled with the timing of the last update.
+ *
+ * @retval 0 on success.
+ */
+int ws2812_get_stats(const struct device *dev, struct ws2812_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LUMEN_DRIVERS_WS2812_H_ */
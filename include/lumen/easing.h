@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Fixed-point easing curves.
+ *
+ * Curves are sampled into small tables at build time and interpolated
+ * linearly in between, so evaluating them needs neither floats nor
+ * divisions.
+ */
+
+#ifndef LUMEN_EASING_H_
+#define LUMEN_EASING_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Progress value of a finished transition. */
+#define EASING_PROGRESS_MAX (1U << 16)
+
+/** Weight of the target at the end of a transition. */
+#define EASING_WEIGHT_MAX 256U
+
+/** @brief Easing curves. */
+enum easing {
+	/** Constant speed. */
+	EASING_LINEAR,
+	/** Starts slow, quadratic. */
+	EASING_IN,
+	/** Ends slow, quadratic. */
+	EASING_OUT,
+	/** Starts and ends slow, smoothstep. */
+	EASING_IN_OUT,
+
+	EASING_COUNT,
+};
+
+/**
+ * @brief Evaluates an easing curve.
+ *
+ * @param curve    Easing curve, unknown curves are linear.
+ * @param progress Elapsed part of the transition, 0 to EASING_PROGRESS_MAX.
+ *
+ * @return Weight of the target, 0 to EASING_WEIGHT_MAX.
+ */
+uint16_t easing_weight(enum easing curve, uint32_t progress);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LUMEN_EASING_H_ */
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Procedural segment effects with declared costs.
+ *
+ * Fire, plasma, twinkle, comet and breathing effects for LED strip
+ * segments. They use integer math only and, like every segment effect,
+ * are a function of the time since they were set, so they keep their speed
+ * with late frames and play in sync on devices sharing a clock. Fire and
+ * plasma are built on fixed-point value noise.
+ *
+ * Each effect declares how many CPU cycles it needs per pixel and frame.
+ * Before an effect is set, effect_fit() checks that it fits the render
+ * budget of the strip together with the other segments, and lowers its
+ * frame rate if it does not.
+ */
+
+#ifndef LUMEN_EFFECTS_H_
+#define LUMEN_EFFECTS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <lumen/segment.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief A segment effect and its cost. */
+struct effect {
+	/** Name of the effect. */
+	const char *name;
+	/** Renders a segment, see segment_effect_t. */
+	segment_effect_t render;
+	/**
+	 * Upper bound of CPU cycles per pixel and frame on a Cortex-M4,
+	 * the led effects shell command of the app compares it to the
+	 * actual cost.
+	 */
+	uint16_t cycles_per_pixel;
+	/** Frame interval the effect looks best at in ms. */
+	uint16_t interval_ms;
+};
+
+/** @brief Heat of burning flames rising from the first pixel. */
+void effect_fire(const struct segment *seg, struct led_rgb *pixels,
+		 uint32_t t_ms);
+
+/** @brief Slowly drifting rainbow clouds. */
+void effect_plasma(const struct segment *seg, struct led_rgb *pixels,
+		   uint32_t t_ms);
+
+/** @brief Pixels in the segment color fading in and out at random. */
+void effect_twinkle(const struct segment *seg, struct led_rgb *pixels,
+		    uint32_t t_ms);
+
+/** @brief A pixel in the segment color running along with a fading tail. */
+void effect_comet(const struct segment *seg, struct led_rgb *pixels,
+		  uint32_t t_ms);
+
+/** @brief The segment color slowly pulsing. */
+void effect_breathe(const struct segment *seg, struct led_rgb *pixels,
+		    uint32_t t_ms);
+
+/** @brief Returns the number of built-in effects. */
+size_t effect_count(void);
+
+/** @brief Returns a built-in effect, or NULL if idx is out of range. */
+const struct effect *effect_get(size_t idx);
+
+/** @brief Returns the built-in effect with the given name, or NULL. */
+const struct effect *effect_find(const char *name);
+
+/** @brief Returns the built-in effect rendered by a function, or NULL. */
+const struct effect *effect_lookup(segment_effect_t render);
+
+/**
+ * @brief Checks that an effect fits the render budget on a segment.
+ *
+ * The budget is CONFIG_LUMEN_EFFECTS_BUDGET_PERCENT of the CPU cycles
+ * between frames. Rendering is done in one thread and every frame has until
+ * the next one is due, so it holds as long as the cycles per ms of all
+ * segments stay within it. Other segments count with the cost of their
+ * effect if it is a built-in one, effects from elsewhere are assumed to be
+ * cheap.
+ *
+ * If the effect does not fit at the given frame interval, the interval is
+ * raised to the shortest one it fits at. SEGMENT_INTERVAL_AUTO counts as
+ * the current frame interval of the strip.
+ *
+ * @param strip       Strip the segment belongs to.
+ * @param idx         Index of the segment.
+ * @param effect      Effect about to be set.
+ * @param len         Length the segment will have.
+ * @param interval_ms Requested frame interval, updated with the one to use.
+ *
+ * @retval 0 if the effect fits at *interval_ms.
+ * @retval -EINVAL if there is no such segment.
+ * @retval -ENOSPC if it does not even fit at
+ *         CONFIG_LUMEN_EFFECTS_MAX_INTERVAL_MS.
+ */
+int effect_fit(struct segment_strip *strip, size_t idx,
+	       const struct effect *effect, size_t len, uint32_t *interval_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LUMEN_EFFECTS_H_ */
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief LED strip segments.
+ *
+ * Splits an LED strip into zones, each with its own effect and frame rate.
+ * Only zones that are due or changed are rendered, and with the lumen WS2812
+ * driver only their pixels are converted to wire format again.
+ *
+ * Effects are driven by the time since they were set rather than by a frame
+ * counter, so animations keep their speed when frames are late or dropped.
+ * Frames are due at multiples of the frame interval since that time, on a
+ * clock that can be shared between devices to play animations in sync.
+ * Changing an effect can crossfade from the current pixels over a given
+ * duration, using integer math only.
+ *
+ * Segments with SEGMENT_INTERVAL_AUTO are rendered at the frame interval of
+ * the strip. With CONFIG_LUMEN_SEGMENT_RATE it follows the measured time
+ * frames take to render and send, so those segments get the highest frame
+ * rate the strip sustains within a CPU budget, and no segment is rendered
+ * faster than that.
+ *
+ * With CONFIG_LUMEN_SEGMENT_DITHER and a wire buffer, rendered pixels are
+ * gamma corrected to 16 bits per color and dithered over time down to the
+ * 8 bits sent, so that dark colors keep their levels instead of rounding to
+ * a few steps or off. The strip is then refreshed continuously while any
+ * pixel lies between two levels. Only the output is dithered: segments
+ * still render, and crossfades still blend, 8-bit colors, so steps between
+ * those colors remain.
+ */
+
+#ifndef LUMEN_SEGMENT_H_
+#define LUMEN_SEGMENT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/led_strip.h>
+
+#include <lumen/easing.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct segment;
+
+/** Frame interval of segments rendered as often as the strip allows. */
+#define SEGMENT_INTERVAL_AUTO UINT16_MAX
+
+/**
+ * @brief Renders the pixels of a segment.
+ *
+ * @param seg    Segment to render.
+ * @param pixels First pixel of the segment, seg->len pixels are valid.
+ * @param t_ms   Time since the effect was set in ms, a multiple of the
+ *               frame interval for animated segments.
+ */
+typedef void (*segment_effect_t)(const struct segment *seg,
+				 struct led_rgb *pixels, uint32_t t_ms);
+
+/** @brief A zone of an LED strip. */
+struct segment {
+	/** Name of the zone. */
+	const char *name;
+	/** Index of the first pixel. */
+	size_t start;
+	/** Number of pixels, 0 if the segment is unused. */
+	size_t len;
+	/** Effect rendering the segment, pixels are off if NULL. */
+	segment_effect_t effect;
+	/** Parameter of the effect. */
+	struct led_rgb color;
+	/**
+	 * Time between frames in ms, 0 to render on change only or
+	 * SEGMENT_INTERVAL_AUTO.
+	 */
+	uint32_t interval_ms;
+	/** Time the effect was set on the strip clock in ms. */
+	int64_t start_ms;
+
+	/* Internal state. */
+	int64_t next_ms;
+	uint32_t fade_ms;
+	enum easing fade_curve;
+	bool fade_pending;
+	bool dirty;
+};
+
+/** @brief Returns the current time in ms. */
+typedef int64_t (*segment_clock_t)(void);
+
+/** @brief An LED strip split into segments. */
+struct segment_strip {
+	/** LED strip device. */
+	const struct device *dev;
+	/** Frame buffer of the whole strip. */
+	struct led_rgb *pixels;
+	/** Number of pixels of the strip. */
+	size_t num_pixels;
+	/** Segments of the strip. */
+	struct segment *segments;
+	/** Number of segments. */
+	size_t num_segments;
+	/**
+	 * Snapshot buffer of num_pixels pixels for crossfades, NULL to
+	 * change effects instantly.
+	 */
+	struct led_rgb *fade_pixels;
+	/** Clock effects and frames are timed with, k_uptime_get() if NULL. */
+	segment_clock_t clock;
+	/**
+	 * Frame interval of segments with SEGMENT_INTERVAL_AUTO in ms,
+	 * set by segment_strip_init() and adapted by the rate controller.
+	 */
+	uint32_t frame_interval_ms;
+	/**
+	 * With CONFIG_LUMEN_SEGMENT_DITHER, buffer of num_pixels pixels the
+	 * gamma corrected and dithered frames are sent from, NULL to send
+	 * pixels as rendered.
+	 */
+	struct led_rgb *wire_pixels;
+	/** Dither error of num_pixels pixels, needed with wire_pixels. */
+	uint32_t *dither_err;
+
+	/* Internal state. */
+	struct k_mutex lock;
+	struct k_sem changed;
+	size_t dirty_first;
+	size_t dirty_end;
+	size_t clear_first;
+	size_t clear_end;
+	uint32_t frame_us;
+	uint32_t rate_settle;
+	int64_t dither_next_ms;
+	bool dither_active;
+};
+
+/**
+ * @brief Initializes a segment strip, all segments are rendered on the
+ * first call to segment_strip_render().
+ */
+void segment_strip_init(struct segment_strip *strip);
+
+/**
+ * @brief Moves or resizes a segment.
+ *
+ * Pixels no longer covered by the segment are turned off and a running
+ * crossfade of the segment ends.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if the segment does not fit the strip or overlaps another
+ *         segment.
+ */
+int segment_configure(struct segment_strip *strip, size_t idx, size_t start,
+		      size_t len);
+
+/**
+ * @brief Changes the effect of a segment.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if there is no such segment.
+ */
+int segment_set_effect(struct segment_strip *strip, size_t idx,
+		       segment_effect_t effect, struct led_rgb color,
+		       uint32_t interval_ms);
+
+/**
+ * @brief Changes the effect of a segment, crossfading from the pixels shown
+ * when the next frame is rendered.
+ *
+ * The crossfade is timed from when the effect is set, like the effect.
+ *
+ * While fading, the segment is rendered every
+ * CONFIG_LUMEN_SEGMENT_FADE_INTERVAL_MS at least. Without a fade buffer or
+ * with a duration of 0 this is the same as segment_set_effect().
+ *
+ * @param fade_ms Duration of the crossfade in ms.
+ * @param curve   Easing curve of the crossfade.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if there is no such segment.
+ */
+int segment_fade_effect(struct segment_strip *strip, size_t idx,
+			segment_effect_t effect, struct led_rgb color,
+			uint32_t interval_ms, uint32_t fade_ms,
+			enum easing curve);
+
+/**
+ * @brief Changes the effect of a segment as if it was set at start_ms on the
+ * strip clock, without crossfading.
+ *
+ * Devices sharing a clock render the same frames at the same time if their
+ * segments were set with the same parameters and start time.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if there is no such segment.
+ */
+int segment_set_effect_since(struct segment_strip *strip, size_t idx,
+			     segment_effect_t effect, struct led_rgb color,
+			     uint32_t interval_ms, int64_t start_ms);
+
+/**
+ * @brief Returns the effect parameters of a segment.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if there is no such segment.
+ */
+int segment_get_effect(struct segment_strip *strip, size_t idx,
+		       struct segment *seg);
+
+/** @brief Returns the current time of the strip clock in ms. */
+int64_t segment_strip_now(const struct segment_strip *strip);
+
+/**
+ * @brief Returns the frame interval of segments with SEGMENT_INTERVAL_AUTO
+ * in ms.
+ */
+uint32_t segment_strip_frame_interval(const struct segment_strip *strip);
+
+/** @brief Returns the index of the segment with the given name, or -ENOENT. */
+int segment_find(struct segment_strip *strip, const char *name);
+
+/**
+ * @brief Marks all segments as changed, e.g. after the strip was written
+ * by someone else.
+ */
+void segment_strip_invalidate(struct segment_strip *strip);
+
+/**
+ * @brief Renders all segments that are due or changed and updates the
+ * strip with them, or with the next dithered frame if that is due.
+ *
+ * @return Number of rendered segments or negative errno code on failure.
+ */
+int segment_strip_render(struct segment_strip *strip);
+
+/**
+ * @brief Waits until a segment or a dithered frame is due or a segment
+ * changed, at most for max_ms.
+ */
+void segment_strip_wait(struct segment_strip *strip, uint32_t max_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LUMEN_SEGMENT_H_ */
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Synchronized playback over BLE periodic advertising.
+ *
+ * A leader broadcasts its show clock and a payload describing the current
+ * animation in periodic advertising. Followers sync to the train without a
+ * connection, lock their show clock to the leader's and hand the payload to
+ * the application, so every device renders the same frames at the same
+ * show time.
+ *
+ * The leader stamps its clock into the advertising data more often than the
+ * advertising interval, at a period that does not divide it, and followers
+ * take the largest offset seen over a window of reports. That is the report
+ * with the freshest stamp and the shortest reception latency, which keeps
+ * followers within about a millisecond of the leader.
+ */
+
+#ifndef LUMEN_SYNC_H_
+#define LUMEN_SYNC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Called on followers with the leader's payload.
+ *
+ * Called once the show clock is locked, whenever the payload changes and
+ * whenever the show clock had to step instead of slewing, so time based
+ * state derived from it can be applied again. Runs in the Bluetooth RX
+ * context.
+ *
+ * @param data Payload of the leader.
+ * @param len  Length of the payload.
+ */
+typedef void (*sync_payload_cb_t)(const uint8_t *data, size_t len);
+
+/**
+ * @brief Starts broadcasting the show clock, Bluetooth must be enabled.
+ *
+ * @retval 0 on success.
+ * @retval -EALREADY if a role was started before.
+ * @retval -errno other negative errno code from the Bluetooth stack.
+ */
+int sync_leader_start(void);
+
+/**
+ * @brief Replaces the payload broadcast by the leader.
+ *
+ * @retval 0 on success.
+ * @retval -EMSGSIZE if len exceeds CONFIG_LUMEN_SYNC_PAYLOAD_MAX.
+ */
+int sync_leader_set_payload(const void *data, size_t len);
+
+/**
+ * @brief Starts looking for a leader and following its show clock,
+ * Bluetooth must be enabled.
+ *
+ * @param cb Called with the leader's payload.
+ *
+ * @retval 0 on success.
+ * @retval -EALREADY if a role was started before.
+ * @retval -errno other negative errno code from the Bluetooth stack.
+ */
+int sync_follower_start(sync_payload_cb_t cb);
+
+/**
+ * @brief Returns whether the show clock follows a leader.
+ *
+ * Always true on the leader.
+ */
+bool sync_locked(void);
+
+/**
+ * @brief Returns the show clock in us.
+ *
+ * On the leader and on followers that have not locked yet this is the
+ * uptime.
+ */
+int64_t sync_time_us(void);
+
+/** @brief Returns the show clock in ms. */
+int64_t sync_time_ms(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LUMEN_SYNC_H_ */
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+#include <lumen/anim.h>
+
+#define OP_SHIFT 6
+#define COUNT_MASK BIT_MASK(OP_SHIFT)
+
+int anim_hdr_parse(const void *buf, struct anim_hdr *hdr)
+{
+	memcpy(hdr, buf, sizeof(*hdr));
+
+	hdr->magic = sys_le32_to_cpu(hdr->magic);
+	hdr->num_pixels = sys_le16_to_cpu(hdr->num_pixels);
+	hdr->num_frames = sys_le32_to_cpu(hdr->num_frames);
+	hdr->interval_ms = sys_le16_to_cpu(hdr->interval_ms);
+	hdr->max_frame_len = sys_le16_to_cpu(hdr->max_frame_len);
+
+	if (hdr->magic != ANIM_MAGIC) {
+		return -EINVAL;
+	}
+
+	if (hdr->version != ANIM_VERSION) {
+		return -ENOTSUP;
+	}
+
+	if (hdr->num_pixels == 0 || hdr->num_frames == 0) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int anim_frame_parse(const struct anim_hdr *hdr, const void *buf,
+		     struct anim_frame_hdr *frame)
+{
+	memcpy(frame, buf, sizeof(*frame));
+
+	frame->len = sys_le16_to_cpu(frame->len);
+
+	if (frame->type > ANIM_FRAME_DELTA || frame->len > hdr->max_frame_len) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int anim_decode(const struct anim_frame_hdr *frame, const uint8_t *codes,
+		struct led_rgb *pixels, size_t num_pixels)
+{
+	const uint8_t *end = codes + frame->len;
+	size_t i = 0;
+
+	while (codes < end) {
+		uint8_t op = *codes >> OP_SHIFT;
+		size_t count = (*codes & COUNT_MASK) + 1;
+		size_t dist;
+
+		codes++;
+
+		if (count > num_pixels - i) {
+			return -EINVAL;
+		}
+
+		switch (op) {
+		case ANIM_OP_LITERAL:
+			if ((size_t)(end - codes) < count * 3) {
+				return -EINVAL;
+			}
+			for (size_t n = 0; n < count; n++, i++) {
+				pixels[i].r = codes[0];
+				pixels[i].g = codes[1];
+				pixels[i].b = codes[2];
+				codes += 3;
+			}
+			break;
+
+		case ANIM_OP_RUN:
+			if (end - codes < 3) {
+				return -EINVAL;
+			}
+			for (size_t n = 0; n < count; n++, i++) {
+				pixels[i].r = codes[0];
+				pixels[i].g = codes[1];
+				pixels[i].b = codes[2];
+			}
+			codes += 3;
+			break;
+
+		case ANIM_OP_SKIP:
+			if (frame->type == ANIM_FRAME_KEY) {
+				return -EINVAL;
+			}
+			i += count;
+			break;
+
+		default: /* ANIM_OP_COPY */
+			if (codes == end) {
+				return -EINVAL;
+			}
+			dist = *codes++ + 1;
+			if (dist > i) {
+				return -EINVAL;
+			}
+			/* Forward, so a short distance repeats a pattern. */
+			for (size_t n = 0; n < count; n++, i++) {
+				pixels[i] = pixels[i - dist];
+			}
+			break;
+		}
+	}
+
+	return i == num_pixels ? 0 : -EINVAL;
+}
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+#include <lumen/easing.h>
+#include <lumen/effects.h>
+
+/* Noise coordinates are 24.8 fixed point, one lattice cell is 256. */
+#define NOISE_FRAC_BITS 8
+
+/* Spatial and temporal scales, in noise units per pixel and per 256 ms. */
+#define FIRE_PIXEL_SCALE 64
+#define FIRE_TIME_SCALE 256
+#define PLASMA_PIXEL_SCALE 24
+#define PLASMA_TIME_SCALE 48
+
+#define TWINKLE_PERIOD_MIN_MS 800
+#define TWINKLE_PERIOD_SPREAD_MS 1024
+/* Out of 256 pixel cycles lit. */
+#define TWINKLE_DENSITY 80
+
+#define COMET_MS_PER_PIXEL 25
+
+#define BREATHE_PERIOD_MS 4000
+#define BREATHE_MIN 16
+
+static uint32_t hash(uint32_t x, uint32_t y)
+{
+	uint32_t h = x * 0x27d4eb2dU ^ y * 0x165667b1U;
+
+	h ^= h >> 15;
+	h *= 0x2c1b3c6dU;
+	h ^= h >> 12;
+
+	return h;
+}
+
+/* Smoothstep of an 8 bit fraction. */
+static uint32_t fade(uint32_t f)
+{
+	return (f * f * (3 * 256 - 2 * f)) >> 16;
+}
+
+static uint32_t lerp(uint32_t a, uint32_t b, uint32_t s)
+{
+	return (a * (256 - s) + b * s) >> 8;
+}
+
+/* Value noise, 0 to 255, smooth in both coordinates. */
+static uint32_t noise(uint32_t x, uint32_t y)
+{
+	const uint32_t xi = x >> NOISE_FRAC_BITS;
+	const uint32_t yi = y >> NOISE_FRAC_BITS;
+	const uint32_t sx = fade(x & BIT_MASK(NOISE_FRAC_BITS));
+	const uint32_t sy = fade(y & BIT_MASK(NOISE_FRAC_BITS));
+
+	return lerp(lerp(hash(xi, yi) >> 24, hash(xi + 1, yi) >> 24, sx),
+		    lerp(hash(xi, yi + 1) >> 24, hash(xi + 1, yi + 1) >> 24,
+			 sx),
+		    sy);
+}
+
+static struct led_rgb scale(struct led_rgb color, uint32_t level)
+{
+	return (struct led_rgb){
+		.r = (color.r * (level + 1)) >> 8,
+		.g = (color.g * (level + 1)) >> 8,
+		.b = (color.b * (level + 1)) >> 8,
+	};
+}
+
+/* Red - green - blue - red. */
+static struct led_rgb hue(uint8_t pos)
+{
+	if (pos < 85) {
+		return (struct led_rgb){ .r = 255 - pos * 3, .g = pos * 3 };
+	} else if (pos < 170) {
+		pos -= 85;
+		return (struct led_rgb){ .g = 255 - pos * 3, .b = pos * 3 };
+	}
+
+	pos -= 170;
+	return (struct led_rgb){ .r = pos * 3, .b = 255 - pos * 3 };
+}
+
+/* Black - red - yellow - white. */
+static struct led_rgb heat_color(uint32_t heat)
+{
+	const uint32_t t = (heat * 192) >> 8;
+	const uint8_t ramp = (t & 63) << 2;
+
+	if (t >= 128) {
+		return (struct led_rgb){ .r = 255, .g = 255, .b = ramp };
+	} else if (t >= 64) {
+		return (struct led_rgb){ .r = 255, .g = ramp };
+	}
+
+	return (struct led_rgb){ .r = ramp };
+}
+
+void effect_fire(const struct segment *seg, struct led_rgb *pixels,
+		 uint32_t t_ms)
+{
+	/* The noise moves towards the end of the segment, flames rise. */
+	const uint32_t y = (uint64_t)t_ms * FIRE_TIME_SCALE / 256;
+	const uint32_t cool = 256 * 256 / MAX(seg->len, 1);
+
+	for (size_t i = 0; i < seg->len; i++) {
+		uint32_t heat = 64 + (noise(i * FIRE_PIXEL_SCALE - y, y / 4) *
+				      3 >> 2);
+
+		/* Cool off along the segment and boost what is left. */
+		heat = heat * (256 - MIN((i * cool) >> 8, 256)) >> 7;
+		pixels[i] = heat_color(MIN(heat, 255));
+	}
+}
+
+void effect_plasma(const struct segment *seg, struct led_rgb *pixels,
+		   uint32_t t_ms)
+{
+	const uint32_t y = (uint64_t)t_ms * PLASMA_TIME_SCALE / 256;
+
+	for (size_t i = 0; i < seg->len; i++) {
+		const uint32_t x = i * PLASMA_PIXEL_SCALE;
+
+		/* Two octaves, the second one offset to decorrelate them. */
+		pixels[i] = hue(noise(x, y) + noise(2 * x + 0x10000, 2 * y));
+	}
+}
+
+void effect_twinkle(const struct segment *seg, struct led_rgb *pixels,
+		    uint32_t t_ms)
+{
+	for (size_t i = 0; i < seg->len; i++) {
+		/* Every pixel has its own period and phase. */
+		const uint32_t h = hash(i, 0);
+		const uint32_t period = TWINKLE_PERIOD_MIN_MS +
+					(h % TWINKLE_PERIOD_SPREAD_MS);
+		const uint32_t t = t_ms + (h >> 16);
+		const uint32_t pos = t % period;
+
+		if ((hash(i, t / period) >> 24) >= TWINKLE_DENSITY) {
+			pixels[i] = (struct led_rgb){ 0 };
+			continue;
+		}
+
+		pixels[i] = scale(seg->color,
+				  MIN(2 * 256 * MIN(pos, period - pos) /
+					      period,
+				      255));
+	}
+}
+
+void effect_comet(const struct segment *seg, struct led_rgb *pixels,
+		  uint32_t t_ms)
+{
+	const size_t tail = MAX(seg->len / 4, 1);
+	const size_t head = (t_ms / COMET_MS_PER_PIXEL) % (seg->len + tail);
+	const uint32_t step = 256 / tail;
+
+	for (size_t i = 0; i < seg->len; i++) {
+		const size_t d = head - i;
+
+		if (i > head || d >= tail) {
+			pixels[i] = (struct led_rgb){ 0 };
+		} else {
+			pixels[i] = scale(seg->color, 255 - d * step);
+		}
+	}
+}
+
+void effect_breathe(const struct segment *seg, struct led_rgb *pixels,
+		    uint32_t t_ms)
+{
+	const uint32_t pos = t_ms % BREATHE_PERIOD_MS;
+	const uint32_t half = BREATHE_PERIOD_MS / 2;
+	const uint32_t progress =
+		(pos < half ? pos : BREATHE_PERIOD_MS - pos) *
+		EASING_PROGRESS_MAX / half;
+	const uint32_t level =
+		BREATHE_MIN + (easing_weight(EASING_IN_OUT, progress) *
+			       (255 - BREATHE_MIN) >> 8);
+	const struct led_rgb color = scale(seg->color, level);
+
+	for (size_t i = 0; i < seg->len; i++) {
+		pixels[i] = color;
+	}
+}
+
+/*
+ * Costs are upper bounds for a Cortex-M4 at -Os, with headroom over the
+ * typical path.
+ */
+static const struct effect effects[] = {
+	{ "fire", effect_fire, 160, 20 },
+	{ "plasma", effect_plasma, 260, 20 },
+	{ "twinkle", effect_twinkle, 120, 20 },
+	{ "comet", effect_comet, 30, COMET_MS_PER_PIXEL },
+	{ "breathe", effect_breathe, 12, 20 },
+};
+
+size_t effect_count(void)
+{
+	return ARRAY_SIZE(effects);
+}
+
+const struct effect *effect_get(size_t idx)
+{
+	return idx < ARRAY_SIZE(effects) ? &effects[idx] : NULL;
+}
+
+const struct effect *effect_find(const char *name)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(effects); i++) {
+		if (strcmp(effects[i].name, name) == 0) {
+			return &effects[i];
+		}
+	}
+
+	return NULL;
+}
+
+const struct effect *effect_lookup(segment_effect_t render)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(effects); i++) {
+		if (effects[i].render == render) {
+			return &effects[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* Cycles per ms a segment takes to render. */
+static uint64_t load(const struct segment_strip *strip,
+		     uint32_t cycles_per_pixel, size_t len,
+		     uint32_t interval_ms)
+{
+	if (interval_ms == SEGMENT_INTERVAL_AUTO) {
+		interval_ms = segment_strip_frame_interval(strip);
+	}
+
+	if (interval_ms == 0) {
+		/* Rendered on change only. */
+		return 0;
+	}
+
+	return DIV_ROUND_UP((uint64_t)cycles_per_pixel * len, interval_ms);
+}
+
+int effect_fit(struct segment_strip *strip, size_t idx,
+	       const struct effect *effect, size_t len, uint32_t *interval_ms)
+{
+	const uint64_t budget = (uint64_t)CONFIG_LUMEN_EFFECTS_CPU_FREQ_KHZ *
+				CONFIG_LUMEN_EFFECTS_BUDGET_PERCENT / 100;
+	uint64_t used = 0;
+	uint64_t cycles;
+	struct segment seg;
+
+	if (idx >= strip->num_segments) {
+		return -EINVAL;
+	}
+
+	for (size_t i = 0; i < strip->num_segments; i++) {
+		const struct effect *other;
+
+		if (i == idx) {
+			continue;
+		}
+
+		segment_get_effect(strip, i, &seg);
+		other = effect_lookup(seg.effect);
+		if (other != NULL) {
+			used += load(strip, other->cycles_per_pixel, seg.len,
+				     seg.interval_ms);
+		}
+	}
+
+	if (*interval_ms == 0) {
+		return 0;
+	}
+
+	cycles = (uint64_t)effect->cycles_per_pixel * len;
+	if (used + load(strip, effect->cycles_per_pixel, len, *interval_ms) <=
+	    budget) {
+		return 0;
+	}
+
+	if (used >= budget ||
+	    DIV_ROUND_UP(cycles, budget - used) >
+		    CONFIG_LUMEN_EFFECTS_MAX_INTERVAL_MS) {
+		return -ENOSPC;
+	}
+
+	/* Shortest interval the segment fits at, rounded to whole ms. */
+	*interval_ms = DIV_ROUND_UP(cycles, budget - used);
+
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/sys/util.h>
+
+#include "dither.h"
+
+/*
+ * The errors of the three colors of a pixel are kept in 10-bit lanes of
+ * one word, so they are accumulated with a single addition. A lane holds
+ * at most 255 + 255, the carry out of its low byte is the bit added to the
+ * 8-bit level.
+ */
+#define LANE_BITS 10
+#define LANES(r, g, b) ((r) | (g) << LANE_BITS | (b) << (2 * LANE_BITS))
+#define FRAC_MASK LANES(0xffU, 0xffU, 0xffU)
+#define CARRY_MASK LANES(1U, 1U, 1U)
+
+/*
+ * (i / 255)^2.8 scaled to 0..0xff00, the curve of the app's 8-bit gamma
+ * table. The top level has no fraction, so adding a carry never overflows.
+ */
+static const uint16_t gamma16[256] = {
+	    0,     0,     0,     0,     1,     1,     2,     3,
+	    4,     6,     8,    10,    13,    16,    19,    23,
+	   28,    33,    39,    45,    52,    60,    68,    78,
+	   87,    98,   109,   121,   134,   148,   163,   179,
+	  195,   213,   232,   251,   272,   293,   316,   340,
+	  365,   391,   418,   447,   477,   508,   540,   573,
+	  608,   644,   682,   721,   761,   802,   846,   890,
+	  936,   984,  1033,  1084,  1136,  1190,  1245,  1302,
+	 1361,  1421,  1483,  1547,  1612,  1680,  1749,  1820,
+	 1892,  1967,  2043,  2121,  2202,  2284,  2368,  2454,
+	 2542,  2632,  2724,  2818,  2914,  3012,  3112,  3215,
+	 3319,  3426,  3535,  3646,  3759,  3875,  3992,  4112,
+	 4235,  4359,  4486,  4616,  4748,  4882,  5018,  5157,
+	 5299,  5442,  5589,  5738,  5889,  6043,  6200,  6359,
+	 6520,  6685,  6852,  7021,  7194,  7369,  7546,  7727,
+	 7910,  8096,  8285,  8476,  8671,  8868,  9068,  9271,
+	 9477,  9685,  9897, 10112, 10329, 10550, 10774, 11000,
+	11230, 11463, 11698, 11937, 12179, 12425, 12673, 12924,
+	13179, 13437, 13698, 13962, 14230, 14501, 14775, 15052,
+	15333, 15617, 15905, 16196, 16490, 16788, 17089, 17393,
+	17701, 18013, 18328, 18646, 18968, 19294, 19623, 19956,
+	20292, 20632, 20976, 21323, 21674, 22029, 22387, 22750,
+	23115, 23485, 23859, 24236, 24617, 25002, 25390, 25783,
+	26179, 26580, 26984, 27392, 27804, 28220, 28640, 29064,
+	29492, 29925, 30361, 30801, 31245, 31694, 32146, 32603,
+	33064, 33529, 33998, 34471, 34949, 35431, 35917, 36407,
+	36902, 37400, 37904, 38411, 38923, 39439, 39960, 40485,
+	41015, 41548, 42087, 42630, 43177, 43729, 44285, 44846,
+	45411, 45981, 46556, 47135, 47718, 48307, 48900, 49497,
+	50100, 50707, 51318, 51935, 52556, 53182, 53812, 54448,
+	55088, 55733, 56383, 57038, 57698, 58362, 59032, 59706,
+	60385, 61070, 61759, 62453, 63152, 63856, 64566, 65280,
+};
+
+void dither_init(uint32_t *err, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		/* Golden ratio hash, a different byte for each color. */
+		uint32_t h = (i + 1) * 0x9e3779b1U;
+
+		err[i] = LANES(h >> 24, (h >> 16) & 0xffU, (h >> 8) & 0xffU);
+	}
+}
+
+bool dither(struct led_rgb *out, const struct led_rgb *pixels, uint32_t *err,
+	    size_t len)
+{
+	uint32_t frac = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		const uint32_t r = gamma16[pixels[i].r];
+		const uint32_t g = gamma16[pixels[i].g];
+		const uint32_t b = gamma16[pixels[i].b];
+		const uint32_t lo = LANES(r & 0xffU, g & 0xffU, b & 0xffU);
+		const uint32_t acc = err[i] + lo;
+		const uint32_t carry = (acc >> 8) & CARRY_MASK;
+
+		err[i] = acc & FRAC_MASK;
+		out[i].r = (r >> 8) + (carry & 1U);
+		out[i].g = (g >> 8) + ((carry >> LANE_BITS) & 1U);
+		out[i].b = (b >> 8) + (carry >> (2 * LANE_BITS));
+		frac |= lo;
+	}
+
+	return frac != 0;
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef LUMEN_SEGMENT_DITHER_H_
+#define LUMEN_SEGMENT_DITHER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/drivers/led_strip.h>
+
+/* Spreads the initial error of the pixels so they do not step in unison. */
+void dither_init(uint32_t *err, size_t len);
+
+/*
+ * Gamma corrects 8-bit pixels to 16 bits and rounds them to the 8 bits in
+ * out, carrying the remainder of each pixel in err over to the next frame.
+ * Returns true if any pixel lies between two 8-bit levels, so that the
+ * result changes from frame to frame.
+ */
+bool dither(struct led_rgb *out, const struct led_rgb *pixels, uint32_t *err,
+	    size_t len);
+
+#endif /* LUMEN_SEGMENT_DITHER_H_ */
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/sys/util.h>
+
+#include <lumen/easing.h>
+
+/* Each table samples a curve at 64 equal steps, scaled to 0..256. */
+#define EASING_STEPS_LOG2 6
+#define EASING_FRAC_BITS (16 - EASING_STEPS_LOG2)
+
+static const uint16_t easing_tables[EASING_COUNT][(1 << EASING_STEPS_LOG2) + 1] = {
+	[EASING_LINEAR] = {
+		  0,   4,   8,  12,  16,  20,  24,  28,
+		 32,  36,  40,  44,  48,  52,  56,  60,
+		 64,  68,  72,  76,  80,  84,  88,  92,
+		 96, 100, 104, 108, 112, 116, 120, 124,
+		128, 132, 136, 140, 144, 148, 152, 156,
+		160, 164, 168, 172, 176, 180, 184, 188,
+		192, 196, 200, 204, 208, 212, 216, 220,
+		224, 228, 232, 236, 240, 244, 248, 252,
+		256,
+	},
+	/* t^2 */
+	[EASING_IN] = {
+		  0,   0,   0,   1,   1,   2,   2,   3,
+		  4,   5,   6,   8,   9,  11,  12,  14,
+		 16,  18,  20,  23,  25,  28,  30,  33,
+		 36,  39,  42,  46,  49,  53,  56,  60,
+		 64,  68,  72,  77,  81,  86,  90,  95,
+		100, 105, 110, 116, 121, 127, 132, 138,
+		144, 150, 156, 163, 169, 176, 182, 189,
+		196, 203, 210, 218, 225, 233, 240, 248,
+		256,
+	},
+	/* 1 - (1 - t)^2 */
+	[EASING_OUT] = {
+		  0,   8,  16,  23,  31,  38,  46,  53,
+		 60,  67,  74,  80,  87,  93, 100, 106,
+		112, 118, 124, 129, 135, 140, 146, 151,
+		156, 161, 166, 170, 175, 179, 184, 188,
+		192, 196, 200, 203, 207, 210, 214, 217,
+		220, 223, 226, 228, 231, 233, 236, 238,
+		240, 242, 244, 245, 247, 248, 250, 251,
+		252, 253, 254, 254, 255, 255, 256, 256,
+		256,
+	},
+	/* 3t^2 - 2t^3 */
+	[EASING_IN_OUT] = {
+		  0,   0,   1,   2,   3,   4,   6,   9,
+		 11,  14,  17,  20,  24,  27,  31,  36,
+		 40,  45,  49,  54,  59,  65,  70,  75,
+		 81,  87,  92,  98, 104, 110, 116, 122,
+		128, 134, 140, 146, 152, 158, 164, 169,
+		175, 181, 186, 191, 197, 202, 207, 211,
+		216, 220, 225, 229, 232, 236, 239, 242,
+		245, 247, 250, 252, 253, 254, 255, 256,
+		256,
+	},
+};
+
+uint16_t easing_weight(enum easing curve, uint32_t progress)
+{
+	const uint16_t *table;
+	uint32_t idx, frac;
+
+	if ((unsigned int)curve >= EASING_COUNT) {
+		curve = EASING_LINEAR;
+	}
+
+	if (progress >= EASING_PROGRESS_MAX) {
+		return EASING_WEIGHT_MAX;
+	}
+
+	table = easing_tables[curve];
+	idx = progress >> EASING_FRAC_BITS;
+	frac = progress & BIT_MASK(EASING_FRAC_BITS);
+
+	return table[idx] +
+	       (((table[idx + 1] - table[idx]) * frac) >> EASING_FRAC_BITS);
+}
@@ -0,0 +1,542 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+#include <lumen/easing.h>
+#include <lumen/segment.h>
+#ifdef CONFIG_LUMEN_WS2812_STRIP
+#include <lumen/drivers/ws2812.h>
+#endif
+
+#ifdef CONFIG_LUMEN_SEGMENT_DITHER
+#include "dither.h"
+#endif
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(segment, CONFIG_LED_STRIP_LOG_LEVEL);
+
+/* Extend the range [*first, *end) to cover len pixels from start. */
+static void extend(size_t *first, size_t *end, size_t start, size_t len)
+{
+	if (len == 0) {
+		return;
+	}
+
+	if (*first >= *end) {
+		*first = start;
+		*end = start + len;
+	} else {
+		*first = MIN(*first, start);
+		*end = MAX(*end, start + len);
+	}
+}
+
+/* Integer crossfade, weight 0 keeps from and EASING_WEIGHT_MAX gives to. */
+static void blend(struct led_rgb *to, const struct led_rgb *from, size_t len,
+		  uint32_t weight)
+{
+	const uint32_t keep = EASING_WEIGHT_MAX - weight;
+
+	for (size_t i = 0; i < len; i++) {
+		to[i].r = (from[i].r * keep + to[i].r * weight) >> 8;
+		to[i].g = (from[i].g * keep + to[i].g * weight) >> 8;
+		to[i].b = (from[i].b * keep + to[i].b * weight) >> 8;
+	}
+}
+
+int64_t segment_strip_now(const struct segment_strip *strip)
+{
+	return strip->clock != NULL ? strip->clock() : k_uptime_get();
+}
+
+#ifdef CONFIG_LUMEN_SEGMENT_PRESENT_LEAD_MS
+#define PRESENT_LEAD_MS CONFIG_LUMEN_SEGMENT_PRESENT_LEAD_MS
+#else
+#define PRESENT_LEAD_MS 0
+#endif
+
+/*
+ * Time to render for. Without changes to show right away, frames due within
+ * the lead time are rendered now and presented when they are due.
+ */
+static int64_t render_time(const struct segment_strip *strip, int64_t now)
+{
+	int64_t due = INT64_MAX;
+
+	if (PRESENT_LEAD_MS == 0 || strip->clear_first < strip->clear_end) {
+		return now;
+	}
+
+	for (size_t i = 0; i < strip->num_segments; i++) {
+		const struct segment *seg = &strip->segments[i];
+
+		if (seg->len == 0) {
+			continue;
+		}
+
+		if (seg->dirty) {
+			return now;
+		}
+
+		if (seg->interval_ms > 0 || seg->fade_ms > 0) {
+			due = MIN(due, seg->next_ms);
+		}
+	}
+
+	return due > now && due <= now + PRESENT_LEAD_MS ? due : now;
+}
+
+/* Frame interval a segment is rendered at, 0 if it is static. */
+static uint32_t seg_interval(const struct segment_strip *strip,
+			     const struct segment *seg)
+{
+	if (seg->interval_ms == SEGMENT_INTERVAL_AUTO) {
+		return strip->frame_interval_ms;
+	}
+
+	if (IS_ENABLED(CONFIG_LUMEN_SEGMENT_RATE) && seg->interval_ms > 0) {
+		return MAX(seg->interval_ms, strip->frame_interval_ms);
+	}
+
+	return seg->interval_ms;
+}
+
+#ifdef CONFIG_LUMEN_SEGMENT_RATE
+
+/* Frames without a backoff before the interval is shortened by 1 ms. */
+#define RATE_SETTLE_FRAMES 32
+
+/*
+ * Longer frames lengthen the interval right away, shorter ones shorten it
+ * a millisecond at a time once frames have been short for a while, so the
+ * rate does not flap around the limit.
+ */
+static void rate_update(struct segment_strip *strip, uint32_t frame_us)
+{
+	uint32_t target;
+
+	if (frame_us >= strip->frame_us) {
+		strip->frame_us = frame_us;
+	} else {
+		strip->frame_us -= (strip->frame_us - frame_us) / 8;
+	}
+
+	target = DIV_ROUND_UP(strip->frame_us * 100,
+			      CONFIG_LUMEN_SEGMENT_RATE_BUDGET_PERCENT *
+				      USEC_PER_MSEC);
+	target = CLAMP(target, CONFIG_LUMEN_SEGMENT_RATE_MIN_INTERVAL_MS,
+		       CONFIG_LUMEN_SEGMENT_RATE_MAX_INTERVAL_MS);
+
+	if (target > strip->frame_interval_ms) {
+		LOG_INF("frame interval %u ms, frames take %u us", target,
+			strip->frame_us);
+		strip->frame_interval_ms = target;
+		strip->rate_settle = 0;
+	} else if (target < strip->frame_interval_ms &&
+		   ++strip->rate_settle >= RATE_SETTLE_FRAMES) {
+		strip->frame_interval_ms--;
+		strip->rate_settle = 0;
+	} else if (target == strip->frame_interval_ms) {
+		strip->rate_settle = 0;
+	}
+}
+
+#endif /* CONFIG_LUMEN_SEGMENT_RATE */
+
+#ifdef CONFIG_LUMEN_SEGMENT_DITHER
+
+/*
+ * Dithered frames follow each other as fast as the strip sustains, the
+ * faster the less the levels are seen flickering.
+ */
+static uint32_t dither_interval(const struct segment_strip *strip)
+{
+#ifdef CONFIG_LUMEN_SEGMENT_RATE
+	return strip->frame_interval_ms;
+#else
+	ARG_UNUSED(strip);
+	return CONFIG_LUMEN_SEGMENT_DITHER_INTERVAL_MS;
+#endif
+}
+
+#endif /* CONFIG_LUMEN_SEGMENT_DITHER */
+
+static bool overlaps(const struct segment *seg, size_t start, size_t len)
+{
+	return seg->len > 0 && len > 0 &&
+	       start < seg->start + seg->len && seg->start < start + len;
+}
+
+void segment_strip_init(struct segment_strip *strip)
+{
+	k_mutex_init(&strip->lock);
+	k_sem_init(&strip->changed, 0, 1);
+
+	strip->dirty_first = 0;
+	strip->dirty_end = 0;
+	strip->clear_first = 0;
+	strip->clear_end = 0;
+	strip->frame_interval_ms = CONFIG_LUMEN_SEGMENT_AUTO_INTERVAL_MS;
+	strip->frame_us = 0;
+	strip->rate_settle = 0;
+	strip->dither_next_ms = 0;
+	strip->dither_active = false;
+
+#ifdef CONFIG_LUMEN_SEGMENT_DITHER
+	if (strip->wire_pixels != NULL) {
+		dither_init(strip->dither_err, strip->num_pixels);
+	}
+#endif
+
+	segment_strip_invalidate(strip);
+}
+
+int segment_configure(struct segment_strip *strip, size_t idx, size_t start,
+		      size_t len)
+{
+	struct segment *seg;
+
+	if (idx >= strip->num_segments || start > strip->num_pixels ||
+	    len > strip->num_pixels - start) {
+		return -EINVAL;
+	}
+
+	k_mutex_lock(&strip->lock, K_FOREVER);
+
+	for (size_t i = 0; i < strip->num_segments; i++) {
+		if (i != idx && overlaps(&strip->segments[i], start, len)) {
+			k_mutex_unlock(&strip->lock);
+			return -EINVAL;
+		}
+	}
+
+	seg = &strip->segments[idx];
+
+	if (seg->start == start && seg->len == len) {
+		k_mutex_unlock(&strip->lock);
+		return 0;
+	}
+
+	/* Turn off the pixels the segment covered so far. */
+	extend(&strip->clear_first, &strip->clear_end, seg->start, seg->len);
+
+	seg->start = start;
+	seg->len = len;
+	seg->fade_ms = 0;
+	seg->fade_pending = false;
+	seg->dirty = true;
+
+	k_mutex_unlock(&strip->lock);
+	k_sem_give(&strip->changed);
+
+	return 0;
+}
+
+int segment_set_effect(struct segment_strip *strip, size_t idx,
+		       segment_effect_t effect, struct led_rgb color,
+		       uint32_t interval_ms)
+{
+	return segment_fade_effect(strip, idx, effect, color, interval_ms, 0,
+				   EASING_LINEAR);
+}
+
+int segment_fade_effect(struct segment_strip *strip, size_t idx,
+			segment_effect_t effect, struct led_rgb color,
+			uint32_t interval_ms, uint32_t fade_ms,
+			enum easing curve)
+{
+	struct segment *seg;
+
+	if (idx >= strip->num_segments) {
+		return -EINVAL;
+	}
+
+	k_mutex_lock(&strip->lock, K_FOREVER);
+
+	seg = &strip->segments[idx];
+	seg->effect = effect;
+	seg->color = color;
+	seg->interval_ms = interval_ms;
+	seg->start_ms = segment_strip_now(strip);
+	if (strip->fade_pixels != NULL && fade_ms > 0) {
+		/* The snapshot is taken by the next render. */
+		seg->fade_ms = fade_ms;
+		seg->fade_curve = curve;
+		seg->fade_pending = true;
+	} else {
+		seg->fade_ms = 0;
+		seg->fade_pending = false;
+	}
+	seg->dirty = true;
+
+	k_mutex_unlock(&strip->lock);
+	k_sem_give(&strip->changed);
+
+	return 0;
+}
+
+int segment_set_effect_since(struct segment_strip *strip, size_t idx,
+			     segment_effect_t effect, struct led_rgb color,
+			     uint32_t interval_ms, int64_t start_ms)
+{
+	struct segment *seg;
+
+	if (idx >= strip->num_segments) {
+		return -EINVAL;
+	}
+
+	k_mutex_lock(&strip->lock, K_FOREVER);
+
+	seg = &strip->segments[idx];
+	seg->effect = effect;
+	seg->color = color;
+	seg->interval_ms = interval_ms;
+	seg->start_ms = start_ms;
+	seg->fade_ms = 0;
+	seg->fade_pending = false;
+	seg->dirty = true;
+
+	k_mutex_unlock(&strip->lock);
+	k_sem_give(&strip->changed);
+
+	return 0;
+}
+
+int segment_get_effect(struct segment_strip *strip, size_t idx,
+		       struct segment *seg)
+{
+	if (idx >= strip->num_segments) {
+		return -EINVAL;
+	}
+
+	k_mutex_lock(&strip->lock, K_FOREVER);
+	*seg = strip->segments[idx];
+	k_mutex_unlock(&strip->lock);
+
+	return 0;
+}
+
+int segment_find(struct segment_strip *strip, const char *name)
+{
+	for (size_t i = 0; i < strip->num_segments; i++) {
+		if (strip->segments[i].name != NULL &&
+		    strcmp(strip->segments[i].name, name) == 0) {
+			return i;
+		}
+	}
+
+	return -ENOENT;
+}
+
+void segment_strip_invalidate(struct segment_strip *strip)
+{
+	k_mutex_lock(&strip->lock, K_FOREVER);
+
+	for (size_t i = 0; i < strip->num_segments; i++) {
+		strip->segments[i].dirty = true;
+	}
+
+	/* Turn off pixels outside of any segment as well. */
+	extend(&strip->clear_first, &strip->clear_end, 0, strip->num_pixels);
+
+	k_mutex_unlock(&strip->lock);
+	k_sem_give(&strip->changed);
+}
+
+int segment_strip_render(struct segment_strip *strip)
+{
+	const int64_t clock_now = segment_strip_now(strip);
+#ifdef CONFIG_LUMEN_SEGMENT_RATE
+	const uint32_t start_cycles = k_cycle_get_32();
+#endif
+#ifdef CONFIG_LUMEN_SEGMENT_PRESENT_LEAD_MS
+	const int64_t tick_now = k_uptime_ticks();
+#endif
+	struct led_rgb *out = strip->pixels;
+	size_t first, count;
+	int rendered = 0;
+	int64_t now;
+	int rc;
+
+	k_mutex_lock(&strip->lock, K_FOREVER);
+
+	now = render_time(strip, clock_now);
+
+	/* Segments rendered below overwrite their part of this again. */
+	if (strip->clear_first < strip->clear_end) {
+		memset(&strip->pixels[strip->clear_first], 0,
+		       (strip->clear_end - strip->clear_first) *
+			       sizeof(struct led_rgb));
+		extend(&strip->dirty_first, &strip->dirty_end,
+		       strip->clear_first,
+		       strip->clear_end - strip->clear_first);
+		strip->clear_first = 0;
+		strip->clear_end = 0;
+	}
+
+	for (size_t i = 0; i < strip->num_segments; i++) {
+		struct segment *seg = &strip->segments[i];
+		struct led_rgb *pixels = &strip->pixels[seg->start];
+		uint32_t interval_ms = seg_interval(strip, seg);
+		int64_t t_ms;
+
+		if (seg->len == 0) {
+			continue;
+		}
+
+		/* Static segments are due again only while fading. */
+		if (!seg->dirty &&
+		    (now < seg->next_ms ||
+		     (interval_ms == 0 && seg->fade_ms == 0))) {
+			continue;
+		}
+
+		if (seg->fade_pending) {
+			memcpy(&strip->fade_pixels[seg->start], pixels,
+			       seg->len * sizeof(struct led_rgb));
+			seg->fade_pending = false;
+		}
+
+		/*
+		 * Render the frame that was due, so devices sharing the clock
+		 * show the same frame even if they are woken up a bit apart.
+		 */
+		t_ms = MAX(now - seg->start_ms, 0);
+		if (interval_ms > 0) {
+			t_ms -= t_ms % interval_ms;
+		}
+
+		if (seg->effect != NULL) {
+			seg->effect(seg, pixels, (uint32_t)t_ms);
+		} else {
+			memset(pixels, 0, seg->len * sizeof(struct led_rgb));
+		}
+
+		if (seg->fade_ms > 0) {
+			uint64_t elapsed = MAX(now - seg->start_ms, 0);
+			uint32_t progress = MIN(elapsed * EASING_PROGRESS_MAX /
+							seg->fade_ms,
+						EASING_PROGRESS_MAX);
+
+			if (progress < EASING_PROGRESS_MAX) {
+				blend(pixels, &strip->fade_pixels[seg->start],
+				      seg->len,
+				      easing_weight(seg->fade_curve, progress));
+				interval_ms = interval_ms == 0 ?
+					CONFIG_LUMEN_SEGMENT_FADE_INTERVAL_MS :
+					MIN(interval_ms,
+					    CONFIG_LUMEN_SEGMENT_FADE_INTERVAL_MS);
+			} else {
+				seg->fade_ms = 0;
+			}
+		}
+
+		seg->dirty = false;
+		seg->next_ms = now + interval_ms;
+		if (interval_ms > 0 && now >= seg->start_ms) {
+			/* Keep frames on the grid of the effect start. */
+			seg->next_ms -= (now - seg->start_ms) % interval_ms;
+		}
+		extend(&strip->dirty_first, &strip->dirty_end, seg->start,
+		       seg->len);
+		rendered++;
+	}
+
+	first = strip->dirty_first;
+	count = strip->dirty_end - strip->dirty_first;
+	strip->dirty_first = 0;
+	strip->dirty_end = 0;
+
+#ifdef CONFIG_LUMEN_SEGMENT_DITHER
+	/* Any pixel between two levels may change in a dithered frame. */
+	if (strip->wire_pixels != NULL &&
+	    (count > 0 || (strip->dither_active &&
+			   clock_now >= strip->dither_next_ms))) {
+		first = 0;
+		count = strip->num_pixels;
+		strip->dither_next_ms = clock_now + dither_interval(strip);
+	}
+#endif
+
+	k_mutex_unlock(&strip->lock);
+
+	/* Pixels are only written by this function, no need to hold the lock. */
+	if (count == 0) {
+		return 0;
+	}
+
+#ifdef CONFIG_LUMEN_SEGMENT_DITHER
+	if (strip->wire_pixels != NULL) {
+		/* Only read to time the next frame, a stale value is harmless. */
+		strip->dither_active = dither(strip->wire_pixels, strip->pixels,
+					      strip->dither_err,
+					      strip->num_pixels);
+		out = strip->wire_pixels;
+	}
+#endif
+
+#ifdef CONFIG_LUMEN_SEGMENT_PRESENT_LEAD_MS
+	if (now > clock_now) {
+		ws2812_present_at(strip->dev, tick_now + k_ms_to_ticks_ceil64(
+							 now - clock_now));
+	}
+#endif
+
+#ifdef CONFIG_LUMEN_WS2812_STRIP
+	rc = ws2812_update_rgb_range(strip->dev, out, strip->num_pixels, first,
+				     count);
+#else
+	rc = led_strip_update_rgb(strip->dev, out, strip->num_pixels);
+#endif
+	if (rc < 0) {
+		LOG_WRN("unable to update led strip (err %d)", rc);
+		return rc;
+	}
+
+#ifdef CONFIG_LUMEN_SEGMENT_RATE
+	/* Includes the time others preempted rendering and the transfer. */
+	k_mutex_lock(&strip->lock, K_FOREVER);
+	rate_update(strip, k_cyc_to_us_ceil32(k_cycle_get_32() - start_cycles));
+	k_mutex_unlock(&strip->lock);
+#endif
+
+	return rendered;
+}
+
+uint32_t segment_strip_frame_interval(const struct segment_strip *strip)
+{
+	return strip->frame_interval_ms;
+}
+
+void segment_strip_wait(struct segment_strip *strip, uint32_t max_ms)
+{
+	int64_t wait_ms = max_ms;
+	int64_t now;
+
+	k_mutex_lock(&strip->lock, K_FOREVER);
+
+	now = segment_strip_now(strip);
+	for (size_t i = 0; i < strip->num_segments; i++) {
+		const struct segment *seg = &strip->segments[i];
+
+		if (seg->len > 0 && (seg->interval_ms > 0 || seg->fade_ms > 0)) {
+			/* Wake up in time to render ahead. */
+			wait_ms = MIN(wait_ms, MAX(seg->next_ms -
+						   PRESENT_LEAD_MS - now, 0));
+		}
+	}
+
+	if (strip->dither_active) {
+		wait_ms = MIN(wait_ms, MAX(strip->dither_next_ms - now, 0));
+	}
+
+	k_mutex_unlock(&strip->lock);
+
+	(void)k_sem_take(&strip->changed, K_MSEC(wait_ms));
+}
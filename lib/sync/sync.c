@@ -0,0 +1,496 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/uuid.h>
+
+#include <lumen/sync.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(sync, CONFIG_LUMEN_SYNC_LOG_LEVEL);
+
+/* Service data UUID of the periodic advertising train, LSB first. */
+#define SYNC_UUID_VAL \
+	BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef3)
+
+#define SYNC_VERSION 1
+
+/* Periodic advertising interval in units of 1.25 ms. */
+#define SYNC_INTERVAL (CONFIG_LUMEN_SYNC_INTERVAL_MS * 4U / 5U)
+
+/* Supervision timeout of ten intervals, in units of 10 ms. */
+#define SYNC_TIMEOUT CLAMP(CONFIG_LUMEN_SYNC_INTERVAL_MS, 10, 0x4000)
+
+/*
+ * Airtime of an AUX_SYNC_IND on LE 2M carrying len bytes of advertising
+ * data: preamble, access address, header, extended header and CRC take
+ * about 21 bytes, at 4 us per byte. The report arrives after the whole PDU,
+ * the stamp refers to its start.
+ */
+#define SYNC_AIRTIME_US(len) (((len) + 21) * 4)
+
+/* Larger errors step the show clock, smaller ones are slewed out. */
+#define SYNC_STEP_US (20 * USEC_PER_MSEC)
+#define SYNC_SLEW_US 500
+
+/** Header of the service data following the UUID, little endian. */
+struct sync_hdr {
+	uint8_t version;
+	/** Incremented whenever the payload changes. */
+	uint8_t seq;
+	/** Show clock of the leader when the data was set. */
+	uint64_t time_us;
+} __packed;
+
+#define SYNC_DATA_MAX \
+	(BT_UUID_SIZE_128 + sizeof(struct sync_hdr) + CONFIG_LUMEN_SYNC_PAYLOAD_MAX)
+
+enum sync_role {
+	SYNC_ROLE_NONE,
+	SYNC_ROLE_LEADER,
+	SYNC_ROLE_FOLLOWER,
+};
+
+static const uint8_t sync_uuid[] = { SYNC_UUID_VAL };
+
+static enum sync_role role;
+
+static struct k_spinlock lock;
+static int64_t offset_us;
+static bool locked;
+
+static int64_t local_us(void)
+{
+	return k_ticks_to_us_floor64(k_uptime_ticks());
+}
+
+int64_t sync_time_us(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+	int64_t t = local_us() + offset_us;
+
+	k_spin_unlock(&lock, key);
+
+	return t;
+}
+
+int64_t sync_time_ms(void)
+{
+	return sync_time_us() / USEC_PER_MSEC;
+}
+
+bool sync_locked(void)
+{
+	return role == SYNC_ROLE_LEADER || locked;
+}
+
+#ifdef CONFIG_LUMEN_SYNC_LEADER
+
+static struct bt_le_ext_adv *adv;
+
+static K_MUTEX_DEFINE(payload_lock);
+static uint8_t payload[CONFIG_LUMEN_SYNC_PAYLOAD_MAX];
+static size_t payload_len;
+static uint8_t payload_seq;
+
+static const struct bt_data ext_ad[] = {
+	BT_DATA_BYTES(BT_DATA_UUID128_ALL, SYNC_UUID_VAL),
+};
+
+static void refresh_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(refresh_work, refresh_handler);
+
+/*
+ * Stamps the show clock into the advertising data. The controller sends
+ * whatever data is current at the next event, so the stamp is older than
+ * the event by up to the refresh period. Refreshing at a period that does
+ * not divide the interval makes that age sweep through the period, and the
+ * followers pick the freshest one.
+ */
+static void refresh_handler(struct k_work *work)
+{
+	static uint8_t data[SYNC_DATA_MAX];
+	struct sync_hdr hdr;
+	struct bt_data ad;
+	size_t len;
+	int err;
+
+	memcpy(data, sync_uuid, sizeof(sync_uuid));
+	len = sizeof(sync_uuid) + sizeof(hdr);
+
+	k_mutex_lock(&payload_lock, K_FOREVER);
+	memcpy(&data[len], payload, payload_len);
+	len += payload_len;
+	hdr.seq = payload_seq;
+	k_mutex_unlock(&payload_lock);
+
+	hdr.version = SYNC_VERSION;
+	hdr.time_us = sys_cpu_to_le64(sync_time_us());
+	memcpy(&data[sizeof(sync_uuid)], &hdr, sizeof(hdr));
+
+	ad = (struct bt_data)BT_DATA(BT_DATA_SVC_DATA128, data, len);
+
+	err = bt_le_per_adv_set_data(adv, &ad, 1);
+	if (err < 0) {
+		LOG_WRN("failed to set periodic advertising data (err %d)",
+			err);
+	}
+
+	k_work_reschedule(&refresh_work, K_MSEC(CONFIG_LUMEN_SYNC_REFRESH_MS));
+}
+
+int sync_leader_start(void)
+{
+	int err;
+
+	if (role != SYNC_ROLE_NONE) {
+		return -EALREADY;
+	}
+
+	err = bt_le_ext_adv_create(BT_LE_EXT_ADV_NCONN, NULL, &adv);
+	if (err < 0) {
+		LOG_ERR("failed to create advertising set (err %d)", err);
+		return err;
+	}
+
+	err = bt_le_ext_adv_set_data(adv, ext_ad, ARRAY_SIZE(ext_ad), NULL, 0);
+	if (err < 0) {
+		LOG_ERR("failed to set advertising data (err %d)", err);
+		goto fail;
+	}
+
+	err = bt_le_per_adv_set_param(adv,
+				      BT_LE_PER_ADV_PARAM(SYNC_INTERVAL,
+							  SYNC_INTERVAL,
+							  BT_LE_PER_ADV_OPT_NONE));
+	if (err < 0) {
+		LOG_ERR("failed to set periodic advertising params (err %d)",
+			err);
+		goto fail;
+	}
+
+	err = bt_le_per_adv_start(adv);
+	if (err < 0) {
+		LOG_ERR("failed to start periodic advertising (err %d)", err);
+		goto fail;
+	}
+
+	err = bt_le_ext_adv_start(adv, BT_LE_EXT_ADV_START_DEFAULT);
+	if (err < 0) {
+		LOG_ERR("failed to start extended advertising (err %d)", err);
+		(void)bt_le_per_adv_stop(adv);
+		goto fail;
+	}
+
+	role = SYNC_ROLE_LEADER;
+	k_work_reschedule(&refresh_work, K_NO_WAIT);
+
+	LOG_INF("broadcasting show clock every %u ms",
+		CONFIG_LUMEN_SYNC_INTERVAL_MS);
+
+	return 0;
+
+fail:
+	(void)bt_le_ext_adv_delete(adv);
+	adv = NULL;
+	return err;
+}
+
+int sync_leader_set_payload(const void *data, size_t len)
+{
+	if (len > CONFIG_LUMEN_SYNC_PAYLOAD_MAX) {
+		return -EMSGSIZE;
+	}
+
+	k_mutex_lock(&payload_lock, K_FOREVER);
+	memcpy(payload, data, len);
+	payload_len = len;
+	payload_seq++;
+	k_mutex_unlock(&payload_lock);
+
+	if (role == SYNC_ROLE_LEADER) {
+		k_work_reschedule(&refresh_work, K_NO_WAIT);
+	}
+
+	return 0;
+}
+
+#else
+
+int sync_leader_start(void)
+{
+	return -ENOTSUP;
+}
+
+int sync_leader_set_payload(const void *data, size_t len)
+{
+	return -ENOTSUP;
+}
+
+#endif /* CONFIG_LUMEN_SYNC_LEADER */
+
+#ifdef CONFIG_LUMEN_SYNC_FOLLOWER
+
+enum {
+	/* A sync to the leader is being created or established. */
+	FLAG_SYNCING,
+	/* Reports of the current sync were received. */
+	FLAG_RECEIVED,
+};
+
+static atomic_t flags;
+static sync_payload_cb_t payload_cb;
+static bt_addr_le_t leader_addr;
+static uint8_t leader_sid;
+static uint8_t last_seq;
+
+/* Offset samples of the last reports, only accessed from the RX context. */
+static int64_t samples[CONFIG_LUMEN_SYNC_WINDOW];
+static size_t num_samples;
+static size_t next_sample;
+
+static void scan_handler(struct k_work *work);
+static K_WORK_DEFINE(scan_work, scan_handler);
+
+static void create_handler(struct k_work *work);
+static K_WORK_DEFINE(create_work, create_handler);
+
+/* Scan while there is no sync, the controller needs it to create one. */
+static void scan_handler(struct k_work *work)
+{
+	int err;
+
+	if (atomic_test_bit(&flags, FLAG_RECEIVED)) {
+		err = bt_le_scan_stop();
+	} else {
+		err = bt_le_scan_start(BT_LE_SCAN_PASSIVE, NULL);
+		if (err == -EALREADY) {
+			err = 0;
+		}
+	}
+
+	if (err < 0) {
+		LOG_WRN("failed to change scanning (err %d)", err);
+	}
+}
+
+static void create_handler(struct k_work *work)
+{
+	struct bt_le_per_adv_sync_param param = { 0 };
+	struct bt_le_per_adv_sync *sync;
+	int err;
+
+	bt_addr_le_copy(&param.addr, &leader_addr);
+	param.sid = leader_sid;
+	param.skip = 0;
+	param.timeout = SYNC_TIMEOUT;
+
+	err = bt_le_per_adv_sync_create(&param, &sync);
+	if (err < 0) {
+		LOG_WRN("failed to create sync (err %d)", err);
+		atomic_clear_bit(&flags, FLAG_SYNCING);
+	}
+}
+
+static bool find_uuid(struct bt_data *data, void *user_data)
+{
+	bool *found = user_data;
+
+	if (data->type != BT_DATA_UUID128_ALL &&
+	    data->type != BT_DATA_UUID128_SOME) {
+		return true;
+	}
+
+	for (size_t i = 0; i + BT_UUID_SIZE_128 <= data->data_len;
+	     i += BT_UUID_SIZE_128) {
+		if (memcmp(&data->data[i], sync_uuid, BT_UUID_SIZE_128) == 0) {
+			*found = true;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void scan_recv(const struct bt_le_scan_recv_info *info,
+		      struct net_buf_simple *buf)
+{
+	struct net_buf_simple_state state;
+	bool found = false;
+
+	/* Only trains with periodic advertising are of interest. */
+	if (info->interval == 0 || atomic_test_bit(&flags, FLAG_SYNCING)) {
+		return;
+	}
+
+	net_buf_simple_save(buf, &state);
+	bt_data_parse(buf, find_uuid, &found);
+	net_buf_simple_restore(buf, &state);
+
+	if (!found || atomic_test_and_set_bit(&flags, FLAG_SYNCING)) {
+		return;
+	}
+
+	bt_addr_le_copy(&leader_addr, info->addr);
+	leader_sid = info->sid;
+	k_work_submit(&create_work);
+}
+
+static struct bt_le_scan_cb scan_cb = {
+	.recv = scan_recv,
+};
+
+static void synced(struct bt_le_per_adv_sync *sync,
+		   struct bt_le_per_adv_sync_synced_info *info)
+{
+	char addr[BT_ADDR_LE_STR_LEN];
+
+	bt_addr_le_to_str(info->addr, addr, sizeof(addr));
+	LOG_INF("synced to leader %s", addr);
+
+	num_samples = 0;
+	next_sample = 0;
+}
+
+static void term(struct bt_le_per_adv_sync *sync,
+		 const struct bt_le_per_adv_sync_term_info *info)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	/* The show clock keeps running with the last offset. */
+	locked = false;
+	k_spin_unlock(&lock, key);
+
+	LOG_INF("lost sync to leader (reason %u)", info->reason);
+
+	atomic_clear_bit(&flags, FLAG_RECEIVED);
+	atomic_clear_bit(&flags, FLAG_SYNCING);
+	k_work_submit(&scan_work);
+}
+
+/* Updates the show clock from a report received at rx_us. */
+static void handle_report(const uint8_t *data, size_t len, int64_t rx_us)
+{
+	struct sync_hdr hdr;
+	k_spinlock_key_t key;
+	int64_t best;
+	bool stepped = false;
+	bool changed;
+
+	if (len < sizeof(hdr)) {
+		return;
+	}
+
+	memcpy(&hdr, data, sizeof(hdr));
+	if (hdr.version != SYNC_VERSION) {
+		return;
+	}
+
+	samples[next_sample] = (int64_t)sys_le64_to_cpu(hdr.time_us) - rx_us +
+			       SYNC_AIRTIME_US(2 + BT_UUID_SIZE_128 + len);
+	next_sample = (next_sample + 1) % ARRAY_SIZE(samples);
+	num_samples = MIN(num_samples + 1, ARRAY_SIZE(samples));
+
+	/* Stale stamps and late reports only make a sample smaller. */
+	best = samples[0];
+	for (size_t i = 1; i < num_samples; i++) {
+		best = MAX(best, samples[i]);
+	}
+
+	key = k_spin_lock(&lock);
+	if (!locked || llabs(best - offset_us) > SYNC_STEP_US) {
+		offset_us = best;
+		stepped = true;
+		locked = true;
+	} else {
+		offset_us += CLAMP(best - offset_us, -SYNC_SLEW_US,
+				   SYNC_SLEW_US);
+	}
+	k_spin_unlock(&lock, key);
+
+	changed = hdr.seq != last_seq;
+	last_seq = hdr.seq;
+
+	if (stepped) {
+		LOG_INF("show clock stepped to %lld us", sync_time_us());
+	}
+
+	if ((stepped || changed) && payload_cb != NULL) {
+		payload_cb(&data[sizeof(hdr)], len - sizeof(hdr));
+	}
+}
+
+static bool parse_svc_data(struct bt_data *data, void *user_data)
+{
+	const int64_t *rx_us = user_data;
+
+	if (data->type != BT_DATA_SVC_DATA128 ||
+	    data->data_len < BT_UUID_SIZE_128 ||
+	    memcmp(data->data, sync_uuid, BT_UUID_SIZE_128) != 0) {
+		return true;
+	}
+
+	handle_report(&data->data[BT_UUID_SIZE_128],
+		      data->data_len - BT_UUID_SIZE_128, *rx_us);
+
+	return false;
+}
+
+static void recv(struct bt_le_per_adv_sync *sync,
+		 const struct bt_le_per_adv_sync_recv_info *info,
+		 struct net_buf_simple *buf)
+{
+	/* Taken first, everything after this adds to the latency. */
+	int64_t rx_us = local_us();
+
+	bt_data_parse(buf, parse_svc_data, &rx_us);
+
+	if (!atomic_test_and_set_bit(&flags, FLAG_RECEIVED)) {
+		k_work_submit(&scan_work);
+	}
+}
+
+static struct bt_le_per_adv_sync_cb sync_cb = {
+	.synced = synced,
+	.term = term,
+	.recv = recv,
+};
+
+int sync_follower_start(sync_payload_cb_t cb)
+{
+	if (role != SYNC_ROLE_NONE) {
+		return -EALREADY;
+	}
+
+	payload_cb = cb;
+	role = SYNC_ROLE_FOLLOWER;
+
+	bt_le_scan_cb_register(&scan_cb);
+	bt_le_per_adv_sync_cb_register(&sync_cb);
+
+	k_work_submit(&scan_work);
+
+	LOG_INF("looking for a leader");
+
+	return 0;
+}
+
+#else
+
+int sync_follower_start(sync_payload_cb_t cb)
+{
+	return -ENOTSUP;
+}
+
+#endif /* CONFIG_LUMEN_SYNC_FOLLOWER */
@@ -0,0 +1,319 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2023 Leon Rinkel
+# SPDX-License-Identifier: Apache-2.0
+
+"""RAM/ROM footprint of the lumen drivers, libraries and app.
+
+check:   Reads the linker map of a build, sums up the sections of the lumen
+         components and fails if one of them exceeds its budget. Run after
+         linking by the app.footprint twister scenarios, see
+         app/footprint/budget.yaml.
+
+summary: Collects the reports written by check, e.g. from twister-out, and
+         prints a table per backend, including the RAM each additional
+         pixel costs.
+
+Zephyr builds with -ffunction-sections and -fdata-sections, so every input
+section in the map is a single function or object, which is what the
+per-symbol lists show.
+"""
+
+import argparse
+import json
+import re
+import sys
+from pathlib import Path
+
+import yaml
+
+# Component by the library an object file is linked from.
+COMPONENTS = {
+    "driver": re.compile(r"drivers__ws2812[^(]*\.a\("),
+    "lib": re.compile(r"lib__(segment|effects|sync|anim)[^(]*\.a\("),
+    "app": re.compile(r"(^|/)libapp\.a\("),
+}
+
+BACKENDS = ("spi", "i2s", "uart", "gpio")
+
+# Output sections that are not loaded onto the target.
+NOLOAD_PREFIXES = (".debug", ".comment", ".ARM.attributes", ".stab")
+
+# Prefixes the compiler gives the section of each function or object.
+SECTION_PREFIXES = (".text.", ".rodata.", ".data.", ".bss.", ".noinit.")
+
+REGION_RE = re.compile(r"^(\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s*(\S*)$")
+OUTPUT_RE = re.compile(
+    r"^(\S+)?\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)(?:\s+load address 0x([0-9a-f]+))?$")
+INPUT_RE = re.compile(r"^ (\S+)(?:\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*))?$")
+INPUT_CONT_RE = re.compile(r"^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$")
+
+
+class MapParser:
+    """Sums up the input sections of a GNU ld map file per component.
+
+    An output section counts as RAM if it is placed in a writable memory
+    region and as ROM if it is placed or loaded in a read-only one, so
+    initialized data counts as both.
+    """
+
+    def __init__(self):
+        self.regions = []
+        self.usage = {name: {} for name in COMPONENTS}
+        self.ram = False
+        self.rom = False
+
+    def parse(self, path):
+        lines = Path(path).read_text().splitlines()
+
+        start = self._parse_regions(lines)
+        self._parse_sections(lines[start:])
+
+        return self.usage
+
+    def _parse_regions(self, lines):
+        in_config = False
+
+        for i, line in enumerate(lines):
+            if line.startswith("Memory Configuration"):
+                in_config = True
+            elif line.startswith("Linker script and memory map"):
+                return i + 1
+            elif in_config:
+                m = REGION_RE.match(line)
+                if m and m.group(1) not in ("Name", "*default*", "IDT_LIST"):
+                    origin = int(m.group(2), 16)
+                    self.regions.append((origin, origin + int(m.group(3), 16),
+                                         "w" in m.group(4)))
+
+        raise ValueError("no memory map found, is this a GNU ld map file?")
+
+    def _writable(self, addr):
+        for origin, end, writable in self.regions:
+            if origin <= addr < end:
+                return writable
+        return None
+
+    def _output_section(self, name, m):
+        self.ram = self.rom = False
+        if name.startswith(NOLOAD_PREFIXES):
+            return
+
+        writable = self._writable(int(m.group(2), 16))
+        self.ram = writable is True
+        self.rom = writable is False
+        if m.group(4) is not None:
+            self.rom = self._writable(int(m.group(4), 16)) is False
+
+    def _input_section(self, section, size, obj):
+        if size == 0 or not (self.ram or self.rom):
+            return
+
+        for name, pattern in COMPONENTS.items():
+            if pattern.search(obj):
+                for prefix in SECTION_PREFIXES:
+                    if section.startswith(prefix):
+                        section = section[len(prefix):]
+                        break
+                sym = self.usage[name].setdefault(section, {"ram": 0, "rom": 0})
+                sym["ram"] += size if self.ram else 0
+                sym["rom"] += size if self.rom else 0
+                return
+
+    def _parse_sections(self, lines):
+        # Long section names are put on a line of their own.
+        out_pending = None
+        in_pending = None
+
+        for line in lines:
+            if not line.strip():
+                continue
+
+            if out_pending is not None:
+                m = OUTPUT_RE.match(line)
+                name, out_pending = out_pending, None
+                if m:
+                    self._output_section(name, m)
+                    continue
+
+            if in_pending is not None:
+                m = INPUT_CONT_RE.match(line)
+                name, in_pending = in_pending, None
+                if m:
+                    self._input_section(name, int(m.group(2), 16), m.group(3))
+                    continue
+
+            if not line[0].isspace():
+                m = OUTPUT_RE.match(line)
+                if m:
+                    self._output_section(m.group(1), m)
+                else:
+                    out_pending = line.split()[0]
+                    self.ram = self.rom = False
+                continue
+
+            m = INPUT_RE.match(line)
+            if m is None:
+                continue
+            if m.group(2) is None:
+                in_pending = m.group(1)
+            else:
+                self._input_section(m.group(1), int(m.group(3), 16), m.group(4))
+
+
+def read_backend(config):
+    """Strip backend selected in a .config, with -stream for streaming I2S."""
+    options = {}
+    for line in Path(config).read_text().splitlines():
+        if "=" in line and not line.startswith("#"):
+            key, value = line.split("=", 1)
+            options[key] = value
+
+    for backend in BACKENDS:
+        if options.get(f"CONFIG_LUMEN_WS2812_STRIP_{backend.upper()}") == "y":
+            if options.get("CONFIG_LUMEN_WS2812_STRIP_I2S_STREAM") == "y":
+                return backend + "-stream"
+            return backend
+    return "none"
+
+
+def component_budget(budget, component, backend):
+    """Budget of a component, either flat or per backend."""
+    entry = budget.get(component)
+    if entry is None:
+        return None
+    if "ram" in entry or "rom" in entry:
+        return entry
+    return entry.get(backend, entry.get(backend.split("-")[0]))
+
+
+def cmd_check(args):
+    usage = MapParser().parse(args.map)
+    backend = read_backend(args.config)
+    budget = yaml.safe_load(Path(args.budget).read_text()) or {}
+    pixels = args.pixels
+    failed = []
+
+    report = {
+        "name": args.name,
+        "backend": backend,
+        "pixels": pixels,
+        "components": {},
+    }
+
+    print(f"footprint: {args.name or 'build'}, {backend} backend, {pixels} pixels")
+    print(f"{'component':<10} {'ram':>7} {'limit':>7} {'rom':>7} {'limit':>7} {'ram/px':>7}")
+
+    for component, symbols in usage.items():
+        ram = sum(s["ram"] for s in symbols.values())
+        rom = sum(s["rom"] for s in symbols.values())
+        limits = component_budget(budget, component, backend) or {}
+        ram_limit = None
+        rom_limit = limits.get("rom")
+        if "ram" in limits:
+            ram_limit = limits["ram"] + limits.get("ram_per_pixel", 0) * pixels
+
+        print(f"{component:<10} {ram:>7} {ram_limit if ram_limit is not None else '-':>7} "
+              f"{rom:>7} {rom_limit if rom_limit is not None else '-':>7} "
+              f"{ram / pixels if pixels else 0:>7.1f}")
+
+        if ram_limit is not None and ram > ram_limit:
+            failed.append(f"{component} RAM {ram} > {ram_limit}")
+        if rom_limit is not None and rom > rom_limit:
+            failed.append(f"{component} ROM {rom} > {rom_limit}")
+
+        report["components"][component] = {
+            "ram": ram,
+            "rom": rom,
+            "ram_limit": ram_limit,
+            "rom_limit": rom_limit,
+            "symbols": symbols,
+        }
+
+    for component, symbols in usage.items():
+        if not symbols:
+            continue
+        print(f"\n{component} symbols:")
+        print(f"{'ram':>7} {'rom':>7}  symbol")
+        for name, sym in sorted(symbols.items(),
+                                key=lambda item: -(item[1]["ram"] + item[1]["rom"])):
+            print(f"{sym['ram']:>7} {sym['rom']:>7}  {name}")
+
+    if args.output:
+        Path(args.output).write_text(json.dumps(report, indent=2) + "\n")
+
+    for failure in failed:
+        print(f"footprint budget exceeded: {failure}", file=sys.stderr)
+
+    return 1 if failed else 0
+
+
+def cmd_summary(args):
+    reports = []
+    for directory in args.dirs:
+        for path in sorted(Path(directory).rglob("footprint.json")):
+            reports.append(json.loads(path.read_text()))
+
+    if not reports:
+        print("no footprint.json found", file=sys.stderr)
+        return 1
+
+    by_backend = {}
+    for report in reports:
+        by_backend.setdefault(report["backend"], []).append(report)
+
+    for backend, builds in sorted(by_backend.items()):
+        builds.sort(key=lambda r: r["pixels"])
+        print(f"{backend}:")
+        print(f"{'pixels':>7} {'ram':>7} {'rom':>7}  " +
+              " ".join(f"{c + ' ram':>10}" for c in COMPONENTS))
+
+        for report in builds:
+            comps = report["components"]
+            ram = sum(c["ram"] for c in comps.values())
+            rom = sum(c["rom"] for c in comps.values())
+            print(f"{report['pixels']:>7} {ram:>7} {rom:>7}  " +
+                  " ".join(f"{comps.get(c, {}).get('ram', 0):>10}" for c in COMPONENTS))
+
+        # Fixed costs cancel out between the shortest and longest chain.
+        first, last = builds[0], builds[-1]
+        if last["pixels"] > first["pixels"]:
+            dpx = last["pixels"] - first["pixels"]
+            per_pixel = {
+                c: (last["components"][c]["ram"] - first["components"][c]["ram"]) / dpx
+                for c in COMPONENTS
+            }
+            print(f"ram per pixel: {sum(per_pixel.values()):.2f} (" +
+                  ", ".join(f"{c} {v:.2f}" for c, v in per_pixel.items()) + ")")
+        print()
+
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    check = sub.add_parser("check", help="check a build against a budget")
+    check.add_argument("--map", required=True, help="linker map of the build")
+    check.add_argument("--config", required=True, help=".config of the build")
+    check.add_argument("--pixels", required=True, type=int,
+                       help="chain-length of the led-strip alias")
+    check.add_argument("--budget", required=True, help="budget YAML file")
+    check.add_argument("--output", help="write the report as JSON")
+    check.add_argument("--name", default="", help="name of the build")
+
+    summary = sub.add_parser("summary", help="compare reports of several builds")
+    summary.add_argument("dirs", nargs="+",
+                         help="directories searched for footprint.json")
+
+    args = parser.parse_args()
+
+    if args.command == "check":
+        return cmd_check(args)
+    return cmd_summary(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
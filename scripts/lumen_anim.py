@@ -0,0 +1,239 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2023 Leon Rinkel
+# SPDX-License-Identifier: Apache-2.0
+
+"""Pre-rendered animations for the lumen app, see include/lumen/anim.h.
+
+encode: Packs raw RGB frames, e.g. from
+            ffmpeg -i show.mp4 -vf scale=30:1 -f rawvideo -pix_fmt rgb24 show.rgb
+        into an animation with a key frame every --key-interval frames and
+        delta frames in between.
+
+info:   Prints the size of an animation and the flash bandwidth playback
+        needs.
+
+Animations are uploaded to the device with the MCUmgr file system group,
+e.g. mcumgr fs upload show.lan /lfs/show.lan.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x4d4e414c
+VERSION = 1
+FLAG_LOOP = 0x01
+
+FRAME_KEY = 0
+FRAME_DELTA = 1
+
+OP_LITERAL = 0
+OP_RUN = 1
+OP_SKIP = 2
+OP_COPY = 3
+
+HDR = struct.Struct("<IBBHIHH")
+FRAME_HDR = struct.Struct("<BBH")
+
+MAX_COUNT = 64
+MAX_DIST = 256
+
+
+def code(op, count):
+    return bytes([op << 6 | (count - 1)])
+
+
+def match_len(a, i, b, j, limit):
+    n = 0
+    while n < limit and a[i + n] == b[j + n]:
+        n += 1
+    return n
+
+
+def encode_frame(cur, prev):
+    """Codes of a frame, a key frame without prev."""
+    out = bytearray()
+    literals = []
+    n = len(cur)
+    i = 0
+
+    def flush():
+        if literals:
+            out.extend(code(OP_LITERAL, len(literals)))
+            for px in literals:
+                out.extend(px)
+            literals.clear()
+
+    while i < n:
+        limit = min(MAX_COUNT, n - i)
+        best = (0, -1, 0, 0)
+
+        # Savings in bytes over literals for each op covering pixel i on.
+        if prev is not None:
+            skip = match_len(cur, i, prev, i, limit)
+            best = max(best, (3 * skip - 1, OP_SKIP, skip, 0))
+
+        run = 1
+        while run < limit and cur[i + run] == cur[i]:
+            run += 1
+        if run >= 2:
+            best = max(best, (3 * run - 4, OP_RUN, run, 0))
+
+        for dist in range(1, min(MAX_DIST, i) + 1):
+            length = 0
+            while length < limit and cur[i + length] == cur[i - dist + length]:
+                length += 1
+            if length >= 2:
+                best = max(best, (3 * length - 2, OP_COPY, length, dist))
+
+        saving, op, count, dist = best
+        if saving <= 0:
+            literals.append(cur[i])
+            if len(literals) == MAX_COUNT:
+                flush()
+            i += 1
+            continue
+
+        flush()
+        out.extend(code(op, count))
+        if op == OP_RUN:
+            out.extend(cur[i])
+        elif op == OP_COPY:
+            out.append(dist - 1)
+        i += count
+
+    flush()
+    return bytes(out)
+
+
+def decode_frame(ftype, codes, pixels):
+    """Reference decoder, checks the encoder."""
+    i = 0
+    pos = 0
+    pixels = list(pixels)
+    while pos < len(codes):
+        op, count = codes[pos] >> 6, (codes[pos] & 0x3f) + 1
+        pos += 1
+        if op == OP_LITERAL:
+            for _ in range(count):
+                pixels[i] = codes[pos:pos + 3]
+                pos += 3
+                i += 1
+        elif op == OP_RUN:
+            for _ in range(count):
+                pixels[i] = codes[pos:pos + 3]
+                i += 1
+            pos += 3
+        elif op == OP_SKIP:
+            assert ftype == FRAME_DELTA
+            i += count
+        else:
+            dist = codes[pos] + 1
+            pos += 1
+            for _ in range(count):
+                pixels[i] = pixels[i - dist]
+                i += 1
+    assert i == len(pixels)
+    return pixels
+
+
+def cmd_encode(args):
+    with open(args.input, "rb") as f:
+        raw = f.read()
+
+    frame_bytes = 3 * args.pixels
+    if not raw or len(raw) % frame_bytes:
+        sys.exit(f"{args.input}: not a whole number of {args.pixels} pixel "
+                 "RGB frames")
+
+    frames = []
+    prev = None
+    for k in range(len(raw) // frame_bytes):
+        data = raw[k * frame_bytes:(k + 1) * frame_bytes]
+        cur = [bytes(data[3 * j:3 * j + 3]) for j in range(args.pixels)]
+
+        if k % args.key_interval == 0:
+            ftype, codes = FRAME_KEY, encode_frame(cur, None)
+            check = [b""] * args.pixels
+        else:
+            ftype, codes = FRAME_DELTA, encode_frame(cur, prev)
+            check = prev
+        assert [bytes(p) for p in decode_frame(ftype, codes, check)] == cur
+
+        frames.append((ftype, codes))
+        prev = cur
+
+    max_len = max(len(codes) for _, codes in frames)
+    if max_len > 0xffff:
+        sys.exit("frames too large")
+
+    with open(args.output, "wb") as f:
+        f.write(HDR.pack(MAGIC, VERSION, FLAG_LOOP if args.loop else 0,
+                         args.pixels, len(frames), args.interval_ms,
+                         max_len))
+        for ftype, codes in frames:
+            f.write(FRAME_HDR.pack(ftype, 0, len(codes)))
+            f.write(codes)
+
+    return info(args.output, len(raw))
+
+
+def info(path, raw_len=None):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    (magic, version, flags, pixels, num_frames, interval_ms,
+     max_len) = HDR.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        sys.exit(f"{path}: not a version {VERSION} animation")
+
+    keys = 0
+    pos = HDR.size
+    for _ in range(num_frames):
+        ftype, _, length = FRAME_HDR.unpack_from(data, pos)
+        keys += ftype == FRAME_KEY
+        pos += FRAME_HDR.size + length
+
+    raw_len = raw_len or 3 * pixels * num_frames
+    seconds = num_frames * interval_ms / 1000
+    print(f"{pixels} pixels, {num_frames} frames ({keys} key) every "
+          f"{interval_ms} ms{', looped' if flags & FLAG_LOOP else ''}")
+    print(f"{len(data)} bytes, {100 * len(data) / raw_len:.1f}% of raw, "
+          f"largest frame {max_len} bytes")
+    if seconds > 0:
+        print(f"{len(data) / seconds / 1024:.1f} KiB/s from flash")
+
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    enc = sub.add_parser("encode", help="pack raw RGB frames")
+    enc.add_argument("input", help="raw RGB frames, 3 bytes per pixel")
+    enc.add_argument("output", help="animation to write")
+    enc.add_argument("--pixels", type=int, required=True,
+                     help="pixels per frame")
+    enc.add_argument("--interval-ms", type=int, default=20,
+                     help="time between frames")
+    enc.add_argument("--key-interval", type=int, default=50,
+                     help="frames from one key frame to the next")
+    enc.add_argument("--loop", action="store_true",
+                     help="start over after the last frame")
+
+    inf = sub.add_parser("info", help="describe an animation")
+    inf.add_argument("file")
+
+    args = parser.parse_args()
+
+    if args.command == "encode":
+        return cmd_encode(args)
+    return info(args.file)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
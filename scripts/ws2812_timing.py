@@ -0,0 +1,364 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2023 Leon Rinkel
+# SPDX-License-Identifier: Apache-2.0
+
+"""Bus settings of the lumen WS2812 SPI and I2S backends from LED timing.
+
+gen:   Reads the devicetree of a build and writes a header with the bus
+       clock, symbols and reset delay of every leonfyi,ws2812-spi and
+       leonfyi,ws2812-i2s node that has a led-timing property. Run at
+       configure time by drivers/ws2812/CMakeLists.txt.
+
+solve: Prints the settings for a timing and bus, to try out values.
+
+Every bit on the wire is a symbol of a number of bus bits, of which the
+first ones are high: 4 to 16 for SPI, packed back to back into 8 bit
+frames, and 4 for I2S (one nibble per bit). I2S nodes with dual-strip send
+one bit of each strip per frame of two 8 bit slots, so their symbols are
+16 bus bits of which only the first 7 of the strip's own slot may be high.
+For each bus clock the controller can actually produce and each symbol
+width, the high bit counts for a zero and a one that keep both high and
+both low times within the tolerance of the LED are searched. The solution
+with the shortest bit gives the shortest frame, ties go to the high times
+closest to nominal and then to the narrower symbol. Low times only have a
+lower bound, LEDs accept longer bits as long as the line does not stay low
+for a reset.
+"""
+
+import argparse
+import math
+import os
+import pickle
+import sys
+from dataclasses import dataclass
+
+# Nominal datasheet timing in ns: t0h, t1h, period, tolerance, reset.
+PRESETS = {
+    "ws2812": (350, 700, 1250, 150, 50000),
+    "ws2812b": (400, 800, 1250, 150, 280000),
+    "sk6812": (300, 600, 1200, 150, 80000),
+    "ws2813": (375, 875, 1250, 75, 300000),
+}
+
+# Widths of the symbols the SPI driver packs into its 8 bit frames.
+SPI_SYMBOL_BITS = range(4, 17)
+I2S_SYMBOL_BITS = 4
+# 16 bit stereo samples, two symbols per sample.
+I2S_FRAME_BITS = 32
+# 8 bit stereo samples in dual strip mode, one symbol per frame and strip.
+I2S_DUAL_SLOT_BITS = 8
+I2S_DUAL_FRAME_BITS = 16
+
+# Clocks the nRF SPI(M) peripherals support, nrfx rounds others down.
+NRF_SPI_FREQUENCIES = (125000, 250000, 500000, 1000000, 2000000, 4000000,
+                       8000000, 16000000, 32000000)
+
+# nRF I2S MCK dividers of the 32 MHz clock and MCK to LRCK ratios usable
+# with 16 bit samples, the driver picks the pair closest to the request.
+NRF_I2S_MCK_DIVS = (2, 3, 4, 5, 6, 8, 10, 11, 15, 16, 21, 23, 30, 31, 32, 42,
+                    63, 125)
+NRF_I2S_RATIOS = (32, 64, 96, 128, 192, 256, 384, 512)
+
+
+@dataclass
+class Timing:
+    t0h: int
+    t1h: int
+    period: int
+    tolerance: int
+    reset: int
+
+
+@dataclass
+class Symbols:
+    bit_ns: float
+    zero: int
+    one: int
+    bits: int
+
+    @property
+    def period(self):
+        return self.bit_ns * self.bits
+
+
+def node_timing(node):
+    """Timing of a node, the preset overridden by the ns properties."""
+    props = node.props
+    preset = props["led-timing"].val
+    values = list(PRESETS.get(preset, (None,) * 5))
+
+    for i, name in enumerate(("t0h-ns", "t1h-ns", "period-ns",
+                              "tolerance-ns", "reset-ns")):
+        if name in props:
+            values[i] = props[name].val
+
+    if None in values:
+        missing = [n for n, v in zip(("t0h-ns", "t1h-ns", "period-ns",
+                                      "tolerance-ns", "reset-ns"), values)
+                   if v is None]
+        sys.exit(f"{node.path}: led-timing \"{preset}\" needs "
+                 + ", ".join(missing))
+
+    return Timing(*values)
+
+
+def fits(timing, bit_ns, bits, high, nominal):
+    """Whether a symbol with high of bits bus bits high matches a bit."""
+    th = high * bit_ns
+    tl = (bits - high) * bit_ns
+
+    if abs(th - nominal) > timing.tolerance:
+        return False
+    if tl < timing.period - nominal - timing.tolerance:
+        return False
+    return tl < timing.reset / 2
+
+
+def symbols(timing, bit_ns, bits, max_high=None):
+    """High bit counts for a zero and a one at a bus bit time, or None."""
+    best = None
+    max_high = bits - 1 if max_high is None else max_high
+
+    for zero in range(1, max_high + 1):
+        for one in range(zero + 1, max_high + 1):
+            if not (fits(timing, bit_ns, bits, zero, timing.t0h) and
+                    fits(timing, bit_ns, bits, one, timing.t1h)):
+                continue
+            # Prefer the counts closest to the nominal high times.
+            err = (abs(zero * bit_ns - timing.t0h) +
+                   abs(one * bit_ns - timing.t1h))
+            if best is None or err < best[0]:
+                best = (err, zero, one)
+
+    if best is None:
+        return None
+    return Symbols(bit_ns, best[1], best[2], bits)
+
+
+def spi_frequencies(controller, max_frequency, timing):
+    """Clocks a SPI controller can run at, fastest first."""
+    if any(c in controller for c in ("nordic,nrf-spim", "nordic,nrf-spi")):
+        freqs = NRF_SPI_FREQUENCIES
+    else:
+        # Assume an exact clock, from the shortest bit allowed on.
+        shortest = max(timing.period - 4 * timing.tolerance, 1)
+        freqs = {round(1e9 * bits / p) for bits in SPI_SYMBOL_BITS
+                 for p in range(shortest, 4 * timing.period)}
+    return sorted((f for f in freqs if f <= max_frequency), reverse=True)
+
+
+def solve_spi(timing, controller, max_frequency):
+    """Clock and symbols of the shortest bit, closest to nominal on ties."""
+    best = None
+    for freq in spi_frequencies(controller, max_frequency, timing):
+        for bits in SPI_SYMBOL_BITS:
+            sym = symbols(timing, 1e9 / freq, bits)
+            if sym is None:
+                continue
+            err = (abs(sym.zero * sym.bit_ns - timing.t0h) +
+                   abs(sym.one * sym.bit_ns - timing.t1h))
+            key = (round(sym.period), err, bits)
+            if best is None or key < best[0]:
+                best = (key, freq, sym)
+    if best is None:
+        return None
+    return best[1], best[2]
+
+
+def nrf_i2s_lrck(requested):
+    """LRCK the nRF I2S driver ends up with for a requested one."""
+    return min((32e6 / div / ratio for div in NRF_I2S_MCK_DIVS
+                for ratio in NRF_I2S_RATIOS),
+               key=lambda lrck: abs(lrck - requested))
+
+
+def solve_i2s(timing, controller, dual=False):
+    if dual:
+        # The last bit of a slot stays low, the demux may switch late.
+        frame_bits, bits, max_high = (I2S_DUAL_FRAME_BITS, I2S_DUAL_FRAME_BITS,
+                                      I2S_DUAL_SLOT_BITS - 1)
+    else:
+        frame_bits, bits, max_high = I2S_FRAME_BITS, I2S_SYMBOL_BITS, None
+
+    # The driver takes the LRCK period in whole microseconds.
+    for lrck_us in range(1, 100):
+        lrck = 1e6 / lrck_us
+        if "nordic,nrf-i2s" in controller:
+            lrck = nrf_i2s_lrck(lrck)
+            # Transfers are timed with the period, it has to be the real one.
+            if abs(1e6 / lrck - lrck_us) > lrck_us / 20:
+                continue
+        sym = symbols(timing, 1e9 / lrck / frame_bits, bits, max_high)
+        if sym is not None:
+            return lrck_us, sym
+    return None
+
+
+def high_bits(count, bits):
+    return ((1 << count) - 1) << (bits - count)
+
+
+def describe(timing, sym):
+    return (f"bit {sym.period:.0f} ns, zero {sym.zero * sym.bit_ns:.0f}/"
+            f"{(sym.bits - sym.zero) * sym.bit_ns:.0f} ns, one "
+            f"{sym.one * sym.bit_ns:.0f}/"
+            f"{(sym.bits - sym.one) * sym.bit_ns:.0f} ns")
+
+
+def gen_node(node, out):
+    timing = node_timing(node)
+    controller = node.bus_node.compats if node.bus_node else []
+    prefix = f"WS2812_TIMING_{node.dep_ordinal}"
+    reset_us = math.ceil(timing.reset / 1000)
+
+    if "leonfyi,ws2812-spi" in node.compats:
+        max_frequency = node.props["spi-max-frequency"].val
+        res = solve_spi(timing, controller, max_frequency)
+        if res is None:
+            sys.exit(f"{node.path}: no SPI clock up to {max_frequency} Hz "
+                     "meets the LED timing")
+        freq, sym = res
+        out.append(f"/* {node.path}: {freq} Hz, {describe(timing, sym)} */")
+        out.append(f"#define {prefix}_SPI_FREQUENCY {freq}")
+        out.append(f"#define {prefix}_SPI_SYMBOL_BITS {sym.bits}")
+        out.append(f"#define {prefix}_SPI_ONE_FRAME "
+                   f"0x{high_bits(sym.one, sym.bits):04x}")
+        out.append(f"#define {prefix}_SPI_ZERO_FRAME "
+                   f"0x{high_bits(sym.zero, sym.bits):04x}")
+    else:
+        i2s = node.props["i2s-dev"].val
+        dual = node.props["dual-strip"].val
+        res = solve_i2s(timing, i2s.compats, dual)
+        if res is None:
+            sys.exit(f"{node.path}: no I2S frame clock meets the LED timing")
+        lrck_us, sym = res
+        out.append(f"/* {node.path}: LRCK period {lrck_us} us, "
+                   f"{describe(timing, sym)} */")
+        out.append(f"#define {prefix}_I2S_LRCK_PERIOD {lrck_us}")
+        if dual:
+            out.append(f"#define {prefix}_I2S_SLOT_ONE "
+                       f"0x{high_bits(sym.one, I2S_DUAL_SLOT_BITS):02x}")
+            out.append(f"#define {prefix}_I2S_SLOT_ZERO "
+                       f"0x{high_bits(sym.zero, I2S_DUAL_SLOT_BITS):02x}")
+        else:
+            out.append(f"#define {prefix}_I2S_NIBBLE_ONE "
+                       f"0x{high_bits(sym.one, I2S_SYMBOL_BITS):x}")
+            out.append(f"#define {prefix}_I2S_NIBBLE_ZERO "
+                       f"0x{high_bits(sym.zero, I2S_SYMBOL_BITS):x}")
+
+    out.append(f"#define {prefix}_RESET_DELAY {reset_us}")
+    out.append("")
+
+
+def cmd_gen(args):
+    sys.path.insert(0, os.path.join(args.zephyr_base, "scripts", "dts",
+                                    "python-devicetree", "src"))
+    with open(args.edt_pickle, "rb") as f:
+        edt = pickle.load(f)
+
+    out = [
+        "/* Generated by scripts/ws2812_timing.py, do not edit. */",
+        "",
+        "#ifndef WS2812_TIMING_GENERATED_H",
+        "#define WS2812_TIMING_GENERATED_H",
+        "",
+    ]
+
+    for compat in ("leonfyi,ws2812-spi", "leonfyi,ws2812-i2s"):
+        for node in edt.compat2okay.get(compat, []):
+            if "led-timing" in node.props:
+                gen_node(node, out)
+
+    out.append("#endif /* WS2812_TIMING_GENERATED_H */")
+
+    text = "\n".join(out) + "\n"
+    os.makedirs(os.path.dirname(args.header), exist_ok=True)
+    try:
+        with open(args.header) as f:
+            if f.read() == text:
+                return 0
+    except FileNotFoundError:
+        pass
+    with open(args.header, "w") as f:
+        f.write(text)
+
+    return 0
+
+
+def cmd_solve(args):
+    values = list(PRESETS[args.preset])
+    for i, v in enumerate((args.t0h, args.t1h, args.period, args.tolerance,
+                           args.reset)):
+        if v is not None:
+            values[i] = v
+    timing = Timing(*values)
+    controller = [args.controller]
+
+    if args.bus == "spi":
+        res = solve_spi(timing, controller, args.max_frequency)
+        if res is None:
+            print("no solution")
+            return 1
+        freq, sym = res
+        print(f"{freq} Hz, {sym.bits} bit symbols, one "
+              f"0x{high_bits(sym.one, sym.bits):04x}, zero "
+              f"0x{high_bits(sym.zero, sym.bits):04x}")
+    else:
+        dual = args.bus == "i2s-dual"
+        res = solve_i2s(timing, controller, dual)
+        if res is None:
+            print("no solution")
+            return 1
+        lrck_us, sym = res
+        if dual:
+            print(f"LRCK period {lrck_us} us, one "
+                  f"0x{high_bits(sym.one, I2S_DUAL_SLOT_BITS):02x}, zero "
+                  f"0x{high_bits(sym.zero, I2S_DUAL_SLOT_BITS):02x}")
+        else:
+            print(f"LRCK period {lrck_us} us, one "
+                  f"0x{high_bits(sym.one, I2S_SYMBOL_BITS):x}, zero "
+                  f"0x{high_bits(sym.zero, I2S_SYMBOL_BITS):x}")
+
+    print(describe(timing, sym))
+    if args.bus == "i2s-dual":
+        print(f"{24 * sym.period / 1000:.1f} us per RGB pixel of each strip")
+    else:
+        print(f"{24 * sym.period / 1000:.1f} us per RGB pixel")
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    gen = sub.add_parser("gen", help="write the header of a build")
+    gen.add_argument("--edt-pickle", required=True,
+                     help="edt.pickle of the build")
+    gen.add_argument("--zephyr-base", required=True,
+                     help="Zephyr tree, for the devicetree package")
+    gen.add_argument("--header", required=True, help="header to write")
+
+    solve = sub.add_parser("solve", help="print the settings for a timing")
+    solve.add_argument("bus", choices=("spi", "i2s", "i2s-dual"))
+    solve.add_argument("--preset", choices=PRESETS, default="ws2812")
+    solve.add_argument("--t0h", type=int)
+    solve.add_argument("--t1h", type=int)
+    solve.add_argument("--period", type=int)
+    solve.add_argument("--tolerance", type=int)
+    solve.add_argument("--reset", type=int)
+    solve.add_argument("--controller", default="nordic,nrf-spim",
+                       help="compatible of the SPI or I2S controller")
+    solve.add_argument("--max-frequency", type=int, default=32000000,
+                       help="spi-max-frequency")
+
+    args = parser.parse_args()
+
+    if args.command == "gen":
+        return cmd_gen(args)
+    return cmd_solve(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,17 @@
+#!/usr/bin/env bash
+# Copyright (c) 2023 Leon Rinkel
+# SPDX-License-Identifier: Apache-2.0
+#
+# Builds the sync BabbleSim test, run it with tests_scripts/sync.sh.
+
+set -ue
+
+: "${ZEPHYR_BASE:?ZEPHYR_BASE must be set to point to the zephyr root directory}"
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must be defined}"
+
+source ${ZEPHYR_BASE}/tests/bsim/compile.source
+
+app_root=$(realpath "$(dirname "${BASH_SOURCE[0]}")/../../..") \
+	app=tests/bsim/sync compile
+
+wait_for_background_jobs
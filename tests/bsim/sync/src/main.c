@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * The leader boots at simulation time 0 on an ideal clock, so its show
+ * clock is the simulation time. Followers boot later and on drifting
+ * clocks, and compare their show clock to the simulation time once locked.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+
+#include <lumen/sync.h>
+
+#include "bs_types.h"
+#include "bs_tracing.h"
+#include "bstests.h"
+#include "time_machine.h"
+
+#define SIM_SECONDS 20
+#define LOCK_TIMEOUT K_SECONDS(10)
+#define SETTLE_MS 1000
+#define CHECK_MS 5000
+#define CHECK_PERIOD_MS 37
+#define TOLERANCE_US 2000
+
+static const char payload[] = "lumen";
+
+extern enum bst_result_t bst_result;
+
+#define FAIL(...)                                                              \
+	do {                                                                   \
+		bst_result = Failed;                                           \
+		bs_trace_error_time_line(__VA_ARGS__);                         \
+	} while (0)
+
+#define PASS(...)                                                              \
+	do {                                                                   \
+		bst_result = Passed;                                           \
+		bs_trace_info_time(1, __VA_ARGS__);                            \
+	} while (0)
+
+static K_SEM_DEFINE(payload_sem, 0, 1);
+static bool payload_ok;
+
+static void payload_cb(const uint8_t *data, size_t len)
+{
+	payload_ok = len == sizeof(payload) &&
+		     memcmp(data, payload, sizeof(payload)) == 0;
+	k_sem_give(&payload_sem);
+}
+
+static void test_leader_main(void)
+{
+	int err;
+
+	err = bt_enable(NULL);
+	if (err < 0) {
+		FAIL("bt_enable failed (err %d)\n", err);
+		return;
+	}
+
+	err = sync_leader_set_payload(payload, sizeof(payload));
+	if (err < 0) {
+		FAIL("failed to set payload (err %d)\n", err);
+		return;
+	}
+
+	err = sync_leader_start();
+	if (err < 0) {
+		FAIL("failed to start leader (err %d)\n", err);
+		return;
+	}
+
+	PASS("leader broadcasting\n");
+}
+
+static void test_follower_main(void)
+{
+	int64_t max_err_us = 0;
+	int err;
+
+	err = bt_enable(NULL);
+	if (err < 0) {
+		FAIL("bt_enable failed (err %d)\n", err);
+		return;
+	}
+
+	err = sync_follower_start(payload_cb);
+	if (err < 0) {
+		FAIL("failed to start follower (err %d)\n", err);
+		return;
+	}
+
+	if (k_sem_take(&payload_sem, LOCK_TIMEOUT) < 0 || !sync_locked()) {
+		FAIL("no lock to the leader\n");
+		return;
+	}
+
+	if (!payload_ok) {
+		FAIL("payload mismatch\n");
+		return;
+	}
+
+	/* Let the window fill with fresher stamps than the first one. */
+	k_msleep(SETTLE_MS);
+
+	for (int t = 0; t < CHECK_MS; t += CHECK_PERIOD_MS) {
+		int64_t err_us = sync_time_us() - (int64_t)tm_get_abs_time();
+
+		max_err_us = MAX(max_err_us, llabs(err_us));
+		if (!sync_locked()) {
+			FAIL("lost lock to the leader\n");
+			return;
+		}
+
+		k_msleep(CHECK_PERIOD_MS);
+	}
+
+	if (max_err_us > TOLERANCE_US) {
+		FAIL("show clock off by up to %lld us\n", max_err_us);
+		return;
+	}
+
+	PASS("show clock within %lld us of the leader\n", max_err_us);
+}
+
+static void test_init(void)
+{
+	bst_ticker_set_next_tick_absolute(SIM_SECONDS * USEC_PER_SEC);
+	bst_result = In_progress;
+}
+
+static void test_tick(bs_time_t hw_device_time)
+{
+	if (bst_result != Passed) {
+		FAIL("test failed (not passed after %d seconds)\n",
+		     SIM_SECONDS);
+	}
+}
+
+static const struct bst_test_instance test_sync[] = {
+	{
+		.test_id = "leader",
+		.test_descr = "Broadcast the show clock and a payload",
+		.test_post_init_f = test_init,
+		.test_tick_f = test_tick,
+		.test_main_f = test_leader_main,
+	},
+	{
+		.test_id = "follower",
+		.test_descr = "Lock to the leader's show clock within "
+			      "2 ms and receive its payload",
+		.test_post_init_f = test_init,
+		.test_tick_f = test_tick,
+		.test_main_f = test_follower_main,
+	},
+	BSTEST_END_MARKER
+};
+
+struct bst_test_list *test_sync_install(struct bst_test_list *tests)
+{
+	return bst_add_tests(tests, test_sync);
+}
+
+bst_test_install_t test_installers[] = {
+	test_sync_install,
+	NULL
+};
+
+int main(void)
+{
+	bst_main();
+	return 0;
+}
@@ -0,0 +1,34 @@
+#!/usr/bin/env bash
+# Copyright (c) 2023 Leon Rinkel
+# SPDX-License-Identifier: Apache-2.0
+#
+# One leader and three followers, which boot at different times and whose
+# clocks run up to 50 ppm off. Every follower has to keep its show clock
+# within 2 ms of the leader's.
+
+simulation_id="lumen_sync"
+verbosity_level=2
+EXECUTE_TIMEOUT=120
+
+source ${ZEPHYR_BASE}/tests/bsim/sh_common.source
+
+cd ${BSIM_OUT_PATH}/bin
+
+exe=./bs_${BOARD}_tests_bsim_sync_prj_conf
+
+Execute ${exe} -v=${verbosity_level} -s=${simulation_id} -d=0 \
+	-testid=leader
+
+Execute ${exe} -v=${verbosity_level} -s=${simulation_id} -d=1 \
+	-testid=follower -start_offset=1234567
+
+Execute ${exe} -v=${verbosity_level} -s=${simulation_id} -d=2 \
+	-testid=follower -start_offset=2500000 -xo_drift=50e-6
+
+Execute ${exe} -v=${verbosity_level} -s=${simulation_id} -d=3 \
+	-testid=follower -start_offset=333333 -xo_drift=-50e-6
+
+Execute ./bs_2G4_phy_v1 -v=${verbosity_level} -s=${simulation_id} \
+	-D=4 -sim_length=20e6 $@
+
+wait_for_background_jobs
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Scheduling of timed transfers with the kernel timer stand-in. The start
+ * function records the tick it was called at in place of the peripheral.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "present.h"
+
+#define FRAME_TICKS k_ms_to_ticks_ceil64(20)
+#define NUM_FRAMES 50
+
+static struct ws2812_present present;
+static int64_t started_at;
+static int starts;
+
+static void start(void *user_data)
+{
+	ARG_UNUSED(user_data);
+
+	started_at = k_uptime_ticks();
+	starts++;
+}
+
+/* Wake up on a tick edge, so the busy-waits below start on a fresh tick. */
+static int64_t next_tick(void)
+{
+	k_sleep(K_TICKS(1));
+
+	return k_uptime_ticks();
+}
+
+static void *present_setup(void)
+{
+	zassert_ok(ws2812_present_init(&present, 0, start, NULL));
+
+	return NULL;
+}
+
+static void present_before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	(void)ws2812_present_wait(&present);
+	present.late = 0;
+	started_at = WS2812_PRESENT_NONE;
+	starts = 0;
+}
+
+ZTEST(ws2812_present, test_arm_without_tick)
+{
+	zassert_false(ws2812_present_pending(&present));
+	zassert_equal(ws2812_present_arm(&present), -EINVAL);
+	zassert_ok(ws2812_present_wait(&present));
+	zassert_equal(starts, 0);
+}
+
+ZTEST(ws2812_present, test_on_time)
+{
+	int64_t at = next_tick() + FRAME_TICKS;
+
+	ws2812_present_set(&present, at);
+	zassert_true(ws2812_present_pending(&present));
+	zassert_ok(ws2812_present_arm(&present));
+	zassert_false(ws2812_present_pending(&present));
+	zassert_equal(starts, 0, "started before the tick");
+
+	zassert_ok(ws2812_present_wait(&present));
+	zassert_equal(starts, 1);
+	zassert_equal(started_at, at, "started at %lld, not %lld", started_at,
+		      at);
+	zassert_equal(present.late, 0);
+}
+
+ZTEST(ws2812_present, test_late)
+{
+	int64_t at = next_tick();
+
+	ws2812_present_set(&present, at);
+	zassert_equal(ws2812_present_arm(&present), -ETIME);
+	zassert_equal(starts, 1, "late frame not started right away");
+	zassert_ok(ws2812_present_wait(&present));
+	zassert_equal(starts, 1);
+	zassert_equal(present.late, 1);
+}
+
+/* Frames on a fixed grid, with renders of varying length before each. */
+ZTEST(ws2812_present, test_periodic)
+{
+	int64_t at = next_tick() + FRAME_TICKS;
+
+	for (int i = 0; i < NUM_FRAMES; i++) {
+		/* Up to three quarters of the frame interval. */
+		k_busy_wait((i * 7919 % 15) * USEC_PER_MSEC);
+
+		ws2812_present_set(&present, at);
+		zassert_ok(ws2812_present_arm(&present), "frame %d late", i);
+		zassert_ok(ws2812_present_wait(&present));
+		zassert_equal(started_at, at, "frame %d started at %lld, not %lld",
+			      i, started_at, at);
+
+		at += FRAME_TICKS;
+	}
+
+	zassert_equal(starts, NUM_FRAMES);
+	zassert_equal(present.late, 0);
+}
+
+/* A render overrunning its frame only delays that frame. */
+ZTEST(ws2812_present, test_missed_deadline)
+{
+	int64_t at = next_tick() + FRAME_TICKS;
+
+	k_busy_wait(2 * k_ticks_to_us_ceil64(FRAME_TICKS));
+
+	ws2812_present_set(&present, at);
+	zassert_equal(ws2812_present_arm(&present), -ETIME);
+	zassert_ok(ws2812_present_wait(&present));
+	zassert_true(started_at > at);
+
+	/* Skip the missed frames and get back on the grid. */
+	at += DIV_ROUND_UP(k_uptime_ticks() - at, FRAME_TICKS) * FRAME_TICKS;
+	if (at - k_uptime_ticks() < 2) {
+		at += FRAME_TICKS;
+	}
+
+	ws2812_present_set(&present, at);
+	zassert_ok(ws2812_present_arm(&present));
+	zassert_ok(ws2812_present_wait(&present));
+	zassert_equal(started_at, at);
+	zassert_equal(starts, 2);
+	zassert_equal(present.late, 1);
+}
+
+ZTEST_SUITE(ws2812_present, NULL, present_setup, present_before, NULL, NULL);
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2023 Leon Rinkel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Rings ws2812_ring_show() accepts, which are only those loaded with the
+ * length of the last loaded ring.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "ring.h"
+
+static struct ws2812_rings rings;
+
+static void ring_before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	rings = (struct ws2812_rings){0};
+}
+
+ZTEST(ws2812_ring, test_never_loaded)
+{
+	for (size_t ring = 0; ring < WS2812_RING_MAX; ring++) {
+		zassert_false(ws2812_rings_loaded(&rings, ring),
+			      "ring %zu loaded", ring);
+	}
+
+	ws2812_rings_add(&rings, 2, 10);
+	zassert_true(ws2812_rings_loaded(&rings, 2));
+	zassert_false(ws2812_rings_loaded(&rings, 0));
+	zassert_false(ws2812_rings_loaded(&rings, 1));
+	zassert_false(ws2812_rings_loaded(&rings, 3));
+	zassert_false(ws2812_rings_loaded(&rings, WS2812_RING_MAX));
+}
+
+ZTEST(ws2812_ring, test_same_length)
+{
+	ws2812_rings_add(&rings, 0, 10);
+	ws2812_rings_add(&rings, 1, 10);
+	ws2812_rings_add(&rings, WS2812_RING_MAX - 1, 10);
+
+	zassert_true(ws2812_rings_loaded(&rings, 0));
+	zassert_true(ws2812_rings_loaded(&rings, 1));
+	zassert_true(ws2812_rings_loaded(&rings, WS2812_RING_MAX - 1));
+	zassert_equal(rings.len, 10);
+}
+
+/* The stride changed, so the other rings are partly overwritten. */
+ZTEST(ws2812_ring, test_other_length)
+{
+	ws2812_rings_add(&rings, 0, 10);
+	ws2812_rings_add(&rings, 1, 10);
+	ws2812_rings_add(&rings, 1, 12);
+
+	zassert_false(ws2812_rings_loaded(&rings, 0), "ring 0 kept");
+	zassert_true(ws2812_rings_loaded(&rings, 1));
+	zassert_equal(rings.len, 12);
+
+	/* Going back to the old length does not bring them back. */
+	ws2812_rings_add(&rings, 2, 10);
+	zassert_false(ws2812_rings_loaded(&rings, 0));
+	zassert_false(ws2812_rings_loaded(&rings, 1));
+	zassert_true(ws2812_rings_loaded(&rings, 2));
+}
+
+ZTEST_SUITE(ws2812_ring, NULL, NULL, ring_before, NULL, NULL);